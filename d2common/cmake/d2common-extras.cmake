@@ -0,0 +1,4 @@
+# Build options shared with the packages depending on d2common.
+# SIMD kernels use NEON by default on aarch64.
+# There is no runtime CPU dispatch, so only enable AVX2 when the target CPUs support AVX2 and FMA.
+option(ENABLE_AVX2 "Compile x86 SIMD kernels with -mavx2 (fused remap) and -mavx2 -mfma (descriptor matcher)" OFF)
@@ -1,5 +1,6 @@
 #pragma once
 #include <ros/ros.h>
+#include <algorithm>
 #include <swarm_msgs/Pose.h>
 #include <swarm_msgs/swarm_lcm_converter.hpp>
 #include "d2landmarks.h"
@@ -26,6 +27,8 @@ struct StereoFrame {
     std::vector<int> right_camera_indices;
     std::vector<CamIdType> left_camera_ids;
     std::vector<CamIdType> right_camera_ids;
+    //Owners of image data shared with the ROS messages (zero-copy ingestion)
+    std::vector<std::shared_ptr<const void>> image_holders;
 
     StereoFrame():stamp(0) {
 
@@ -76,6 +79,7 @@ struct VisualImageDesc {
     double stamp;
     cv::Mat raw_image;
     cv::Mat raw_depth_image;
+    std::vector<std::shared_ptr<const void>> raw_image_holders; //Keep the messages raw_image may point to
     int drone_id = 0;
     FrameIdType frame_id = 0; 
     //The index of view; In stereo. 0 left 1 right + 2 * camera_index are different camera
@@ -90,6 +94,9 @@ struct VisualImageDesc {
     std::vector<float> image_desc;
     std::vector<float> landmark_descriptor;
     std::vector<float> landmark_scores;
+    //Compacted frames keep int8 descriptors instead: desc = int8 * landmark_descriptor_scale
+    std::vector<int8_t> landmark_descriptor_int8;
+    float landmark_descriptor_scale = 0;
     bool prevent_adding_db = false;
     bool is_lazy_frame = false; //if true no features casue it's a lazy frame send from remote
 
@@ -143,9 +150,69 @@ struct VisualImageDesc {
         return size;
     }
     
+    static float quantizeDescriptors(const std::vector<float> & desc, std::vector<int8_t> & desc_int8) {
+        float max = 0;
+        for (auto v : desc) {
+            max = std::max(max, std::abs(v));
+        }
+        float scale = max > 0 ? max / 127.0f : 1.0f;
+        desc_int8.resize(desc.size());
+        for (size_t i = 0; i < desc.size(); i++) {
+            desc_int8[i] = (int8_t) std::round(desc[i] / scale);
+        }
+        return scale;
+    }
+
+    bool isCompacted() const {
+        return landmark_descriptor.empty() && !landmark_descriptor_int8.empty();
+    }
+
+    //Int8 descriptors of the frame, quantized into buf if the frame is not compacted
+    const int8_t * landmarkDescriptorInt8(std::vector<int8_t> & buf, float & scale) const {
+        if (isCompacted()) {
+            scale = landmark_descriptor_scale;
+            return landmark_descriptor_int8.data();
+        }
+        scale = quantizeDescriptors(landmark_descriptor, buf);
+        return buf.data();
+    }
+
+    std::vector<float> landmarkDescriptorFloat() const {
+        if (!isCompacted()) {
+            return landmark_descriptor;
+        }
+        std::vector<float> ret(landmark_descriptor_int8.size());
+        for (size_t i = 0; i < ret.size(); i++) {
+            ret[i] = landmark_descriptor_int8[i] * landmark_descriptor_scale;
+        }
+        return ret;
+    }
+
+    //Keep only what loop closure needs: SuperPoint landmarks, int8 descriptors and the poses.
+    void compact() {
+        if (!landmark_descriptor.empty()) {
+            landmark_descriptor_scale = quantizeDescriptors(landmark_descriptor, landmark_descriptor_int8);
+            std::vector<float>().swap(landmark_descriptor);
+        }
+        landmarks.erase(std::remove_if(landmarks.begin(), landmarks.end(), [](const LandmarkPerFrame & lm) {
+            return lm.type != LandmarkType::SuperPointLandmark;
+        }), landmarks.end());
+        landmarks.shrink_to_fit();
+        releaseRawImage();
+        std::vector<uint8_t>().swap(image);
+    }
+
+    size_t memoryBytes() const {
+        return sizeof(VisualImageDesc) + landmarks.capacity()*sizeof(LandmarkPerFrame) + 
+            (image_desc.capacity() + landmark_descriptor.capacity() + landmark_scores.capacity())*sizeof(float) +
+            landmark_descriptor_int8.capacity() + image.capacity() + 
+            raw_image.total()*raw_image.elemSize() + raw_depth_image.total()*raw_depth_image.elemSize();
+    }
+
     void releaseRawImage() {
         raw_image.release();
         raw_depth_image.release();
+        raw_image_holders.clear();
         image.clear();
     }
     
@@ -209,21 +276,25 @@ struct VisualImageDesc {
         
         img_desc.header.pose_drone = pose_drone.toLCM();
         img_desc.header.camera_extrinsic = extrinsic.toLCM();
-        if (send_features && landmark_descriptor.size() > 0) {
+        if (send_features && (landmark_descriptor.size() > 0 || isCompacted())) {
             if (compress_int8) {
                 //Not send scores currently
-                Eigen::Map<const VectorXf> desc0(landmark_descriptor.data(), landmark_descriptor.size());
-                img_desc.landmark_descriptor_size_int8 = landmark_descriptor.size();
-                img_desc.landmark_descriptor_int8.resize(landmark_descriptor.size());
                 img_desc.landmark_descriptor_size = 0;
-                auto max = desc0.cwiseAbs().maxCoeff();
-                for (int i = 0; i < landmark_descriptor.size(); i++) {
-                    img_desc.landmark_descriptor_int8[i] = (int8_t)(desc0[i] / max * 127);
-                }
                 img_desc.landmark_scores_size = 0;
+                if (isCompacted()) {
+                    img_desc.landmark_descriptor_int8 = landmark_descriptor_int8;
+                } else {
+                    Eigen::Map<const VectorXf> desc0(landmark_descriptor.data(), landmark_descriptor.size());
+                    img_desc.landmark_descriptor_int8.resize(landmark_descriptor.size());
+                    auto max = desc0.cwiseAbs().maxCoeff();
+                    for (int i = 0; i < landmark_descriptor.size(); i++) {
+                        img_desc.landmark_descriptor_int8[i] = (int8_t)(desc0[i] / max * 127);
+                    }
+                }
+                img_desc.landmark_descriptor_size_int8 = img_desc.landmark_descriptor_int8.size();
             } else {
-                img_desc.landmark_descriptor = landmark_descriptor;
-                img_desc.landmark_descriptor_size = landmark_descriptor.size();
+                img_desc.landmark_descriptor = landmarkDescriptorFloat();
+                img_desc.landmark_descriptor_size = img_desc.landmark_descriptor.size();
                 img_desc.landmark_descriptor_size_int8 = 0;
                 img_desc.landmark_scores_size = landmark_scores.size();
                 img_desc.landmark_scores = landmark_scores;
@@ -393,6 +464,30 @@ struct VisualImageDescArray {
         }
     }
 
+    void compact() {
+        for (auto & img : images) {
+            img.compact();
+        }
+        imu_buf = IMUBuffer();
+    }
+
+    bool isCompacted() const {
+        for (auto & img : images) {
+            if (img.isCompacted()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t memoryBytes() const {
+        size_t size = sizeof(VisualImageDescArray) + imu_buf.size()*sizeof(IMUData) + sld_win_status.capacity()*sizeof(FrameIdType);
+        for (auto & img : images) {
+            size += img.memoryBytes();
+        }
+        return size;
+    }
+
     void setTd(double td) {
         cur_td = td;
         for (auto & img : images) {
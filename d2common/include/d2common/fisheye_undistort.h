@@ -5,6 +5,7 @@
 #include <camodocal/camera_models/PinholeCamera.h>
 
 #include <d2common/utils.hpp>
+#include <d2common/fused_remap.h>
 #include <opencv2/core/cuda.hpp>
 #include <opencv2/cudawarping.hpp>
 
@@ -16,6 +17,12 @@
 #include "sensor_msgs/Image.h"
 #include <opencv2/cudaarithm.hpp>
 #include <opencv2/cudaimgproc.hpp>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
 
 namespace D2Common {
 
@@ -24,12 +31,17 @@ using D2Common::Utility::TicToc;
 #define DEG_TO_RAD (M_PI / 180.0)
 #define REMAP_FUNC cv::INTER_LINEAR
 // #define REMAP_FUNC cv::INTER_NEAREST
+#define UNDIST_MAP_CACHE_VERSION 1
+#define UNDIST_MAP_CACHE_MAX_MAPS 5
+#define UNDIST_MAP_CACHE_MAX_SIZE 16384
 class FisheyeUndist {
     typedef std::vector<std::pair<cv::Mat, cv::Mat>> MapArray;
     camodocal::CameraPtr cam;
 
     std::vector<cv::cuda::GpuMat> undistMapsGPUX;
     std::vector<cv::cuda::GpuMat> undistMapsGPUY;
+    MapArray cached_maps; //Loaded from the map cache, consumed by genOneUndistMap
+    std::string cache_key; //Camera parameters, mode, fov and output size of the maps
 
    public:
     enum UndistortType {
@@ -38,7 +50,14 @@ class FisheyeUndist {
         UndistortPinhole2  // two images for stereo, maybe slightly overlapped,
                            // this is for quadcam depth generation.
     };
-    MapArray undistMaps;
+    MapArray undistMaps; //CV_32FC2 maps
+    MapArray undistMapsFixed; //CV_16SC2 + CV_16UC1 fixed-point maps for the CPU remap
+
+    //Directory of the on-disk map cache, disabled if empty.
+    static std::string & mapCacheDir() {
+        static std::string dir;
+        return dir;
+    }
 
     cv::Mat fisheye2cam_pt;
     cv::Mat fisheye2cam_id;
@@ -79,16 +98,8 @@ class FisheyeUndist {
         fisheye2cam_pt = cv::Mat::zeros(raw_width, raw_height, CV_32FC2);
         fisheye2cam_id = cv::Mat::ones(raw_width, raw_height, CV_8UC1);
         fisheye2cam_id = fisheye2cam_id * 255;
-        undistMaps = generateAllUndistMap(cam, cameraRotation, imgWidth, fov);
-        // ROS_INFO("undismap size %ld", undistMaps.size());
-        if (enable_cuda) {
-            for (auto mat : undistMaps) {
-                cv::Mat maps[2];
-                cv::split(mat.first, maps);
-                undistMapsGPUX.push_back(cv::cuda::GpuMat(maps[0]));
-                undistMapsGPUY.push_back(cv::cuda::GpuMat(maps[1]));
-            }
-        }
+        undistMaps = buildMaps(cam, UndistortPinhole5, imgWidth, 0);
+        initMaps();
     }
 
     FisheyeUndist(camodocal::CameraPtr cam, int _id, double _fov,
@@ -105,17 +116,76 @@ class FisheyeUndist {
         fisheye2cam_pt = cv::Mat::zeros(raw_width, raw_height, CV_32FC2);
         fisheye2cam_id = cv::Mat::ones(raw_width, raw_height, CV_8UC1);
         fisheye2cam_id = fisheye2cam_id * 255;
+        undistMaps = buildMaps(cam, mode, imgWidth, imgHeight);
+        initMaps();
+        if (!photomertic.empty()) {
+            auto _photometics = undist_all(photomertic, true);
+            photometics = _photometics;
+            for (int i = 0; i < _photometics.size(); i++) {
+                cv::Mat bgr;
+                cv::cvtColor(_photometics[i], bgr, cv::COLOR_GRAY2BGR);
+                photometics_bgr.push_back(bgr);
+            }
+            if (enable_cuda) {
+                auto _photometics_gpu = undist_all_cuda(photomertic, true);
+                photometics_gpu = _photometics_gpu;
+                for (int i = 0; i < _photometics_gpu.size(); i++) {
+                    cv::cuda::GpuMat bgr_gpu;
+                    cv::cuda::cvtColor(_photometics_gpu[i], bgr_gpu,
+                                       cv::COLOR_GRAY2BGR);
+                    photometics_gpu_bgr.push_back(bgr_gpu);
+                }
+            }
+        } else {
+            printf("no photometric calibration file found\n");
+        }
+    }
+
+    MapArray buildMaps(camodocal::CameraPtr p_cam, UndistortType mode,
+                       int imgWidth, int imgHeight) {
+        TicToc tic;
+        std::string cache_path = mapCachePath(p_cam, mode, imgWidth, imgHeight);
+        bool cached = !cache_path.empty() && loadMapCache(cache_path);
+        MapArray maps = generateMaps(p_cam, mode, imgWidth, imgHeight);
+        if (cached && maps.size() != cached_maps.size()) {
+            //The generators consume one cached map each, a different count means the cache is stale
+            printf("[FisheyeUndist] Map cache %s has %ld maps, expected %ld; regenerating\n",
+                   cache_path.c_str(), cached_maps.size(), maps.size());
+            cached = false;
+            cached_maps.clear();
+            fisheye2cam_pt = cv::Mat::zeros(raw_width, raw_height, CV_32FC2);
+            fisheye2cam_id = cv::Mat::ones(raw_width, raw_height, CV_8UC1) * 255;
+            maps = generateMaps(p_cam, mode, imgWidth, imgHeight);
+        }
+        cached_maps.clear();
+        if (!cached && !cache_path.empty()) {
+            saveMapCache(cache_path, maps);
+        }
+        printf("[FisheyeUndist] %s %ld undistort maps cost %.1fms\n",
+               cached ? "Loaded" : "Generated", maps.size(), tic.toc());
+        return maps;
+    }
+
+    MapArray generateMaps(camodocal::CameraPtr p_cam, UndistortType mode,
+                          int imgWidth, int imgHeight) {
         if (mode == UndistortPinhole5) {
-            undistMaps =
-                generateAllUndistMap(cam, cameraRotation, imgWidth, fov);
+            return generateAllUndistMap(p_cam, cameraRotation, imgWidth, fov);
         } else if (mode == UndistortCylindrical) {
-            undistMaps = generateCylinderMap(cam, cameraRotation, imgWidth,
-                                             imgHeight, fov);
+            return generateCylinderMap(p_cam, cameraRotation, imgWidth,
+                                       imgHeight, fov);
         } else if (mode == UndistortPinhole2) {
-            undistMaps = generatePinhole2Map(cam, cameraRotation, imgWidth,
-                                             imgHeight, fov);
+            return generatePinhole2Map(p_cam, cameraRotation, imgWidth,
+                                       imgHeight, fov);
+        }
+        return MapArray();
+    }
+
+    void initMaps() {
+        for (auto & mat : undistMaps) {
+            cv::Mat map1, map2;
+            cv::convertMaps(mat.first, cv::Mat(), map1, map2, CV_16SC2);
+            undistMapsFixed.emplace_back(map1, map2);
         }
-        // ROS_INFO("undismap size %ld", undistMaps.size());
         if (enable_cuda) {
             for (auto mat : undistMaps) {
                 cv::Mat maps[2];
@@ -124,23 +194,127 @@ class FisheyeUndist {
                 undistMapsGPUY.push_back(cv::cuda::GpuMat(maps[1]));
             }
         }
-        if (!photomertic.empty()) {
-            auto _photometics = undist_all(photomertic, true);
-            auto _photometics_gpu = undist_all_cuda(photomertic, true);
-            photometics = _photometics;
-            photometics_gpu = _photometics_gpu;
-            for (int i = 0; i < _photometics.size(); i++) {
-                cv::Mat bgr;
-                cv::cvtColor(_photometics[i], bgr, cv::COLOR_GRAY2BGR);
-                photometics_bgr.push_back(bgr);
-                cv::cuda::GpuMat bgr_gpu;
-                cv::cuda::cvtColor(_photometics_gpu[i], bgr_gpu,
-                                   cv::COLOR_GRAY2BGR);
-                photometics_gpu_bgr.push_back(bgr_gpu);
+    }
+
+    std::string mapCacheKey(camodocal::CameraPtr p_cam, UndistortType mode,
+                            int imgWidth, int imgHeight) {
+        std::stringstream ss;
+        ss << p_cam->parametersToString() << "|mode " << mode << "|fov " << fov
+           << "|size " << imgWidth << "x" << imgHeight << "|id " << cam_id;
+        return ss.str();
+    }
+
+    std::string mapCachePath(camodocal::CameraPtr p_cam, UndistortType mode,
+                             int imgWidth, int imgHeight) {
+        std::string dir = mapCacheDir();
+        if (dir.empty()) {
+            return "";
+        }
+        //A leading ~ is the per-user home, e.g. ~/.ros
+        if (dir[0] == '~') {
+            const char * home = getenv("HOME");
+            if (home == nullptr) {
+                return "";
             }
-        } else {
-            printf("no photometric calibration file found\n");
+            dir = home + dir.substr(1);
+        }
+        cache_key = mapCacheKey(p_cam, mode, imgWidth, imgHeight);
+        char name[64] = {0};
+        sprintf(name, "/fisheye_undist_%016zx.bin", std::hash<std::string>()(cache_key));
+        return dir + name;
+    }
+
+    static void writeMat(std::ofstream & ofs, const cv::Mat & mat) {
+        int header[3] = {mat.rows, mat.cols, mat.type()};
+        ofs.write((const char *)header, sizeof(header));
+        cv::Mat cont = mat.isContinuous() ? mat : mat.clone();
+        ofs.write((const char *)cont.data, cont.total() * cont.elemSize());
+    }
+
+    static bool readMat(std::ifstream & ifs, cv::Mat & mat, int type) {
+        int header[3];
+        if (!ifs.read((char *)header, sizeof(header))) {
+            return false;
+        }
+        //The header comes from the file, check it before allocating
+        if (header[0] <= 0 || header[1] <= 0 || header[0] > UNDIST_MAP_CACHE_MAX_SIZE ||
+                header[1] > UNDIST_MAP_CACHE_MAX_SIZE || header[2] != type) {
+            return false;
+        }
+        mat.create(header[0], header[1], header[2]);
+        return (bool) ifs.read((char *)mat.data, mat.total() * mat.elemSize());
+    }
+
+    void saveMapCache(const std::string & path, const MapArray & maps) {
+        //Written to a temporary file and renamed, so a concurrent or interrupted write never leaves a partial cache
+        std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+        std::ofstream ofs(tmp_path, std::ios::binary);
+        if (!ofs.is_open()) {
+            printf("[FisheyeUndist] Failed to write map cache %s\n", tmp_path.c_str());
+            return;
+        }
+        int version = UNDIST_MAP_CACHE_VERSION;
+        int key_len = cache_key.size();
+        int num = maps.size();
+        ofs.write((const char *)&version, sizeof(int));
+        ofs.write((const char *)&key_len, sizeof(int));
+        ofs.write(cache_key.data(), key_len);
+        ofs.write((const char *)&num, sizeof(int));
+        for (auto & map : maps) {
+            writeMat(ofs, map.first);
+        }
+        writeMat(ofs, fisheye2cam_pt);
+        writeMat(ofs, fisheye2cam_id);
+        ofs.close();
+        if (!ofs || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            printf("[FisheyeUndist] Failed to write map cache %s\n", path.c_str());
+            std::remove(tmp_path.c_str());
+        }
+    }
+
+    bool loadMapCache(const std::string & path) {
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs.is_open()) {
+            return false;
+        }
+        int version = 0, key_len = 0, num = 0;
+        ifs.read((char *)&version, sizeof(int));
+        ifs.read((char *)&key_len, sizeof(int));
+        if (!ifs || version != UNDIST_MAP_CACHE_VERSION || key_len != cache_key.size()) {
+            return false;
+        }
+        std::string key(key_len, 0);
+        ifs.read(&key[0], key_len);
+        ifs.read((char *)&num, sizeof(int));
+        if (!ifs || key != cache_key || num <= 0 || num > UNDIST_MAP_CACHE_MAX_MAPS) {
+            return false;
         }
+        MapArray maps(num);
+        cv::Mat pt, id;
+        for (auto & map : maps) {
+            if (!readMat(ifs, map.first, CV_32FC2)) {
+                return false;
+            }
+        }
+        if (!readMat(ifs, pt, CV_32FC2) || !readMat(ifs, id, CV_8UC1) ||
+                pt.size() != fisheye2cam_pt.size() || id.size() != fisheye2cam_id.size()) {
+            return false;
+        }
+        cached_maps = maps;
+        fisheye2cam_pt = pt;
+        fisheye2cam_id = id;
+        return true;
+    }
+
+    //CPU undistortion with the fixed-point maps, fused with the photometric calibration and the gray conversion
+    cv::Mat undist_id(const cv::Mat & image, int _id, bool calib_photometric=false, bool to_gray=false) {
+        cv::Mat output, gain;
+        if (photometics.size() > 0 && calib_photometric) {
+            gain = (to_gray || image.channels() == 1) ? photometics[_id] : photometics_bgr[_id];
+        }
+        remapGain(image, output, undistMapsFixed[_id].first,
+                  undistMapsFixed[_id].second, gain, to_gray);
+        return output;
     }
 
     cv::cuda::GpuMat undist_id_cuda(cv::Mat image, int _id, bool calib_photometric=false) {
@@ -255,40 +429,17 @@ class FisheyeUndist {
                                     bool enable_rear = true) {
         std::vector<cv::Mat> ret;
         ret.resize(undistMaps.size());
-        bool disable[5] = {0};
+        std::vector<bool> disable(undistMaps.size(), false);
         disable[0] = !enable_top;
-        disable[5] = !enable_rear;
-        if (use_rgb) {
-#pragma omp parallel for num_threads(5)
-            for (unsigned int i = 0; i < undistMaps.size(); i++) {
-                if (!disable[i]) {
-                    cv::remap(image, ret[i], undistMaps[i].first,
-                              undistMaps[i].second, REMAP_FUNC);
-                    if (photometics.size() > 0) {
-                        cv::multiply(ret[i], photometics[i], ret[i]);
-                    }
-                }
-            }
-            return ret;
-        } else {
-            cv::Mat gray;
-            if (image.channels() == 3)
-                cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
-            else
-                gray = image;
-#pragma omp parallel for num_threads(5)
-            for (unsigned int i = 0; i < undistMaps.size(); i++) {
-                if (!disable[i]) {
-                    cv::remap(gray, ret[i], undistMaps[i].first,
-                              undistMaps[i].second, REMAP_FUNC);
-                    if (photometics.size() > 0) {
-                        cv::multiply(ret[i], photometics[i], ret[i]);
-                    }
-                }
+        if (undistMaps.size() == 5) {
+            disable[4] = !enable_rear;
+        }
+#pragma omp parallel for num_threads(undistMaps.size())
+        for (unsigned int i = 0; i < undistMaps.size(); i++) {
+            if (!disable[i]) {
+                ret[i] = undist_id(image, i, true, !use_rgb);
             }
-            return ret;
         }
-
         return ret;
     }
 
@@ -314,11 +465,11 @@ class FisheyeUndist {
                 if (!disable[i]) {
                     if (i > 4) {
                         cv::remap(image2, rights[i % 5],
-                                  undist2->undistMaps[i % 5].first,
-                                  undist2->undistMaps[i % 5].second, method);
+                                  undist2->undistMapsFixed[i % 5].first,
+                                  undist2->undistMapsFixed[i % 5].second, method);
                     } else {
-                        cv::remap(image1, lefts[i], undistMaps[i % 5].first,
-                                  undistMaps[i % 5].second, method);
+                        cv::remap(image1, lefts[i], undistMapsFixed[i % 5].first,
+                                  undistMapsFixed[i % 5].second, method);
                     }
                 }
             }
@@ -331,11 +482,11 @@ class FisheyeUndist {
                 if (!disable[i]) {
                     if (i > 4) {
                         cv::remap(gray2, rights[i % 5],
-                                  undist2->undistMaps[i % 5].first,
-                                  undist2->undistMaps[i % 5].second, method);
+                                  undist2->undistMapsFixed[i % 5].first,
+                                  undist2->undistMapsFixed[i % 5].second, method);
                     } else {
-                        cv::remap(gray1, lefts[i], undistMaps[i % 5].first,
-                                  undistMaps[i % 5].second, method);
+                        cv::remap(gray1, lefts[i], undistMapsFixed[i % 5].first,
+                                  undistMapsFixed[i % 5].second, method);
                     }
                 }
             }
@@ -562,6 +713,9 @@ class FisheyeUndist {
                                                 Eigen::Quaterniond rotation,
                                                 const unsigned &imgWidth,
                                                 const unsigned &imgHeight) {
+        if (_id < cached_maps.size()) {
+            return cached_maps[_id];
+        }
         cv::Mat map = cv::Mat(imgHeight, imgWidth, CV_32FC2);
         ROS_DEBUG("Generating map of size (%d,%d)", map.size[0], map.size[1]);
         ROS_DEBUG("Perspective facing (%.2f,%.2f,%.2f)",
@@ -606,10 +760,7 @@ class FisheyeUndist {
                                        ((double)0 - (double)imgHeight / 2),
                                        f_center);
         // std::cout << objPoint << std::endl;
-        cv::Mat map1, map2;
-        cv::convertMaps(map, cv::Mat(), map1, map2, CV_16SC2);
         return std::make_pair(map, cv::Mat());
-        // return std::make_pair(map1, map2);
     }
 
     std::pair<cv::Mat, cv::Mat> genOneUndistMap(int _id,
@@ -618,6 +769,9 @@ class FisheyeUndist {
                                                 const unsigned &imgWidth,
                                                 const unsigned &imgHeight,
                                                 const double &f_center) {
+        if (_id < cached_maps.size()) {
+            return cached_maps[_id];
+        }
         cv::Mat map = cv::Mat(imgHeight, imgWidth, CV_32FC2);
         ROS_DEBUG("Generating map of size (%d,%d)", map.size[0], map.size[1]);
         ROS_DEBUG("Perspective facing (%.2f,%.2f,%.2f)",
@@ -665,10 +819,7 @@ class FisheyeUndist {
                                        ((double)0 - (double)imgHeight / 2),
                                        f_center);
         // std::cout << objPoint << std::endl;
-        cv::Mat map1, map2;
-        cv::convertMaps(map, cv::Mat(), map1, map2, CV_16SC2);
         return std::make_pair(map, cv::Mat());
-        // return std::make_pair(map1, map2);
     }
 };
 }  // namespace D2Common
\ No newline at end of file
@@ -0,0 +1,13 @@
+#pragma once
+#include <opencv2/core.hpp>
+
+namespace D2Common {
+//Bilinear remap with fixed-point maps (CV_16SC2 + CV_16UC1 from cv::convertMaps, zero border), fused with the
+//photometric gain and the BGR to gray conversion: each output pixel is written once.
+//src: CV_8UC1 or CV_8UC3. gain: optional CV_32F with the channels of the output.
+void remapGain(const cv::Mat & src, cv::Mat & dst, const cv::Mat & map1, const cv::Mat & map2,
+    const cv::Mat & gain = cv::Mat(), bool to_gray = false);
+
+//dst = saturate(src * gain); gain may be nullptr. AVX2/NEON when available.
+void applyGainRow(const float * src, const float * gain, uint8_t * dst, int num);
+}
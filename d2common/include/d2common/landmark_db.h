@@ -0,0 +1,156 @@
+#pragma once
+#include "d2landmarks.h"
+#include <unordered_map>
+#include <vector>
+#include <memory>
+
+namespace D2Common {
+//Landmark database as a dense array of (id, landmark) pairs with a hash index from the id.
+//Iteration walks contiguous memory and insertion does not allocate a tree node.
+//Erase moves the last landmark into the freed slot, so references are invalidated by insertion and removal.
+class LandmarkDB {
+public:
+    typedef std::pair<LandmarkIdType, LandmarkPerId> value_type;
+    typedef std::vector<value_type>::iterator iterator;
+    typedef std::vector<value_type>::const_iterator const_iterator;
+protected:
+    std::vector<value_type> landmarks;
+    std::unordered_map<LandmarkIdType, size_t> index;
+public:
+    iterator begin() {
+        return landmarks.begin();
+    }
+    iterator end() {
+        return landmarks.end();
+    }
+    const_iterator begin() const {
+        return landmarks.begin();
+    }
+    const_iterator end() const {
+        return landmarks.end();
+    }
+    size_t size() const {
+        return landmarks.size();
+    }
+    bool empty() const {
+        return landmarks.empty();
+    }
+    iterator find(LandmarkIdType id) {
+        auto it = index.find(id);
+        return it == index.end() ? landmarks.end() : landmarks.begin() + it->second;
+    }
+    const_iterator find(LandmarkIdType id) const {
+        auto it = index.find(id);
+        return it == index.end() ? landmarks.end() : landmarks.begin() + it->second;
+    }
+    size_t count(LandmarkIdType id) const {
+        return index.count(id);
+    }
+    LandmarkPerId & at(LandmarkIdType id) {
+        return landmarks[index.at(id)].second;
+    }
+    const LandmarkPerId & at(LandmarkIdType id) const {
+        return landmarks[index.at(id)].second;
+    }
+    LandmarkPerId & operator[](LandmarkIdType id) {
+        auto it = index.find(id);
+        if (it != index.end()) {
+            return landmarks[it->second].second;
+        }
+        index[id] = landmarks.size();
+        landmarks.emplace_back(id, LandmarkPerId());
+        return landmarks.back().second;
+    }
+    void erase(LandmarkIdType id) {
+        auto it = index.find(id);
+        if (it == index.end()) {
+            return;
+        }
+        size_t slot = it->second;
+        index.erase(it);
+        if (slot + 1 != landmarks.size()) {
+            landmarks[slot] = std::move(landmarks.back());
+            index[landmarks[slot].first] = slot;
+        }
+        landmarks.pop_back();
+    }
+    void clear() {
+        landmarks.clear();
+        index.clear();
+    }
+    void reserve(size_t num) {
+        landmarks.reserve(num);
+        index.reserve(num);
+    }
+};
+
+//Estimated position and flag of a landmark, as published to the frontend modules
+struct LandmarkUpdate {
+    LandmarkIdType landmark_id;
+    int drone_id;
+    FrameIdType base_frame_id;
+    Eigen::Vector3d position;
+    LandmarkFlag flag;
+    LandmarkUpdate(const LandmarkPerId & lm):
+        landmark_id(lm.landmark_id), drone_id(lm.drone_id), base_frame_id(lm.base_frame_id),
+        position(lm.position), flag(lm.flag)
+    {}
+};
+
+//Landmarks changed since the previous version of a landmark database. Immutable once published,
+//so one delta is shared by all consumers and applied without holding the producer's lock.
+struct LandmarkDelta {
+    uint64_t version = 0;
+    std::vector<LandmarkUpdate> updates;
+};
+typedef std::shared_ptr<const LandmarkDelta> LandmarkDeltaPtr;
+
+//Fixed-size state blocks of landmarks, allocated in chunks so their addresses stay valid as Ceres parameter blocks.
+//Blocks of removed landmarks are recycled.
+class LandmarkStateStore {
+    static const int CHUNK_BLOCKS = 1024;
+    int block_size;
+    std::vector<std::unique_ptr<double[]>> chunks;
+    std::vector<double*> free_blocks;
+    std::unordered_map<LandmarkIdType, double*> index;
+public:
+    LandmarkStateStore(int _block_size): block_size(_block_size) {}
+    //Returns the existing block of the landmark or a new one
+    double * add(LandmarkIdType id) {
+        auto it = index.find(id);
+        if (it != index.end()) {
+            return it->second;
+        }
+        if (free_blocks.empty()) {
+            chunks.emplace_back(new double[CHUNK_BLOCKS*block_size]());
+            for (int i = CHUNK_BLOCKS - 1; i >= 0; i--) {
+                free_blocks.push_back(chunks.back().get() + i*block_size);
+            }
+        }
+        double * block = free_blocks.back();
+        free_blocks.pop_back();
+        index[id] = block;
+        return block;
+    }
+    void remove(LandmarkIdType id) {
+        auto it = index.find(id);
+        if (it == index.end()) {
+            return;
+        }
+        free_blocks.push_back(it->second);
+        index.erase(it);
+    }
+    bool has(LandmarkIdType id) const {
+        return index.find(id) != index.end();
+    }
+    double * at(LandmarkIdType id) const {
+        return index.at(id);
+    }
+    const std::unordered_map<LandmarkIdType, double*> & states() const {
+        return index;
+    }
+    int blockSize() const {
+        return block_size;
+    }
+};
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace D2Common {
+//Free list of fixed-size blocks, allocated in chunks. Blocks are recycled and never returned to the system,
+//so an object created and destroyed every solve costs a few pointer operations instead of malloc/free.
+template <size_t BlockSize, size_t Align, size_t ChunkBlocks = 1024>
+class FixedBlockPool {
+    union alignas(Align) Block {
+        Block * next;
+        unsigned char data[BlockSize];
+    };
+    std::vector<std::unique_ptr<Block[]>> chunks;
+    Block * free_list = nullptr;
+    std::mutex pool_lock;
+public:
+    void * allocate() {
+        const std::lock_guard<std::mutex> lock(pool_lock);
+        if (free_list == nullptr) {
+            chunks.emplace_back(new Block[ChunkBlocks]);
+            auto chunk = chunks.back().get();
+            for (size_t i = 0; i < ChunkBlocks; i++) {
+                chunk[i].next = free_list;
+                free_list = &chunk[i];
+            }
+        }
+        auto block = free_list;
+        free_list = block->next;
+        return block;
+    }
+
+    void deallocate(void * ptr) {
+        const std::lock_guard<std::mutex> lock(pool_lock);
+        auto block = static_cast<Block*>(ptr);
+        block->next = free_list;
+        free_list = block;
+    }
+
+    static FixedBlockPool & instance() {
+        static FixedBlockPool pool;
+        return pool;
+    }
+};
+
+//Derive T from PoolAllocated<T> to allocate it from a pool shared by all types of the same size and alignment.
+//Subclasses of T with a different size fall back to the global allocator.
+template <typename T>
+class PoolAllocated {
+public:
+    static void * operator new(size_t size) {
+        if (size != sizeof(T)) {
+            return ::operator new(size);
+        }
+        return FixedBlockPool<sizeof(T), alignof(T)>::instance().allocate();
+    }
+
+    static void operator delete(void * ptr, size_t size) {
+        if (size != sizeof(T)) {
+            ::operator delete(ptr);
+            return;
+        }
+        FixedBlockPool<sizeof(T), alignof(T)>::instance().deallocate(ptr);
+    }
+};
+}
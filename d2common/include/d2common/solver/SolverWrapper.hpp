@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <array>
 #include <ceres/ceres.h>
 #include <d2common/d2state.hpp>
 #include <d2common/solver/BaseParamResInfo.hpp>
@@ -9,6 +10,9 @@ namespace D2Common {
 class ResidualInfo;
 class D2EstimatorState;
 
+//Identifies a residual across solves: residual type followed by the ids of the states it connects
+typedef std::array<int64_t, 6> ResidualKey;
+
 struct SolverReport {
     int total_iterations = 0;
     double total_time = 0;
@@ -47,6 +51,20 @@ public:
     virtual void addResidual(ResidualInfo*residual_info) {
         residuals.push_back(residual_info);
     }
+    //Update protocol for callers that rebuild their residuals every solve:
+    //beginUpdate(), then keepResidual() or addKeyedResidual() for each residual, then endUpdate().
+    //By default the problem is simply rebuilt.
+    virtual void beginUpdate() {
+        reset();
+    }
+    //Returns the residual added with this key in a previous solve, nullptr if it has to be created
+    virtual ResidualInfo * keepResidual(const ResidualKey & key) {
+        return nullptr;
+    }
+    virtual void addKeyedResidual(ResidualInfo * residual_info, const ResidualKey & key) {
+        addResidual(residual_info);
+    }
+    virtual void endUpdate() {}
     virtual SolverReport solve() = 0;
     ceres::Problem & getProblem() {
         return *problem;
@@ -64,10 +82,29 @@ public:
 class CeresSolver : public SolverWrapper {
 protected:
     ceres::Solver::Options options;
+    //In incremental mode the problem persists across solves. Residuals neither kept nor
+    //re-added since beginUpdate() are removed by endUpdate(), together with orphaned parameter blocks.
+    bool incremental = false;
+    struct KeyedResidual {
+        ResidualInfo * info = nullptr;
+        ceres::ResidualBlockId block = nullptr;
+        bool keep = false;
+    };
+    std::map<ResidualKey, KeyedResidual> keyed_residuals;
+    std::vector<std::pair<ResidualKey, ResidualInfo*>> pending_residuals;
+    //Duplicated keys are not added, but may still be referenced by the marginalizer until the next update
+    std::vector<ResidualInfo*> dropped_residuals;
+    void clearDropped();
+    static void releaseResidual(ResidualInfo * residual_info);
+    ceres::Problem * createProblem() const;
 public:
-    CeresSolver(D2State * _state, ceres::Solver::Options _options): 
-            SolverWrapper(_state), options(_options)  {}
+    CeresSolver(D2State * _state, ceres::Solver::Options _options, bool _incremental = false);
     virtual void addResidual(ResidualInfo*residual_info) override;
+    void beginUpdate() override;
+    ResidualInfo * keepResidual(const ResidualKey & key) override;
+    void addKeyedResidual(ResidualInfo * residual_info, const ResidualKey & key) override;
+    void endUpdate() override;
+    void reset() override;
     SolverReport solve() override;
 };
 
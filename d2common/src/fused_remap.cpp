@@ -0,0 +1,117 @@
+#include <d2common/fused_remap.h>
+#include <opencv2/imgproc.hpp>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace D2Common {
+
+void applyGainRow(const float * src, const float * gain, uint8_t * dst, int num) {
+    //All paths round to nearest even, as cv::saturate_cast does, so they give the same pixels
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= num; i += 8) {
+        __m256 v = _mm256_loadu_ps(src + i);
+        if (gain != nullptr) {
+            v = _mm256_mul_ps(v, _mm256_loadu_ps(gain + i));
+        }
+        __m256i iv = _mm256_cvtps_epi32(v);
+        __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(iv), _mm256_extracti128_si256(iv, 1));
+        _mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(w, w));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 8 <= num; i += 8) {
+        float32x4_t a = vld1q_f32(src + i);
+        float32x4_t b = vld1q_f32(src + i + 4);
+        if (gain != nullptr) {
+            a = vmulq_f32(a, vld1q_f32(gain + i));
+            b = vmulq_f32(b, vld1q_f32(gain + i + 4));
+        }
+        uint16x4_t ua = vqmovun_s32(vcvtnq_s32_f32(a));
+        uint16x4_t ub = vqmovun_s32(vcvtnq_s32_f32(b));
+        vst1_u8(dst + i, vqmovn_u16(vcombine_u16(ua, ub)));
+    }
+#endif
+    for (; i < num; i++) {
+        dst[i] = cv::saturate_cast<uint8_t>(gain != nullptr ? src[i] * gain[i] : src[i]);
+    }
+}
+
+void remapGain(const cv::Mat & src, cv::Mat & dst, const cv::Mat & map1, const cv::Mat & map2,
+        const cv::Mat & gain, bool to_gray) {
+    const int cn = src.channels();
+    const int out_cn = (to_gray || cn == 1) ? 1 : cn;
+    if (src.depth() != CV_8U || (cn != 1 && cn != 3) || map1.type() != CV_16SC2 || map2.type() != CV_16UC1) {
+        //Unfused fallback, e.g. for float images
+        cv::Mat tmp;
+        cv::remap(src, tmp, map1, map2, cv::INTER_LINEAR);
+        if (out_cn != cn) {
+            cv::cvtColor(tmp, tmp, cv::COLOR_BGR2GRAY);
+        }
+        if (!gain.empty()) {
+            int type = tmp.type();
+            tmp.convertTo(tmp, CV_32F);
+            cv::multiply(tmp, gain, tmp);
+            tmp.convertTo(tmp, type);
+        }
+        dst = tmp;
+        return;
+    }
+    CV_Assert(gain.empty() || (gain.depth() == CV_32F && gain.channels() == out_cn && gain.size() == map1.size()));
+    cv::Mat out(map1.size(), CV_MAKETYPE(CV_8U, out_cn));
+    const int rows = src.rows, cols = src.cols;
+    const float inv_tab = 1.0f / cv::INTER_TAB_SIZE;
+    //OpenCV BGR2GRAY weights
+    const float gray_w[3] = {0.114f, 0.587f, 0.299f};
+    cv::parallel_for_(cv::Range(0, out.rows), [&](const cv::Range & range) {
+        std::vector<float> buf(out.cols * out_cn);
+        for (int y = range.start; y < range.end; y++) {
+            const cv::Vec2s * xy = map1.ptr<cv::Vec2s>(y);
+            const uint16_t * frac = map2.ptr<uint16_t>(y);
+            for (int x = 0; x < out.cols; x++) {
+                const int sx = xy[x][0], sy = xy[x][1];
+                const float fx = (frac[x] & (cv::INTER_TAB_SIZE - 1)) * inv_tab;
+                const float fy = (frac[x] >> cv::INTER_BITS) * inv_tab;
+                const float w[4] = {(1 - fx)*(1 - fy), fx*(1 - fy), (1 - fx)*fy, fx*fy};
+                const uint8_t * p[4] = {nullptr, nullptr, nullptr, nullptr};
+                if (sx >= 0 && sy >= 0 && sx + 1 < cols && sy + 1 < rows) {
+                    p[0] = src.ptr<uint8_t>(sy) + sx*cn;
+                    p[1] = p[0] + cn;
+                    p[2] = src.ptr<uint8_t>(sy + 1) + sx*cn;
+                    p[3] = p[2] + cn;
+                } else {
+                    //Border: neighbours outside the image are zero
+                    for (int k = 0; k < 4; k++) {
+                        int px = sx + (k & 1), py = sy + (k >> 1);
+                        if (px >= 0 && py >= 0 && px < cols && py < rows) {
+                            p[k] = src.ptr<uint8_t>(py) + px*cn;
+                        }
+                    }
+                }
+                float v[3] = {0, 0, 0};
+                for (int k = 0; k < 4; k++) {
+                    if (p[k] == nullptr) {
+                        continue;
+                    }
+                    for (int c = 0; c < cn; c++) {
+                        v[c] += w[k] * p[k][c];
+                    }
+                }
+                if (out_cn == 1 && cn == 3) {
+                    buf[x] = gray_w[0]*v[0] + gray_w[1]*v[1] + gray_w[2]*v[2];
+                } else {
+                    for (int c = 0; c < out_cn; c++) {
+                        buf[x*out_cn + c] = v[c];
+                    }
+                }
+            }
+            applyGainRow(buf.data(), gain.empty() ? nullptr : gain.ptr<float>(y), out.ptr<uint8_t>(y), out.cols*out_cn);
+        }
+    });
+    dst = out;
+}
+
+}
@@ -2,6 +2,27 @@
 #include <d2common/solver/BaseParamResInfo.hpp>
 
 namespace D2Common {
+CeresSolver::CeresSolver(D2State * _state, ceres::Solver::Options _options, bool _incremental): 
+        SolverWrapper(_state), options(_options), incremental(_incremental) {
+    delete problem;
+    problem = createProblem();
+}
+
+ceres::Problem * CeresSolver::createProblem() const {
+    ceres::Problem::Options problem_options;
+    //Residual and parameter blocks are removed every solve in incremental mode
+    problem_options.enable_fast_removal = incremental;
+    //Cost functions are released with their ResidualInfo, most of them back to a pool.
+    //Loss functions are shared and owned by the caller.
+    problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    if (incremental) {
+        //The problem persists, so parameterizations are shared and owned by the caller as well
+        problem_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    }
+    return new ceres::Problem(problem_options);
+}
+
 void CeresSolver::addResidual(ResidualInfo*residual_info) {
     auto pointers = residual_info->paramsPointerList(state);
     // printf("Add residual info %d", residual_info->residual_type);
@@ -11,6 +32,110 @@ void CeresSolver::addResidual(ResidualInfo*residual_info) {
     SolverWrapper::addResidual(residual_info);
 }
 
+void CeresSolver::releaseResidual(ResidualInfo * residual_info) {
+    delete residual_info->cost_function;
+    delete residual_info;
+}
+
+void CeresSolver::reset() {
+    delete problem;
+    problem = createProblem();
+    for (auto residual : residuals) {
+        releaseResidual(residual);
+    }
+    residuals.clear();
+    for (auto & it : keyed_residuals) {
+        releaseResidual(it.second.info);
+    }
+    keyed_residuals.clear();
+    for (auto & it : pending_residuals) {
+        releaseResidual(it.second);
+    }
+    pending_residuals.clear();
+    clearDropped();
+}
+
+void CeresSolver::clearDropped() {
+    for (auto residual : dropped_residuals) {
+        releaseResidual(residual);
+    }
+    dropped_residuals.clear();
+}
+
+void CeresSolver::beginUpdate() {
+    if (!incremental) {
+        reset();
+        return;
+    }
+    clearDropped();
+    for (auto & it : keyed_residuals) {
+        it.second.keep = false;
+    }
+}
+
+ResidualInfo * CeresSolver::keepResidual(const ResidualKey & key) {
+    if (!incremental) {
+        return nullptr;
+    }
+    auto it = keyed_residuals.find(key);
+    if (it == keyed_residuals.end()) {
+        return nullptr;
+    }
+    it->second.keep = true;
+    return it->second.info;
+}
+
+void CeresSolver::addKeyedResidual(ResidualInfo * residual_info, const ResidualKey & key) {
+    if (!incremental) {
+        addResidual(residual_info);
+        return;
+    }
+    //Adding an existing key replaces the residual
+    auto it = keyed_residuals.find(key);
+    if (it != keyed_residuals.end()) {
+        it->second.keep = false;
+    }
+    pending_residuals.emplace_back(key, residual_info);
+}
+
+void CeresSolver::endUpdate() {
+    if (!incremental) {
+        return;
+    }
+    //Stale blocks go first: the state of a removed frame may be reallocated at the same address.
+    for (auto it = keyed_residuals.begin(); it != keyed_residuals.end();) {
+        if (it->second.keep) {
+            ++it;
+            continue;
+        }
+        problem->RemoveResidualBlock(it->second.block);
+        releaseResidual(it->second.info);
+        it = keyed_residuals.erase(it);
+    }
+    std::vector<state_type*> param_blocks;
+    std::vector<ceres::ResidualBlockId> blocks;
+    problem->GetParameterBlocks(&param_blocks);
+    for (auto pointer : param_blocks) {
+        problem->GetResidualBlocksForParameterBlock(pointer, &blocks);
+        if (blocks.empty()) {
+            problem->RemoveParameterBlock(pointer);
+        }
+    }
+    for (auto & it : pending_residuals) {
+        auto residual_info = it.second;
+        if (keyed_residuals.find(it.first) != keyed_residuals.end()) {
+            dropped_residuals.push_back(residual_info);
+            continue;
+        }
+        auto & keyed = keyed_residuals[it.first];
+        keyed.info = residual_info;
+        keyed.block = problem->AddResidualBlock(residual_info->cost_function,
+            residual_info->loss_function, residual_info->paramsPointerList(state));
+        keyed.keep = true;
+    }
+    pending_residuals.clear();
+}
+
 SolverReport CeresSolver::solve() {
     ceres::Solver::Summary summary;
     ceres::Solve(options, problem, &summary);
@@ -43,9 +43,10 @@ SolverReport ConsensusSolver::solve() {
             delete problem;
         }
         ceres::Problem::Options problem_options;
+        //Loss functions are shared and owned by the caller
+        problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
         if (i != config.max_steps - 1) {
             problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
-            problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
             problem_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
             problem_options.manifold_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
         }
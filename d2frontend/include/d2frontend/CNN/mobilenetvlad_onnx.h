@@ -22,6 +22,9 @@ public:
             input_shape_{1, _height, _width, 1},
             results_{0}
     {
+        batch_input_shape_ = {_height, _width, 1};
+        batch_output_names_ = {output_name};
+        batch_output_shapes_ = {{NETVLAD_DESC_RAW_SIZE}};
         std::cout << "Trying to init MobileNetVLADONNX@" << engine_path << 
             " tensorrt " << use_tensorrt << " fp16 " << use_fp16 << " int8 " << use_int8 << 
             " pca " << params->enable_pca_netvlad << std::endl;
@@ -61,15 +64,44 @@ public:
         if (params->enable_perf_output) {
             printf("MobileNetVLADONNX::inference() took %f ms\n", tic.toc());
         }
+        return postprocess(results_.data());
+    }
+
+    //All images in one Run when the model has a dynamic batch, otherwise one by one.
+    std::vector<std::vector<float>> inference(const std::vector<cv::Mat> & inputs) {
+        std::vector<std::vector<float>> ret;
+        if (!dynamic_batch) {
+            for (auto & input : inputs) {
+                ret.emplace_back(inference(input));
+            }
+            return ret;
+        }
+        TicToc tic;
+        int batch = inputs.size();
+        prepareBatch(batch);
+        for (int b = 0; b < batch; b++) {
+            preprocessGray(inputs[b], batchInput(b), 1.0); // DO NOT SCALING HERE
+        }
+        doInferenceBatch();
+        for (int b = 0; b < batch; b++) {
+            ret.emplace_back(postprocess(batchOutput(0, b)));
+        }
+        if (params->enable_perf_output) {
+            printf("MobileNetVLADONNX::inference() batch %d took %f ms\n", batch, tic.toc());
+        }
+        return ret;
+    }
+
+    std::vector<float> postprocess(const float * results) const {
         // Perform PCA if neccasary
         if (pca_comp_T.rows() > 0) {
-            Eigen::Map<Eigen::VectorXf> desc(results_.data(), results_.size());
+            Eigen::Map<const Eigen::VectorXf> desc(results, NETVLAD_DESC_RAW_SIZE);
             Eigen::VectorXf desc_pca = pca_comp_T * (desc - pca_mean);
             // Normalize and return
             desc_pca /= desc_pca.norm();
             return std::vector<float>(desc_pca.data(), desc_pca.data() + desc_pca.size());
         }
-        return std::vector<float>(results_.begin(), results_.end());
+        return std::vector<float>(results, results + NETVLAD_DESC_RAW_SIZE);
     }
 };
 }
@@ -2,17 +2,159 @@
 #include "CNN_generic.h"
 #include <onnxruntime_cxx_api.h>
 namespace D2FrontEnd {
+struct ONNXRuntimeConfig {
+    bool use_cuda = true; //Otherwise only the CPU execution provider is used, TensorRT is ignored
+    int intra_op_threads = 1;
+    int inter_op_threads = 1; //Operators run in parallel when > 1
+    bool enable_mem_pattern = true;
+    bool enable_cpu_mem_arena = true;
+};
+
+//Must be set before the first network is created. All sessions share one Ort::Env and its thread pools,
+//so the networks together never use more than intra_op_threads + inter_op_threads threads.
+inline ONNXRuntimeConfig & onnxRuntimeConfig() {
+    static ONNXRuntimeConfig config;
+    return config;
+}
+
+inline Ort::Env & onnxSharedEnv() {
+    static Ort::Env env = [] {
+        auto & config = onnxRuntimeConfig();
+        const OrtApi & api = Ort::GetApi();
+        OrtThreadingOptions * tp_options = nullptr;
+        Ort::ThrowOnError(api.CreateThreadingOptions(&tp_options));
+        Ort::ThrowOnError(api.SetGlobalIntraOpNumThreads(tp_options, config.intra_op_threads));
+        Ort::ThrowOnError(api.SetGlobalInterOpNumThreads(tp_options, config.inter_op_threads));
+        Ort::Env _env(tp_options, ORT_LOGGING_LEVEL_WARNING, "D2SLAM");
+        api.ReleaseThreadingOptions(tp_options);
+        printf("[ONNX] Shared env: CUDA %d intra_op_threads %d inter_op_threads %d mem_pattern %d cpu_mem_arena %d\n", 
+            config.use_cuda, config.intra_op_threads, config.inter_op_threads, config.enable_mem_pattern, config.enable_cpu_mem_arena);
+        return _env;
+    }();
+    return env;
+}
+
+//Session options with the thread pools of the shared env, and CUDA provider if enabled.
+inline Ort::SessionOptions createSessionOptions() {
+    auto & config = onnxRuntimeConfig();
+    Ort::SessionOptions session_options;
+    session_options.DisablePerSessionThreads();
+    session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
+    if (config.inter_op_threads > 1) {
+        session_options.SetExecutionMode(ExecutionMode::ORT_PARALLEL);
+    }
+    if (!config.enable_mem_pattern) {
+        session_options.DisableMemPattern();
+    }
+    if (!config.enable_cpu_mem_arena) {
+        session_options.DisableCpuMemArena();
+    }
+    return session_options;
+}
+
+inline void appendCUDAProvider(Ort::SessionOptions & session_options) {
+    if (!onnxRuntimeConfig().use_cuda) {
+        return;
+    }
+    OrtCUDAProviderOptions options;
+    options.device_id = 0;
+    options.arena_extend_strategy = 0;
+    options.gpu_mem_limit = 1 * 1024 * 1024 * 1024;
+    options.cudnn_conv_algo_search = OrtCudnnConvAlgoSearch::OrtCudnnConvAlgoSearchExhaustive;
+    options.do_copy_in_default_stream = 1;
+    session_options.AppendExecutionProvider_CUDA(options);
+}
+
 class ONNXInferenceGeneric: public CNNInferenceGeneric {
 protected:
     Ort::Value input_tensor_{nullptr};
     Ort::Value output_tensor_{nullptr};
-    Ort::Env env;
     Ort::Session * session_ = nullptr;
     std::string output_name;
     float * input_image = nullptr;
     char engine_folder [256] = {0};
     char int8_calib_table_name_c [256] = {0};
+
+    //Batched inference. Shapes are without the batch dimension, the tensors are recreated only when the batch size changes.
+    bool dynamic_batch = false;
+    int batch_size_ = 0;
+    std::vector<int64_t> batch_input_shape_;
+    std::vector<std::string> batch_output_names_;
+    std::vector<std::vector<int64_t>> batch_output_shapes_;
+    std::vector<float> batch_input_;
+    std::vector<std::vector<float>> batch_outputs_;
+    Ort::Value batch_input_tensor_{nullptr};
+    std::vector<Ort::Value> batch_output_tensors_;
+
+    static int64_t shapeSize(const std::vector<int64_t> & shape) {
+        int64_t size = 1;
+        for (auto s : shape) {
+            size *= s;
+        }
+        return size;
+    }
+
+    void prepareBatch(int batch) {
+        if (batch == batch_size_) {
+            return;
+        }
+        auto memory_info = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+        std::vector<int64_t> shape{batch};
+        shape.insert(shape.end(), batch_input_shape_.begin(), batch_input_shape_.end());
+        batch_input_.resize(shapeSize(shape));
+        batch_input_tensor_ = Ort::Value::CreateTensor<float>(memory_info, batch_input_.data(), batch_input_.size(), 
+            shape.data(), shape.size());
+        batch_outputs_.resize(batch_output_shapes_.size());
+        batch_output_tensors_.clear();
+        for (size_t i = 0; i < batch_output_shapes_.size(); i++) {
+            std::vector<int64_t> out_shape{batch};
+            out_shape.insert(out_shape.end(), batch_output_shapes_[i].begin(), batch_output_shapes_[i].end());
+            batch_outputs_[i].resize(shapeSize(out_shape));
+            batch_output_tensors_.emplace_back(Ort::Value::CreateTensor<float>(memory_info, batch_outputs_[i].data(), 
+                batch_outputs_[i].size(), out_shape.data(), out_shape.size()));
+        }
+        batch_size_ = batch;
+    }
+
+    //Gray, resize and convert to float, written into dst of size width*height
+    void preprocessGray(const cv::Mat & input, float * dst, double scale) const {
+        cv::Mat _input;
+        if (input.channels() == 3) {
+            cv::cvtColor(input, _input, cv::COLOR_BGR2GRAY);
+        } else {
+            _input = input;
+        }
+        if (_input.rows != height || _input.cols != width) {
+            cv::resize(_input, _input, cv::Size(width, height));
+        }
+        cv::Mat dst_mat(height, width, CV_32F, dst);
+        _input.convertTo(dst_mat, CV_32F, scale);
+    }
+
+    //Input of the b-th image in the batch, of size width*height
+    float * batchInput(int b) {
+        return batch_input_.data() + b*width*height;
+    }
+
+    const float * batchOutput(int output, int b) const {
+        return batch_outputs_[output].data() + b*shapeSize(batch_output_shapes_[output]);
+    }
+
+    void doInferenceBatch() {
+        const char* input_names[] = {m_InputBlobName.c_str()};
+        std::vector<const char*> output_names;
+        for (auto & name : batch_output_names_) {
+            output_names.emplace_back(name.c_str());
+        }
+        session_->Run(Ort::RunOptions{nullptr}, input_names, &batch_input_tensor_, 1, output_names.data(), 
+            batch_output_tensors_.data(), batch_output_tensors_.size());
+    }
 public:
+    //True when the model has a dynamic batch dimension, so that all cameras can be inferenced in one Run.
+    bool supportBatch() const {
+        return dynamic_batch;
+    }
+
     ONNXInferenceGeneric(std::string engine_path, std::string input_blob_name, std::string output_blob_name, int _width, int _height,
             bool use_tensorrt, bool use_fp16, bool use_int8, std::string int8_calib_table_name = ""):
         CNNInferenceGeneric(input_blob_name, _width, _height), output_name(output_blob_name) {
@@ -27,11 +169,10 @@ public:
     }
 
     void init(const std::string & engine_path, bool onnx_with_tensorrt, bool enable_fp16, bool enable_int8, std::string int8_calib_table_name = "") {
-        Ort::SessionOptions session_options;
-        session_options.SetIntraOpNumThreads(1);
-        session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
-
-        if (onnx_with_tensorrt) {
+        Ort::SessionOptions session_options = createSessionOptions();
+        if (onnx_with_tensorrt && !onnxRuntimeConfig().use_cuda) {
+            printf("ONNX TensorRT is disabled since CUDA is disabled, use CPU for inference\n");
+        } else if (onnx_with_tensorrt) {
             int pn = engine_path.find_last_of('/');
             std::string configPath = engine_path.substr(0, pn);
             memcpy(engine_folder, configPath.c_str(), configPath.size());
@@ -53,15 +194,10 @@ public:
             printf("ONNX will use TensorRT for inference INT8 %d FP16 %d cache path %s\n", enable_int8, enable_fp16, engine_folder);
         }
 
-        OrtCUDAProviderOptions options;
-        options.device_id = 0;
-        options.arena_extend_strategy = 0;
-        options.gpu_mem_limit = 1 * 1024 * 1024 * 1024;
-        options.cudnn_conv_algo_search = OrtCudnnConvAlgoSearch::OrtCudnnConvAlgoSearchExhaustive;
-        options.do_copy_in_default_stream = 1;
-        session_options.AppendExecutionProvider_CUDA(options);
-
-        session_ = new Ort::Session(env, engine_path.c_str(), session_options);
+        appendCUDAProvider(session_options);
+        session_ = new Ort::Session(onnxSharedEnv(), engine_path.c_str(), session_options);
+        auto input_shape = session_->GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+        dynamic_batch = input_shape.size() > 0 && input_shape[0] < 0;
     }
 };
 }
@@ -1,14 +1,32 @@
 #pragma once
-#include <ATen/ATen.h>
-#include <torch/csrc/api/include/torch/types.h>
 #include <opencv2/opencv.hpp>
 #include <Eigen/Eigen>
 
 #define SP_DESC_RAW_LEN 256
 
 namespace D2FrontEnd {
+class SuperPointNMS {
+    //Max-pool NMS over the SuperPoint heatmap. Buffers are kept between frames.
+    cv::Mat conf; //heatmap with values below threshold set to zero
+    cv::Mat pooled;
+    cv::Mat kernel;
+    int kernel_dist = -1;
+    struct Candidate {
+        float score;
+        int index; //row-major pixel index, for deterministic ordering of ties
+    };
+    std::vector<Candidate> candidates;
+public:
+    void extract(const cv::Mat & prob, float threshold, int nms_dist, int max_num, 
+        std::vector<cv::Point2f> &keypoints, std::vector<float>& scores);
+};
+
+void getKeyPoints(const cv::Mat & prob, float threshold, int nms_dist, SuperPointNMS & nms, 
+    std::vector<cv::Point2f> &keypoints, std::vector<float>& scores, int max_num);
 void getKeyPoints(const cv::Mat & prob, float threshold, int nms_dist, std::vector<cv::Point2f> &keypoints, std::vector<float>& scores, int width, int height, int max_num);
-void computeDescriptors(const torch::Tensor & mProb, const torch::Tensor & desc,
-        const std::vector<cv::Point2f> &keypoints, std::vector<float> & local_descriptors, int width, int height, 
+//Bilinear sampling of the coarse descriptor map [SP_DESC_RAW_LEN, height/8, width/8] (as grid_sample with align_corners=false),
+//followed by L2 normalization and the optional PCA projection, in one pass per keypoint.
+void computeDescriptors(const float * desc_raw, const std::vector<cv::Point2f> &keypoints, 
+        std::vector<float> & local_descriptors, int width, int height, 
         const Eigen::MatrixXf & pca_comp_T, const Eigen::RowVectorXf & pca_mean);
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "onnx_generic.h"
+#include "superpoint_common.h"
 #include <Eigen/Dense>
 
 namespace D2FrontEnd {
@@ -13,6 +14,7 @@ class SuperPointONNX: public ONNXInferenceGeneric {
     std::vector<Ort::Value> output_tensors_;
     int max_num = 200;
     int nms_dist = 10;
+    SuperPointNMS nms;
 public:
     double thres = 0.015;
     SuperPointONNX(std::string engine_path, 
@@ -24,6 +26,9 @@ public:
 
     
     void inference(const cv::Mat & input, std::vector<cv::Point2f> & keypoints, std::vector<float> & local_descriptors, std::vector<float> & scores);
+    //All images in one Run when the model has a dynamic batch, otherwise one by one.
+    void inference(const std::vector<cv::Mat> & inputs, std::vector<std::vector<cv::Point2f>> & keypoints, 
+        std::vector<std::vector<float>> & local_descriptors, std::vector<std::vector<float>> & scores);
     void doInference(const unsigned char* input, const uint32_t batchSize) override;
 };
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "d2frontend_params.h"
 #include "d2landmark_manager.h"
+#include "landmark_grid_index.h"
 #include <unordered_map>
 #include <mutex>
 #include <d2common/d2frontend_types.h>
@@ -26,6 +27,7 @@ struct D2FTConfig {
     bool check_essential = false;
     bool enable_lk_optical_flow = true;
     bool lk_use_fast = false;
+    bool lk_use_cuda = true; //Otherwise LK pyramids are built and cached on CPU
     double ransacReprojThreshold = 10;
     double max_pts_velocity_time=0.3;
     int remote_min_match_num = 30;
@@ -42,6 +44,7 @@ struct D2FTConfig {
     std::string superglue_model_path;
     double landmark_distance_assumption = 2.0; // For uninitialized landmark, assume it is 3m away
     int frame_step = 2;
+    bool enable_parallel_tracking = false; //Track each camera of a multi-camera frame on a worker thread
 };
 
 struct TrackReport {
@@ -67,11 +70,22 @@ struct TrackReport {
 };
 
 struct LKImageInfo {
-    FrameIdType frame_id;
+    FrameIdType frame_id = -1;
     std::vector<cv::Point2f> lk_pts;
     std::vector<LandmarkIdType> lk_ids;
     cv::Mat image;
+    //Pyramid of image, reused as the previous pyramid of the next frame and as the target of left-right tracking.
     std::vector<cv::cuda::GpuMat> pyr;
+    std::vector<cv::Mat> pyr_cpu;
+};
+
+struct LKTrackPending {
+    //Output of the compute-only stage of LK tracking, committed afterwards in camera order.
+    std::vector<cv::Point2f> lk_pts;
+    std::vector<LandmarkIdType> lk_ids;
+    std::vector<cv::Point2f> new_pts;
+    std::vector<cv::cuda::GpuMat> pyr;
+    std::vector<cv::Mat> pyr_cpu;
 };
 
 class SuperGlueOnnx;
@@ -96,6 +110,9 @@ protected:
     int reference_frame_id = 0;
 
     std::vector<VisualImageDescArray> current_keyframes;
+    //Grid index over superpoint landmarks of each image in current_keyframes: frame_id -> camera_index -> grid.
+    //Only used by local tracking without motion prediction.
+    std::map<FrameIdType, std::map<int, LandmarkGridIndex>> keyframe_grids;
     LandmarkManager * lmanager = nullptr;
     int keyframe_count = 0;
     int frame_count = 0;
@@ -105,9 +122,11 @@ protected:
     std::recursive_mutex track_lock;
     std::recursive_mutex keyframe_lock;
     std::recursive_mutex lmanager_lock;
+    uint64_t landmark_version = 0; //Version of the last applied landmark delta
     
     std::map<int, std::vector<cv::Point2f>> landmark_predictions_viz;
     std::map<int, std::vector<cv::Point2f>> landmark_predictions_matched_viz;
+    std::mutex viz_lock;
 
     TrackReport trackLK(VisualImageDesc & frame);
     TrackReport track(const VisualImageDesc & left_frame, VisualImageDesc & right_frame, bool enable_lk=true, TrackLRType type=WHOLE_IMG_MATCH);
@@ -115,6 +134,18 @@ protected:
     TrackReport track(VisualImageDesc & frame, const Swarm::Pose & motion_prediction=Swarm::Pose());
     TrackReport trackRemote(VisualImageDesc & frame, const VisualImageDesc & prev_frame, 
             bool use_motion_predict=false, const Swarm::Pose & motion_prediction=Swarm::Pose());
+    void trackLocalFramesParallel(VisualImageDescArray & frames, TrackReport & report);
+    //Compute-only stages, safe to run concurrently for different cameras.
+    void matchKeyframe(const VisualImageDesc & frame, const Swarm::Pose & motion_prediction, std::vector<int> & ids_b_to_a);
+    void matchLeftRight(const VisualImageDesc & left_frame, const VisualImageDesc & right_frame, TrackLRType type, std::vector<int> & ids_b_to_a);
+    void initLKInfo(const VisualImageDesc & frame);
+    void computeLK(const VisualImageDesc & frame, LKTrackPending & pending);
+    void computeLKLeftRight(const VisualImageDesc & left_frame, const VisualImageDesc & right_frame, TrackLRType type, LKTrackPending & pending);
+    //Commit stages, mutate the landmark manager and must run serially.
+    TrackReport commitKeyframeMatches(VisualImageDesc & frame, const std::vector<int> & ids_b_to_a);
+    TrackReport commitLeftRightMatches(const VisualImageDesc & left_frame, VisualImageDesc & right_frame, const std::vector<int> & ids_b_to_a);
+    TrackReport commitLK(VisualImageDesc & frame, LKTrackPending & pending);
+    TrackReport commitLKLeftRight(VisualImageDesc & right_frame, const LKTrackPending & pending);
     bool getMatchedPrevKeyframe(const VisualImageDescArray & frame_a, VisualImageDescArray& prev, int & dir_a, int & dir_b);
     void processFrame(VisualImageDescArray & frames, bool is_keyframe);
     bool isKeyframe(const TrackReport & reports);
@@ -133,6 +164,7 @@ protected:
     SuperGlueOnnx * superglue = nullptr;
     bool matchLocalFeatures(const VisualImageDesc & img_desc_a, const VisualImageDesc & img_desc_b, std::vector<int> & ids_down_to_up, 
         const MatchLocalFeatureParams & param);
+    const LandmarkGridIndex * getKeyframeGrid(const VisualImageDesc & img_desc) const;
     std::vector<cv::Point2f> predictLandmarks(const VisualImageDesc & img_desc_a, 
             const Swarm::Pose & cam_pose_a, const Swarm::Pose & cam_pose_b, bool use_extrinsic=false) const;
 public:
@@ -140,7 +172,7 @@ public:
     bool trackLocalFrames(VisualImageDescArray & frames);
     bool trackRemoteFrames(VisualImageDescArray & frames);
     void updatebySldWin(const std::vector<VINSFrame*> sld_win);
-    void updatebyLandmarkDB(const std::map<LandmarkIdType, LandmarkPerId> & vins_landmark_db);
+    void updatebyLandmarkDelta(const LandmarkDeltaPtr & delta);
     std::vector<camodocal::CameraPtr> cams;
 };
 
@@ -12,6 +12,8 @@
 #include <sensor_msgs/Image.h>
 #include "d2common/d2frontend_types.h"
 #include "d2frontend_params.h"
+#include "frame_pipeline.h"
+#include "image_buffer_pool.h"
 #include <message_filters/subscriber.h>
 #include <message_filters/time_synchronizer.h>
 #include <queue>
@@ -27,6 +29,7 @@ class LoopCam;
 class LoopNet;
 class D2FeatureTracker;
 class LoopDetector;
+struct LoopVerifyTask;
 class D2Frontend {
     typedef image_transport::SubscriberFilter ImageSubscriber;
 protected:
@@ -39,7 +42,10 @@ protected:
     Eigen::Vector3d last_keyframe_position = Eigen::Vector3d(10000, 10000, 10000);
 
     std::set<ros::Time> received_keyframe_stamps;
-    std::queue<VisualImageDescArray> loop_queue;
+    //Loop detection executor: the query stage feeds the verify stage
+    PriorityFrameQueue<VisualImageDescArray> * loop_queue = nullptr;
+    BoundedFrameQueue<LoopVerifyTask> * loop_verify_queue = nullptr;
+    std::map<int, int> loop_drone_frames;
     std::mutex loop_lock;
     image_transport::ImageTransport * it_;
 
@@ -56,6 +62,7 @@ protected:
     void stereoImagesCallback(const sensor_msgs::ImageConstPtr left, const sensor_msgs::ImageConstPtr right);
     void depthImagesCallback(const sensor_msgs::ImageConstPtr left, const sensor_msgs::ImageConstPtr depth);
     void monoImageCallback(const sensor_msgs::ImageConstPtr & left);
+    ImageBufferPool gray_pool;
     double last_invoke = 0;
     
     void pubNodeFrame(const VisualImageDescArray & viokf);
@@ -66,12 +73,25 @@ protected:
     virtual void processRemoteImage(VisualImageDescArray & frame_desc, bool succ_track);
 
     void processStereoframe(const StereoFrame & stereoframe);
+    bool trackFrame(VisualImageDescArray & vframearry);
+
+    //Pipeline stages, used when params->enable_pipeline
+    BoundedFrameQueue<StereoFrame> * extract_queue = nullptr;
+    BoundedFrameQueue<VisualImageDescArray> * track_queue = nullptr;
+    BoundedFrameQueue<VisualImageDescArray> * backend_queue = nullptr;
+    std::thread th_extract, th_track, th_backend;
+    void extractThread();
+    void trackThread();
+    void backendThread();
     void loopDetectionThread();
+    void loopVerifyThread();
+    int loopQueuePriority(const VisualImageDescArray & viokf);
 
     void addToLoopQueue(const VisualImageDescArray & viokf);
 
     ros::Subscriber remote_img_sub;
     ros::Publisher loopconn_pub;
+    ros::Publisher relocalization_pub;
     ros::Publisher remote_image_desc_pub;
     ros::Publisher local_image_desc_pub;
     ros::Publisher keyframe_pub;
@@ -80,11 +100,15 @@ protected:
     message_filters::TimeSynchronizer<sensor_msgs::Image, sensor_msgs::Image> * sync;
     image_transport::Subscriber image_sub_single;
 
-    std::thread th, th_loop_det;
+    std::thread th, th_loop_det, th_loop_verify;
     bool received_image = false;
+    bool stopped = false;
     ros::Timer timer, loop_timer;
 public:
     D2Frontend ();
+    virtual ~D2Frontend();
+    //Closes the stage queues and joins the worker threads. Called on node shutdown, safe to call twice.
+    virtual void stop();
     virtual Swarm::Pose getMotionPredict(double stamp) const {return Swarm::Pose();};
     
 protected:
@@ -46,6 +46,12 @@ enum TrackLRType {
     RIGHT_LEFT_IMG_MATCH
 };
 
+enum FrameDropPolicy {
+    BLOCK = 0, //Backpressure: the upstream stage waits
+    DROP_OLDEST,
+    DROP_OLDEST_NON_KEYFRAME //Keyframes are never dropped; blocks if only keyframes are queued
+};
+
 struct LoopCamConfig;
 struct LoopDetectorConfig;
 struct D2FTConfig;
@@ -100,7 +106,10 @@ struct D2FrontendParams {
     int width_undistort = 800;
     int height_undistort = 400;
     bool enable_undistort_image; //Undistort image before feature detection
+    bool undistort_use_cuda = true; //Otherwise remap on CPU with fixed-point maps
     double focal_length = 460.0;
+    int loop_ransac_threads = 4; //Threads sharing the RANSAC hypotheses of loop PnP
+    int loop_ransac_seed = 0; //Fixed seed so loop verification is reproducible
     std::vector<Swarm::Pose> extrinsics;
     std::vector<cv::Mat> cam_Ks;
     std::vector<cv::Mat> cam_Ds;
@@ -112,6 +121,13 @@ struct D2FrontendParams {
     std::vector<int> camera_seq;
 
     bool show_raw_image = false;
+
+    //Pipelined frontend: extraction, tracking and backend hand-off run on their own threads
+    bool enable_pipeline = false;
+    int pipeline_queue_size = 2;
+    FrameDropPolicy pipeline_drop_policy = FrameDropPolicy::BLOCK;
+    int loop_queue_size = 20; //Frames waiting for loop detection, the lowest priority is dropped when full
+
     //Configs of submodules
     LoopCamConfig * loopcamconfig;
     LoopDetectorConfig * loopdetectorconfig;
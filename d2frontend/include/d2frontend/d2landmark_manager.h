@@ -1,5 +1,7 @@
 #pragma once
 #include "d2common/d2landmarks.h"
+#include "d2common/landmark_db.h"
+#include <unordered_map>
 
 using namespace D2Common;
 #define MAX_FEATURE_NUM 10000000
@@ -7,8 +9,8 @@ using namespace D2Common;
 namespace D2FrontEnd {
 class LandmarkManager {
 protected:
-    std::map<FrameIdType, std::map<LandmarkIdType, int>> related_landmarks;
-    std::map<LandmarkIdType, LandmarkPerId> landmark_db;
+    std::unordered_map<FrameIdType, std::unordered_map<LandmarkIdType, int>> related_landmarks;
+    LandmarkDB landmark_db;
     int count = 0;
     typedef std::lock_guard<std::recursive_mutex> Guard;
     mutable std::recursive_mutex state_lock;
@@ -24,7 +26,7 @@ public:
     }
     std::vector<LandmarkPerId> popFrame(FrameIdType frame_id, bool pop_base=false); //If pop base, we will remove the related landmarks' base frame.
     virtual void removeLandmark(const LandmarkIdType & id);
-    const std::map<LandmarkIdType, LandmarkPerId> & getLandmarkDB() const {
+    const LandmarkDB & getLandmarkDB() const {
         return landmark_db;
     }
     std::set<LandmarkIdType> getRelatedLandmarks(FrameIdType frame_id) const {
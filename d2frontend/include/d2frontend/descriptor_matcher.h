@@ -0,0 +1,69 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include "landmark_grid_index.h"
+
+namespace D2FrontEnd {
+//Dot product kernels, AVX2/NEON when available.
+float descDot(const float * a, const float * b, int dims);
+int32_t descDot(const int8_t * a, const int8_t * b, int dims);
+
+struct Top2Match {
+    int idx[2] = {-1, -1};
+    float dist[2] = {FLT_MAX, FLT_MAX}; // L2 distance
+};
+
+class DescriptorMatcher {
+    //Brute-force L2 matcher for SuperPoint descriptors. When search_radius > 0, candidates are gated by a grid over pts_b
+    //before any descriptor distance is evaluated.
+    int dims;
+    double search_radius;
+    LandmarkGridIndex own_grid;
+    bool use_own_grid = false; //A flag rather than a pointer to own_grid, so copies of the matcher stay valid
+    const LandmarkGridIndex * grid_b = nullptr; //External grid
+    std::vector<float> sqnorm_b;
+    const float * desc_b = nullptr;
+    const int8_t * desc_b_int8 = nullptr;
+    float scale_b = 1.0f;
+    int num_b = 0;
+
+    void setTrainGrid(const std::vector<cv::Point2f> & pts_b, const LandmarkGridIndex * grid);
+    const LandmarkGridIndex * trainGrid() const {
+        return use_own_grid ? &own_grid : grid_b;
+    }
+    template<typename Func>
+    void forEachCandidate(const cv::Point2f * pt_a, Func func) const;
+    template<typename DistFunc>
+    std::vector<cv::DMatch> crossCheck(int num_a, const std::vector<cv::Point2f> & pts_a, DistFunc dist_func) const;
+    float distance(const float * desc_a, float sqnorm_a, int j) const;
+    float distance(const int8_t * desc_a, float sqnorm_a, float scale_a, int j) const;
+public:
+    DescriptorMatcher(int dims, double search_radius=-1);
+    //A prebuilt grid over pts_b may be given to avoid rebuilding it for every query frame.
+    void setTrain(const float * desc_b, int num_b, const std::vector<cv::Point2f> & pts_b=std::vector<cv::Point2f>(), 
+        const LandmarkGridIndex * grid_b=nullptr);
+    //Int8 descriptors are dequantized as desc*scale
+    void setTrain(const int8_t * desc_b, float scale_b, int num_b, const std::vector<cv::Point2f> & pts_b=std::vector<cv::Point2f>(),
+        const LandmarkGridIndex * grid_b=nullptr);
+    std::vector<Top2Match> knn2(const float * desc_a, int num_a, const std::vector<cv::Point2f> & pts_a=std::vector<cv::Point2f>()) const;
+    std::vector<Top2Match> knn2(const int8_t * desc_a, float scale_a, int num_a, const std::vector<cv::Point2f> & pts_a=std::vector<cv::Point2f>()) const;
+    //Gate with a grid over the (predicted) query points instead, e.g. the cached grid of a keyframe.
+    //Train was set without points; pts_b gives the train positions.
+    std::vector<Top2Match> knn2(const float * desc_a, const LandmarkGridIndex & grid_a, const std::vector<cv::Point2f> & pts_b) const;
+    //Lowe's ratio test on knn2
+    std::vector<cv::DMatch> matchRatio(const float * desc_a, int num_a, double ratio,
+        const std::vector<cv::Point2f> & pts_a=std::vector<cv::Point2f>()) const;
+    std::vector<cv::DMatch> matchRatio(const int8_t * desc_a, float scale_a, int num_a, double ratio,
+        const std::vector<cv::Point2f> & pts_a=std::vector<cv::Point2f>()) const;
+    std::vector<cv::DMatch> matchRatio(const float * desc_a, const LandmarkGridIndex & grid_a, double ratio,
+        const std::vector<cv::Point2f> & pts_b) const;
+    //Mutual nearest neighbour, same as cv::BFMatcher(cv::NORM_L2, true)
+    std::vector<cv::DMatch> matchCrossCheck(const float * desc_a, int num_a,
+        const std::vector<cv::Point2f> & pts_a=std::vector<cv::Point2f>()) const;
+    std::vector<cv::DMatch> matchCrossCheck(const int8_t * desc_a, float scale_a, int num_a,
+        const std::vector<cv::Point2f> & pts_a=std::vector<cv::Point2f>()) const;
+};
+
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <string>
+#include <d2common/utils.hpp>
+#include "d2frontend_params.h"
+
+namespace D2FrontEnd {
+using D2Common::Utility::TicToc;
+
+class PipelineStageStats {
+    //Latency counters of one pipeline stage, in ms.
+    std::string name;
+    std::mutex lock;
+    int count = 0;
+    int dropped = 0;
+    double sum_wait = 0;
+    double sum_process = 0;
+    double max_process = 0;
+public:
+    PipelineStageStats(std::string _name): name(_name) {}
+    void add(double wait_ms, double process_ms) {
+        std::lock_guard<std::mutex> guard(lock);
+        count ++;
+        sum_wait += wait_ms;
+        sum_process += process_ms;
+        max_process = std::max(max_process, process_ms);
+        if (params->enable_perf_output && count % 100 == 0) {
+            printf("[D2Frontend::Pipeline] %s: %d frames dropped %d avg wait %.1fms process avg %.1fms max %.1fms\n",
+                name.c_str(), count, dropped, sum_wait/count, sum_process/count, max_process);
+        }
+    }
+    void addDropped() {
+        std::lock_guard<std::mutex> guard(lock);
+        dropped ++;
+    }
+};
+
+template<typename T>
+class BoundedFrameQueue {
+    //Queue between two pipeline stages. When full, push blocks (backpressure) or drops a queued frame by the policy.
+    struct Item {
+        T data;
+        TicToc enqueued;
+    };
+    std::deque<Item> queue;
+    std::mutex lock;
+    std::condition_variable cv_not_empty, cv_not_full;
+    size_t capacity;
+    FrameDropPolicy policy;
+    std::function<bool(const T&)> is_keyframe;
+    bool closed = false;
+public:
+    PipelineStageStats stats;
+
+    BoundedFrameQueue(std::string name, size_t _capacity, FrameDropPolicy _policy,
+            std::function<bool(const T&)> _is_keyframe = nullptr):
+        stats(name), capacity(std::max(_capacity, (size_t) 1)), policy(_policy), is_keyframe(_is_keyframe) {}
+
+    void push(T data) {
+        std::unique_lock<std::mutex> guard(lock);
+        if (queue.size() >= capacity && policy != FrameDropPolicy::BLOCK) {
+            for (auto it = queue.begin(); it != queue.end(); it++) {
+                if (policy == FrameDropPolicy::DROP_OLDEST || !is_keyframe || !is_keyframe(it->data)) {
+                    queue.erase(it);
+                    stats.addDropped();
+                    break;
+                }
+            }
+        }
+        //Blocking policy, or only keyframes are queued.
+        cv_not_full.wait(guard, [&] { return queue.size() < capacity || closed; });
+        if (closed) {
+            return;
+        }
+        queue.push_back(Item{std::move(data), TicToc()});
+        cv_not_empty.notify_one();
+    }
+
+    //Returns false if the queue is closed or timeout. wait_ms is the time the frame spent in the queue.
+    bool pop(T & data, double & wait_ms, int timeout_ms = 100) {
+        std::unique_lock<std::mutex> guard(lock);
+        if (!cv_not_empty.wait_for(guard, std::chrono::milliseconds(timeout_ms), [&] { return !queue.empty() || closed; })
+                || queue.empty()) {
+            return false;
+        }
+        data = std::move(queue.front().data);
+        wait_ms = queue.front().enqueued.toc();
+        queue.pop_front();
+        cv_not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        cv_not_empty.notify_all();
+        cv_not_full.notify_all();
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> guard(lock);
+        return queue.size();
+    }
+
+    bool isClosed() {
+        std::lock_guard<std::mutex> guard(lock);
+        return closed;
+    }
+};
+
+template<typename T>
+class PriorityFrameQueue {
+    //Bounded queue popping the highest priority first, FIFO within a priority.
+    //When full, the oldest frame of the lowest priority is dropped, or the new frame if it has an even lower priority.
+    struct Item {
+        T data;
+        int priority;
+        TicToc enqueued;
+    };
+    std::deque<Item> queue;
+    std::mutex lock;
+    std::condition_variable cv_not_empty;
+    size_t capacity;
+    bool closed = false;
+public:
+    PipelineStageStats stats;
+
+    PriorityFrameQueue(std::string name, size_t _capacity):
+        stats(name), capacity(std::max(_capacity, (size_t) 1)) {}
+
+    //Returns false if the frame is dropped
+    bool push(T data, int priority) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (closed) {
+            return false;
+        }
+        if (queue.size() >= capacity) {
+            auto lowest = queue.begin();
+            for (auto it = queue.begin(); it != queue.end(); it++) {
+                if (it->priority < lowest->priority) {
+                    lowest = it;
+                }
+            }
+            stats.addDropped();
+            if (lowest->priority > priority) {
+                return false;
+            }
+            queue.erase(lowest);
+        }
+        queue.push_back(Item{std::move(data), priority, TicToc()});
+        cv_not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T & data, double & wait_ms, int timeout_ms = 100) {
+        std::unique_lock<std::mutex> guard(lock);
+        if (!cv_not_empty.wait_for(guard, std::chrono::milliseconds(timeout_ms), [&] { return !queue.empty() || closed; })
+                || queue.empty()) {
+            return false;
+        }
+        auto best = queue.begin();
+        for (auto it = queue.begin(); it != queue.end(); it++) {
+            if (it->priority > best->priority) {
+                best = it;
+            }
+        }
+        data = std::move(best->data);
+        wait_ms = best->enqueued.toc();
+        queue.erase(best);
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        cv_not_empty.notify_all();
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> guard(lock);
+        return queue.size();
+    }
+
+    bool isClosed() {
+        std::lock_guard<std::mutex> guard(lock);
+        return closed;
+    }
+};
+}
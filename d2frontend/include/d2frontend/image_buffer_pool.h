@@ -0,0 +1,52 @@
+#pragma once
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <opencv2/core.hpp>
+
+namespace D2FrontEnd {
+class ImageBufferPool {
+    //Recycles image buffers across frames. Each acquired buffer comes with a holder and is handed out again only
+    //after every copy of the holder is released, so frames kept by the pipeline or the loop detector are never overwritten.
+    struct Buffer {
+        cv::Mat mat;
+        bool in_use = false;
+    };
+    struct State {
+        std::mutex lock;
+        std::vector<std::unique_ptr<Buffer>> buffers;
+    };
+    //Shared with the holders, which may outlive the pool
+    std::shared_ptr<State> state;
+    size_t max_buffers;
+public:
+    ImageBufferPool(size_t _max_buffers = 16): state(std::make_shared<State>()), max_buffers(_max_buffers) {}
+
+    cv::Mat acquire(int rows, int cols, int type, std::shared_ptr<const void> & holder) {
+        std::lock_guard<std::mutex> guard(state->lock);
+        Buffer * buf = nullptr;
+        for (auto & _buf : state->buffers) {
+            if (!_buf->in_use && _buf->mat.rows == rows && _buf->mat.cols == cols && _buf->mat.type() == type) {
+                buf = _buf.get();
+                break;
+            }
+        }
+        if (buf == nullptr) {
+            if (state->buffers.size() >= max_buffers) {
+                //All buffers are in use, this one is not recycled
+                holder.reset();
+                return cv::Mat(rows, cols, type);
+            }
+            state->buffers.emplace_back(new Buffer{cv::Mat(rows, cols, type)});
+            buf = state->buffers.back().get();
+        }
+        buf->in_use = true;
+        auto _state = state;
+        holder = std::shared_ptr<const void>(buf->mat.data, [_state, buf] (const void *) {
+            std::lock_guard<std::mutex> guard(_state->lock);
+            buf->in_use = false;
+        });
+        return buf->mat;
+    }
+};
+}
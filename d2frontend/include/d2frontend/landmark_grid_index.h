@@ -0,0 +1,62 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+namespace D2Common {
+struct VisualImageDesc;
+}
+
+namespace D2FrontEnd {
+class LandmarkGridIndex {
+    //Bucket grid over 2D points, for fixed radius search.
+    float cell_size = 0;
+    int cols = 0;
+    int rows = 0;
+    float min_x = 0;
+    float min_y = 0;
+    std::vector<int> cell_start; //CSR layout: points in cell c are cell_index[cell_start[c]..cell_start[c+1]]
+    std::vector<int> cell_index;
+    std::vector<cv::Point2f> pts;
+public:
+    LandmarkGridIndex() {}
+    LandmarkGridIndex(const std::vector<cv::Point2f> & pts, float cell_size);
+    //Index over the SuperPoint landmarks of the image, the order follows VisualImageDesc::landmarks2D(true)
+    static LandmarkGridIndex fromSuperPoints(const D2Common::VisualImageDesc & img_desc, float cell_size);
+    bool empty() const {
+        return cols == 0;
+    }
+    int size() const {
+        return pts.size();
+    }
+    const std::vector<cv::Point2f> & points() const {
+        return pts;
+    }
+
+    //Call func(index) for each point within radius of pt
+    template<typename Func>
+    void radiusSearch(const cv::Point2f & pt, float radius, Func func) const {
+        if (cols == 0) {
+            return;
+        }
+        int cx0 = std::max((int) std::floor((pt.x - radius - min_x) / cell_size), 0);
+        int cx1 = std::min((int) std::floor((pt.x + radius - min_x) / cell_size), cols - 1);
+        int cy0 = std::max((int) std::floor((pt.y - radius - min_y) / cell_size), 0);
+        int cy1 = std::min((int) std::floor((pt.y + radius - min_y) / cell_size), rows - 1);
+        float r2 = radius*radius;
+        for (int cy = cy0; cy <= cy1; cy++) {
+            for (int cx = cx0; cx <= cx1; cx++) {
+                int c = cy*cols + cx;
+                for (int k = cell_start[c]; k < cell_start[c + 1]; k++) {
+                    int j = cell_index[k];
+                    auto d = pts[j] - pt;
+                    if (d.x*d.x + d.y*d.y <= r2) {
+                        func(j);
+                    }
+                }
+            }
+        }
+    }
+};
+}
@@ -76,12 +76,20 @@ public:
     LoopCam(LoopCamConfig config, ros::NodeHandle & nh);
     
     VisualImageDesc extractorImgDescDeepnet(ros::Time stamp, cv::Mat img, int index, int camera_id, bool superpoint_mode=false);
+    //Batched version, all images go through the CNNs together
+    std::vector<VisualImageDesc> extractorImgDescDeepnet(ros::Time stamp, const std::vector<cv::Mat> & imgs, 
+        const std::vector<int> & indices, const std::vector<CamIdType> & camera_ids, bool superpoint_mode=false);
     std::vector<VisualImageDesc> generateStereoImageDescriptor(const StereoFrame & msg, int i, cv::Mat &_show);
     VisualImageDesc generateGrayDepthImageDescriptor(const StereoFrame & msg, int i, cv::Mat &_show);
     VisualImageDesc generateImageDescriptor(const StereoFrame & msg, int i, cv::Mat &_show);
+    //Fill a VisualImageDesc already extracted from the undistorted image undist.
+    VisualImageDesc generateImageDescriptor(const StereoFrame & msg, int i, const cv::Mat & undist, VisualImageDesc vframe, cv::Mat &_show);
+    cv::Mat undistortImage(const StereoFrame & msg, int i);
     VisualImageDescArray processStereoframe(const StereoFrame & msg);
 
     void encodeImage(const cv::Mat & _img, VisualImageDesc & _img_desc);
+    VisualImageDesc initImageDesc(ros::Time stamp, cv::Mat & img, int camera_index, int camera_id) const;
+    void addLandmarks(VisualImageDesc & vframe, const cv::Mat & img, const std::vector<cv::Point2f> & landmarks_2d);
     
     std::vector<camodocal::CameraPtr> cams;
 
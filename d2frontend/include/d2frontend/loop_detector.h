@@ -6,9 +6,14 @@
 #include <d2frontend/d2frontend_params.h>
 #include <functional>
 #include <swarm_msgs/Pose.h>
-#include <faiss/IndexFlat.h>
+#include <d2frontend/place_recognition_index.h>
+#include <d2common/d2frontend_types.h>
+#include <d2common/landmark_db.h>
 #include <swarm_msgs/drone_trajectory.hpp>
 #include <mutex>
+#include <deque>
+#include <list>
+#include <array>
 
 using namespace swarm_msgs;
 #define REMOTE_MAGIN_NUMBER 1000000
@@ -57,17 +62,37 @@ struct LoopDetectorConfig {
     double knn_match_ratio = 0.8;
     double gravity_check_thres = 0.06;
     std::string superglue_model_path;
+    PlaceIndexConfig place_index;
+    std::string load_database_path; //Pre-seed the database, e.g. from a previous flight
+    std::string save_database_path; //Saved when the node shuts down
+    int loop_candidate_num = 1; //NetVLAD candidates per query; more than 1 enables the pre-check ranking
+    int loop_verify_num = 2; //Candidates that get the full PnP verification
+    int loop_precheck_keypoints = 100; //Query keypoints matched in the pre-check
+    int keyframe_db_full_num = -1; //Keyframes kept uncompacted; older ones keep int8 descriptors only. -1 disables compaction
+    double keyframe_db_memory_budget_mb = 0; //0 for unbounded
+    double keyframe_db_evict_radius = 1.0; //Keyframes with a more recent neighbour within the radius are evicted first
 };
 
 class SuperGlueOnnx;
 
+struct LoopVerifyTask {
+    //Output of the query stage, everything the verify stage needs
+    VisualImageDescArray frame;
+    std::vector<VisualImageDescArray> candidates;
+    std::vector<int> candidate_dirs;
+    int camera_index = 1;
+};
+
 class LoopDetector {
     LoopDetectorConfig _config;
     std::map<LandmarkIdType, LandmarkPerId> landmark_db;
     std::recursive_mutex frame_mutex, landmark_mutex;
+    uint64_t landmark_version = 0; //Version of the last applied landmark delta
+    std::mutex verify_mutex, show_mutex;
+    mutable std::mutex traj_mutex;
 protected:
-    faiss::IndexFlatIP local_index;
-    faiss::IndexFlatIP remote_index;
+    PlaceRecognitionIndex local_index;
+    PlaceRecognitionIndex remote_index;
     Swarm::DroneTrajectory ego_motion_traj;
     std::map<int, int64_t> index_to_frame_id;
     std::map<int, int> imgid2dir;
@@ -77,6 +102,18 @@ protected:
     std::map<int64_t, VisualImageDescArray> keyframe_database;
     std::mutex keyframe_database_mutex;
 
+    //Memory bookkeeping of keyframe_database, guarded by keyframe_database_mutex
+    size_t keyframe_db_bytes = 0;
+    std::deque<int64_t> full_keyframes; //Uncompacted keyframes, oldest first
+    std::list<int64_t> keyframe_lru; //Least recently used first
+    std::map<int64_t, std::list<int64_t>::iterator> keyframe_lru_pos;
+    std::map<int64_t, std::vector<int>> frame_id_to_indices;
+    std::map<LandmarkIdType, int> landmark_refs; //Retained keyframes observing the landmark; landmark_db only keeps referenced ones
+    //Keyframes hashed by drone and by cells of keyframe_db_evict_radius, and for each keyframe the number of
+    //newer keyframes of the same drone within the radius, so the eviction tests coverage in O(1)
+    std::map<std::array<int64_t, 4>, std::vector<int64_t>> keyframe_cells;
+    std::map<int64_t, int> keyframe_coverage;
+
     std::map<int64_t, std::vector<cv::Mat>> msgid2cvimgs;
     
     double t0 = -1;
@@ -98,9 +135,24 @@ protected:
 
     int addImageArrayToDatabase(VisualImageDescArray & new_fisheye_desc, bool add_to_faiss = true);
     int addImageDescToDatabase(VisualImageDesc & new_img_desc);
-    bool queryImageArrayFromDatabase(const VisualImageDescArray & new_img_desc, VisualImageDescArray & ret, int & camera_index_new, int & camera_index_old);
-    int queryFrameIndexFromDatabase(const VisualImageDesc & new_img_desc, double & similarity);
-    int queryIndexFromDatabase(const VisualImageDesc & new_img_desc, faiss::IndexFlatIP & index, bool remote_db, double thres, int max_index, double & similarity);
+    //Require keyframe_database_mutex
+    void touchKeyframe(int64_t frame_id);
+    void compactKeyframes();
+    void enforceMemoryBudget();
+    void evictKeyframe(int64_t frame_id);
+    std::array<int64_t, 4> keyframeCell(const VisualImageDescArray & frame) const;
+    //Add (sign 1) or remove (sign -1) the keyframe from the coverage bookkeeping, with its current pose
+    void updateKeyframeCoverage(int64_t frame_id, int sign);
+    //Up to loop_candidate_num keyframes, most similar first
+    bool queryImageArrayFromDatabase(const VisualImageDescArray & new_img_desc, std::vector<VisualImageDescArray> & rets, 
+        int & camera_index_new, std::vector<int> & camera_indices_old);
+    //Candidates are (similarity, index) pairs
+    int queryFrameIndexFromDatabase(const VisualImageDesc & new_img_desc, int max_num, std::vector<std::pair<double, int>> & candidates);
+    int queryIndexFromDatabase(const VisualImageDesc & new_img_desc, const PlaceRecognitionIndex & index, bool remote_db, double thres, 
+        int max_index, int max_num, std::vector<std::pair<double, int>> & candidates);
+    //Reorder candidates by the pre-check match count
+    void rankCandidates(const VisualImageDescArray & frame_array, int camera_index, 
+        std::vector<VisualImageDescArray> & candidates, std::vector<int> & candidate_dirs) const;
 
     bool checkLoopOdometryConsistency(LoopEdge & loop_conn) const;
     void drawMatched(const VisualImageDescArray & fisheye_desc_a, const VisualImageDescArray & fisheye_desc_b,
@@ -108,18 +160,33 @@ protected:
             std::vector<std::pair<int, int>> index2dirindex_a, std::vector<std::pair<int, int>> index2dirindex_b);
 public:
     std::function<void(LoopEdge &)> on_loop_cb;
+    //Loops against keyframes loaded from a database. Those keyframes are in the frame of the session that saved them,
+    //unknown to the pose graph, so these edges are relocalizations and never go to on_loop_cb.
+    std::function<void(LoopEdge &)> on_relocalization_cb;
     std::function<void(VisualImageDescArray&)> broadcast_keyframe_cb;
     int self_id = -1;
     LoopDetector(int self_id, const LoopDetectorConfig & config);
+    //Query and verify in the calling thread
     void processImageArray(VisualImageDescArray & img_des);
+    //Query stage: place recognition and database insertion, under frame_mutex.
+    //Returns true if the task needs verification; img_des is then moved into the task.
+    bool queryImageArray(VisualImageDescArray & img_des, LoopVerifyTask & task);
+    //Verify stage: matching and PnP on the candidates. Does not block queryImageArray.
+    bool verifyLoop(LoopVerifyTask & task);
     void onLoopConnection(LoopEdge & loop_conn);
     LoopCam * loop_cam = nullptr;
     cv::Mat decode_image(const VisualImageDesc & _img_desc);
-    void updatebyLandmarkDB(const std::map<LandmarkIdType, LandmarkPerId> & vins_landmark_db);
+    void updatebyLandmarkDelta(const LandmarkDeltaPtr & delta);
     void updatebySldWin(const std::vector<VINSFrame*> sld_win);
     bool hasFrame(FrameIdType frame_id);
 
     int databaseSize() const;
+    //Keyframes, place recognition indices and landmark positions in a versioned binary file.
+    bool saveDatabase(const std::string & path);
+    //The file is read through mmap and decoded at once; nothing stays mapped. Frame and landmark ids of loaded
+    //keyframes are moved to a separate range so they never collide with ids generated in this run.
+    //A missing or corrupted file leaves the database empty.
+    bool loadDatabase(const std::string & path);
 
 };
 
@@ -0,0 +1,51 @@
+#pragma once
+#include <faiss/IndexFlat.h>
+#include <faiss/impl/io.h>
+#include <memory>
+#include <vector>
+#include <string>
+
+namespace D2FrontEnd {
+enum PlaceIndexType {
+    PLACE_INDEX_FLAT = 0,
+    PLACE_INDEX_IVF_PQ,
+    PLACE_INDEX_HNSW
+};
+
+struct PlaceIndexConfig {
+    PlaceIndexType type = PLACE_INDEX_FLAT;
+    int train_threshold = 2000; //Stay exhaustive until the database has this many descriptors
+    int ivf_nlist = 64;
+    int ivf_nprobe = 8;
+    int pq_m = 64; //Sub-quantizers, must divide the descriptor dims
+    int hnsw_m = 32;
+    int hnsw_ef_search = 64;
+    int max_search_k = 128; //Upper bound of neighbours returned by one query
+};
+
+class PlaceRecognitionIndex {
+    //Inner-product index of global (NetVLAD) descriptors. Ids are the insertion order.
+    //Starts as a flat index and switches to IVF-PQ or HNSW once train_threshold descriptors are added.
+    PlaceIndexConfig config;
+    int dims;
+    std::unique_ptr<faiss::Index> index;
+    bool approximate = false;
+    void buildApproximate();
+public:
+    PlaceRecognitionIndex(int dims, const PlaceIndexConfig & config = PlaceIndexConfig());
+    //Returns the id of the descriptor
+    int add(const float * desc);
+    //At most min(k, max_search_k, size()) results sorted by similarity; missing results have label -1.
+    int search(const float * desc, int k, std::vector<float> & similarity, std::vector<faiss::idx_t> & labels) const;
+    int size() const;
+    void write(faiss::IOWriter * writer) const;
+    //Replaces the index; returns false if the dims do not match
+    bool read(faiss::IOReader * reader);
+    bool isApproximate() const {
+        return approximate;
+    }
+    const faiss::Index * faissIndex() const {
+        return index.get();
+    }
+};
+}
@@ -7,6 +7,7 @@
 #include <chrono>
 #include <d2common/d2basetypes.h>
 #include <d2frontend/d2frontend_params.h>
+#include <d2frontend/image_buffer_pool.h>
 
 namespace D2FrontEnd {
 using D2Common::LandmarkIdType;
@@ -14,6 +15,14 @@ using D2Common::LandmarkIdType;
 cv_bridge::CvImagePtr getImageFromMsg(const sensor_msgs::Image &img_msg);
 cv_bridge::CvImagePtr getImageFromMsg(const sensor_msgs::ImageConstPtr &img_msg);
 cv::Mat getImageFromMsg(const sensor_msgs::CompressedImageConstPtr &img_msg, int flag);
+//Keeps a ROS message alive as long as the returned holder
+std::shared_ptr<const void> holdMessage(const sensor_msgs::ImageConstPtr &img_msg);
+//Zero-copy for mono8 and bgr8 messages: the returned image views the message data, which holder owns.
+//The data is shared with other subscribers and must not be written.
+cv::Mat getImageFromMsg(const sensor_msgs::ImageConstPtr &img_msg, std::shared_ptr<const void> & holder);
+//Color images are converted into a buffer from the pool, which holder then owns.
+cv::Mat getGrayImageFromMsg(const sensor_msgs::ImageConstPtr &img_msg, ImageBufferPool & pool, 
+    std::shared_ptr<const void> & holder);
 Eigen::MatrixXf load_csv_mat_eigen(std::string csv);
 Eigen::VectorXf load_csv_vec_eigen(std::string csv);
 
@@ -40,6 +49,7 @@ void detectPoints(const cv::Mat & img, std::vector<cv::Point2f> & n_pts, std::ve
     bool enable_cuda=true, bool use_fast=false, int fast_rows=3, int fast_cols=4);
 
 std::vector<cv::cuda::GpuMat> buildImagePyramid(const cv::cuda::GpuMat& prevImg, int maxLevel_=3);
+std::vector<cv::Mat> buildImagePyramid(const cv::Mat& prevImg, int maxLevel_=3);
 
 std::vector<cv::Point2f> opticalflowTrack(const cv::Mat & cur_img, const cv::Mat & prev_img, std::vector<cv::Point2f> & prev_pts, 
         std::vector<LandmarkIdType> & ids, TrackLRType type=WHOLE_IMG_MATCH, bool enable_cuda=true);
@@ -47,6 +57,14 @@ std::vector<cv::Point2f> opticalflowTrack(const cv::Mat & cur_img, const cv::Mat
 std::vector<cv::Point2f> opticalflowTrackPyr(const cv::Mat & cur_img, std::vector<cv::cuda::GpuMat> & prev_pyr, 
         std::vector<cv::Point2f> & prev_pts, std::vector<LandmarkIdType> & ids, TrackLRType type=WHOLE_IMG_MATCH, bool update_pyr=true);
 
+//Track with pyramids of both images built by the caller, so they can be cached and shared between calls.
+std::vector<cv::Point2f> opticalflowTrackPyr(const cv::Mat & cur_img, const std::vector<cv::cuda::GpuMat> & prev_pyr, 
+        const std::vector<cv::cuda::GpuMat> & cur_pyr, std::vector<cv::Point2f> & prev_pts, std::vector<LandmarkIdType> & ids, 
+        TrackLRType type=WHOLE_IMG_MATCH);
+std::vector<cv::Point2f> opticalflowTrackPyr(const cv::Mat & cur_img, const std::vector<cv::Mat> & prev_pyr, 
+        const std::vector<cv::Mat> & cur_pyr, std::vector<cv::Point2f> & prev_pts, std::vector<LandmarkIdType> & ids, 
+        TrackLRType type=WHOLE_IMG_MATCH);
+
 std::vector<cv::DMatch> matchKNN(const cv::Mat & desc_a, const cv::Mat & desc_b, double knn_match_ratio=0.8,
         const std::vector<cv::Point2f> pts_a=std::vector<cv::Point2f>(),
         const std::vector<cv::Point2f> pts_b=std::vector<cv::Point2f>(),
@@ -10,24 +10,15 @@ std::vector<float> flatten(const std::vector<cv::Point2f> & vec) {
     }
     return res;
 }
-SuperGlueOnnx::SuperGlueOnnx(const std::string & engine_path):
-    env(Ort::Env(ORT_LOGGING_LEVEL_WARNING, "SuperGlueOnnx")) {
+SuperGlueOnnx::SuperGlueOnnx(const std::string & engine_path) {
     init(engine_path);
 }
 
 void SuperGlueOnnx::init(const std::string & engine_path) {
-    Ort::SessionOptions session_options;
-    session_options.SetIntraOpNumThreads(1);
-    session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
-    OrtCUDAProviderOptions options;
-    options.device_id = 0;
-    options.arena_extend_strategy = 0;
-    options.gpu_mem_limit = 1 * 1024 * 1024 * 1024;
-    options.cudnn_conv_algo_search = OrtCudnnConvAlgoSearch::OrtCudnnConvAlgoSearchExhaustive;
-    options.do_copy_in_default_stream = 1;
-    session_options.AppendExecutionProvider_CUDA(options);
+    Ort::SessionOptions session_options = createSessionOptions();
+    appendCUDAProvider(session_options);
     printf("[SuperGlueOnnx] Loading superglue from %s...\n", engine_path.c_str());
-    session_ = new Ort::Session(env, engine_path.c_str(), session_options);
+    session_ = new Ort::Session(onnxSharedEnv(), engine_path.c_str(), session_options);
     memory_info = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
 }
 
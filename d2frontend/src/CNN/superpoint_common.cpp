@@ -5,162 +5,108 @@
 using D2Common::Utility::TicToc;
 
 namespace D2FrontEnd {
-void NMS2(std::vector<cv::Point2f> det, cv::Mat conf, std::vector<cv::Point2f>& pts, std::vector<float>& scores,
-        int border, int dist_thresh, int img_width, int img_height, int max_num);
-void getKeyPoints(const cv::Mat & prob, float threshold, int nms_dist, std::vector<cv::Point2f> &keypoints, std::vector<float>& scores, int width, int height, int max_num)
-{
-    TicToc getkps;
-    auto mask = (prob > threshold);
-    std::vector<cv::Point> kps;
-    cv::findNonZero(mask, kps);
-    std::vector<cv::Point2f> keypoints_no_nms;
-    for (int i = 0; i < kps.size(); i++) {
-        keypoints_no_nms.push_back(cv::Point2f(kps[i].x, kps[i].y));
+void SuperPointNMS::extract(const cv::Mat & prob, float threshold, int nms_dist, int max_num, 
+        std::vector<cv::Point2f> &keypoints, std::vector<float>& scores) {
+    //A point is kept if it is the maximum of its (2*nms_dist+1)^2 window. Both passes run on OpenCV's SIMD kernels.
+    cv::threshold(prob, conf, threshold, 0, cv::THRESH_TOZERO);
+    if (kernel_dist != nms_dist) {
+        kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(2*nms_dist + 1, 2*nms_dist + 1));
+        kernel_dist = nms_dist;
     }
-
-    cv::Mat conf(keypoints_no_nms.size(), 1, CV_32F);
-    for (size_t i = 0; i < keypoints_no_nms.size(); i++) {
-        int x = keypoints_no_nms[i].x;
-        int y = keypoints_no_nms[i].y;
-        conf.at<float>(i, 0) = prob.at<float>(y, x);
+    cv::dilate(conf, pooled, kernel);
+    candidates.clear();
+    for (int v = 0; v < conf.rows; v++) {
+        const float * c = conf.ptr<float>(v);
+        const float * p = pooled.ptr<float>(v);
+        for (int u = 0; u < conf.cols; u++) {
+            if (c[u] > 0 && c[u] >= p[u]) {
+                candidates.push_back({c[u], v*conf.cols + u});
+            }
+        }
+    }
+    auto comp = [](const Candidate & a, const Candidate & b) {
+        return a.score > b.score || (a.score == b.score && a.index < b.index);
+    };
+    if (max_num >= 0 && candidates.size() > max_num) {
+        std::nth_element(candidates.begin(), candidates.begin() + max_num, candidates.end(), comp);
+        candidates.resize(max_num);
+    }
+    std::sort(candidates.begin(), candidates.end(), comp);
+    keypoints.reserve(keypoints.size() + candidates.size());
+    scores.reserve(scores.size() + candidates.size());
+    for (auto & cand : candidates) {
+        keypoints.emplace_back(cand.index % conf.cols, cand.index / conf.cols);
+        scores.emplace_back(cand.score);
     }
+}
 
-    int border = 0;
+void getKeyPoints(const cv::Mat & prob, float threshold, int nms_dist, SuperPointNMS & nms, 
+        std::vector<cv::Point2f> &keypoints, std::vector<float>& scores, int max_num) {
     TicToc ticnms;
-    NMS2(keypoints_no_nms, conf, keypoints, scores, border, nms_dist, width, height, max_num);
+    nms.extract(prob, threshold, nms_dist, max_num, keypoints, scores);
     if (params->enable_perf_output) {
-        printf(" NMS %f keypoints_no_nms %ld keypoints %ld/%ld\n", ticnms.toc(), keypoints_no_nms.size(), keypoints.size(), max_num);
+        printf(" NMS %f keypoints %ld/%ld\n", ticnms.toc(), keypoints.size(), max_num);
     }
 }
 
+void getKeyPoints(const cv::Mat & prob, float threshold, int nms_dist, std::vector<cv::Point2f> &keypoints, std::vector<float>& scores, int width, int height, int max_num)
+{
+    static thread_local SuperPointNMS nms;
+    assert(prob.cols == width && prob.rows == height);
+    getKeyPoints(prob, threshold, nms_dist, nms, keypoints, scores, max_num);
+}
+
 
-void computeDescriptors(const torch::Tensor & mProb, const torch::Tensor & mDesc, 
-        const std::vector<cv::Point2f> &keypoints, 
+void computeDescriptors(const float * desc_raw, const std::vector<cv::Point2f> &keypoints, 
         std::vector<float> & local_descriptors, int width, int height, 
         const Eigen::MatrixXf & pca_comp_T, const Eigen::RowVectorXf & pca_mean) {
     TicToc tic;
-    cv::Mat kpt_mat(keypoints.size(), 2, CV_32F);  // [n_keypoints, 2]  (y, x)
-    for (size_t i = 0; i < keypoints.size(); i++) {
-        kpt_mat.at<float>(i, 0) = (float)keypoints[i].y;
-        kpt_mat.at<float>(i, 1) = (float)keypoints[i].x;
+    const int desc_w = width/8;
+    const int desc_h = height/8;
+    const int plane = desc_w*desc_h;
+    bool use_pca = pca_comp_T.size() > 0;
+    int out_dim = use_pca ? pca_comp_T.cols() : SP_DESC_RAW_LEN;
+    //((d/|d|) - mean)*C == (d*C)/|d| - mean*C
+    Eigen::RowVectorXf pca_mean_proj;
+    if (use_pca) {
+        pca_mean_proj = pca_mean * pca_comp_T;
     }
-
-
-    auto fkpts = at::from_blob(kpt_mat.data, {keypoints.size(), 2}, torch::kFloat);
-
-    auto grid = torch::zeros({1, 1, fkpts.size(0), 2});  // [1, 1, n_keypoints, 2]
-    grid[0][0].slice(1, 0, 1) = 2.0 * fkpts.slice(1, 1, 2) / width - 1;  // x
-    grid[0][0].slice(1, 1, 2) = 2.0 * fkpts.slice(1, 0, 1) / height - 1;  // y
-
-    // mDesc.to(torch::kCUDA);
-    // grid.to(torch::kCUDA);
-    auto desc = torch::grid_sampler(mDesc, grid, 0, 0, 0);
-
-    desc = desc.squeeze(0).squeeze(1);
-
-    // normalize to 1
-    auto dn = torch::norm(desc, 2, 1);
-    desc = desc.div(torch::unsqueeze(dn, 1));
-
-    desc = desc.transpose(0, 1).contiguous();
-    desc = desc.to(torch::kCPU);
-    Eigen::Map<Eigen::Matrix<float,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor>> _desc(desc.data<float>(), desc.size(0), desc.size(1));
-    if (pca_comp_T.size() > 0) {
-        Eigen::Matrix<float,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> _desc_new = (_desc.rowwise() - pca_mean) *pca_comp_T;
-        //Perform row wise normalization
-        for (int i = 0; i < _desc_new.rows(); i++) {
-            _desc_new.row(i) /= _desc_new.row(i).norm();
+    local_descriptors.resize(keypoints.size()*out_dim);
+    Eigen::Matrix<float, 1, SP_DESC_RAW_LEN> sample;
+    for (size_t i = 0; i < keypoints.size(); i++) {
+        //Pixel to coarse cell coordinate, align_corners=false; corners out of the map are zero padded.
+        float x = keypoints[i].x * desc_w / width - 0.5f;
+        float y = keypoints[i].y * desc_h / height - 0.5f;
+        int x0 = std::floor(x), y0 = std::floor(y);
+        float ax = x - x0, ay = y - y0;
+        int offsets[4];
+        float weights[4] = {(1 - ax)*(1 - ay), ax*(1 - ay), (1 - ax)*ay, ax*ay};
+        for (int k = 0; k < 4; k++) {
+            int xk = x0 + (k & 1), yk = y0 + (k >> 1);
+            if (xk < 0 || xk >= desc_w || yk < 0 || yk >= desc_h) {
+                offsets[k] = 0;
+                weights[k] = 0;
+            } else {
+                offsets[k] = yk*desc_w + xk;
+            }
         }
-        local_descriptors = std::vector<float>(_desc_new.data(), _desc_new.data()+_desc_new.cols()*_desc_new.rows());
-    } else {
-        for (int i = 0; i < _desc.rows(); i++) {
-            _desc.row(i) /= _desc.row(i).norm();
+        const float * ch = desc_raw;
+        for (int c = 0; c < SP_DESC_RAW_LEN; c++, ch += plane) {
+            sample(c) = weights[0]*ch[offsets[0]] + weights[1]*ch[offsets[1]] + 
+                weights[2]*ch[offsets[2]] + weights[3]*ch[offsets[3]];
         }
-        local_descriptors = std::vector<float>(_desc.data(), _desc.data()+_desc.cols()*_desc.rows());
+        float norm = sample.norm();
+        Eigen::Map<Eigen::RowVectorXf> out(local_descriptors.data() + i*out_dim, out_dim);
+        if (use_pca) {
+            out.noalias() = sample * pca_comp_T;
+            out = out / norm - pca_mean_proj;
+        } else {
+            out = sample;
+        }
+        out.normalize();
     }
     if (params->enable_perf_output) {
         std::cout << " computeDescriptors full " << tic.toc() << std::endl;
     }
 }
-
-bool pt_conf_comp(std::pair<cv::Point2f, double> i1, std::pair<cv::Point2f, double> i2)
-{
-    return (i1.second > i2.second);
-}
-
-//NMS code is modified from https://github.com/KinglittleQ/SuperPoint_SLAM
-void NMS2(std::vector<cv::Point2f> det, cv::Mat conf, std::vector<cv::Point2f>& pts, 
-            std::vector<float>& scores, int border, int dist_thresh, int img_width, int img_height, int max_num)
-{
-
-    std::vector<cv::Point2f> pts_raw = det;
-
-    std::vector<std::pair<cv::Point2f, double>> pts_conf_vec;
-
-    cv::Mat grid = cv::Mat(cv::Size(img_width, img_height), CV_8UC1);
-    cv::Mat inds = cv::Mat(cv::Size(img_width, img_height), CV_16UC1);
-
-    cv::Mat confidence = cv::Mat(cv::Size(img_width, img_height), CV_32FC1);
-
-    grid.setTo(0);
-    inds.setTo(0);
-    confidence.setTo(0);
-
-    for (unsigned int i = 0; i < pts_raw.size(); i++)
-    {   
-        int uu = (int) pts_raw[i].x;
-        int vv = (int) pts_raw[i].y;
-
-        grid.at<char>(vv, uu) = 1;
-        inds.at<unsigned short>(vv, uu) = i;
-
-        confidence.at<float>(vv, uu) = conf.at<float>(i, 0);
-    }
-
-    for (int i = 0; i < pts_raw.size(); i++)
-    {   
-        int uu = (int) pts_raw[i].x;
-        int vv = (int) pts_raw[i].y;
-
-        if (grid.at<char>(vv, uu) != 1)
-            continue;
-
-        for(int k = -dist_thresh; k < (dist_thresh+1); k++)
-            for(int j = -dist_thresh; j < (dist_thresh+1); j++)
-            {
-                if(j==0 && k==0) continue;
-                if (uu+j < 0 || uu+j >= img_width || vv+k < 0 || vv+k >= img_height) continue;
-
-                if ( confidence.at<float>(vv + k, uu + j) < confidence.at<float>(vv, uu) ) {
-                    grid.at<char>(vv + k, uu + j) = 0;
-                }
-            }
-        grid.at<char>(vv, uu) = 2;
-    }
-
-    size_t valid_cnt = 0;
-
-    for (int v = 0; v < (img_height); v++){
-        for (int u = 0; u < (img_width); u++)
-        {
-            if (u>= (img_width - border) || u < border || v >= (img_height - border) || v < border)
-            continue;
-
-            if (grid.at<char>(v,u) == 2)
-            {
-                int select_ind = (int) inds.at<unsigned short>(v, u);
-                float _conf = confidence.at<float> (v, u);
-                cv::Point2f p = pts_raw[select_ind];
-                pts_conf_vec.push_back(std::make_pair(p, _conf));
-                valid_cnt++;
-            }
-        }
-    }
-    
-    std::sort(pts_conf_vec.begin(), pts_conf_vec.end(), pt_conf_comp);
-    for (unsigned int i = 0; i < max_num && i < pts_conf_vec.size(); i ++) {
-        pts.push_back(pts_conf_vec[i].first);
-        scores.push_back(pts_conf_vec[i].second);
-    }
 }
-}
\ No newline at end of file
@@ -2,7 +2,6 @@
 #include <d2frontend/d2frontend_params.h>
 #include <d2frontend/CNN/superpoint_common.h>
 #include <d2frontend/utils.h>
-#include "ATen/Parallel.h"
 #include "d2common/utils.hpp"
 using D2Common::Utility::TicToc;
 
@@ -21,7 +20,6 @@ SuperPointONNX::SuperPointONNX(std::string engine_path,
         thres(_thres),
         max_num(_max_num),
         nms_dist(_nms_dist) {
-    at::set_num_threads(1);
     std::cout << "Init SuperPointONNX: " << engine_path << " size " << _width << " " << _height << std::endl;
 
     input_image = new float[_width*_height];
@@ -36,6 +34,9 @@ SuperPointONNX::SuperPointONNX(std::string engine_path,
     //desc
     output_tensors_.emplace_back(Ort::Value::CreateTensor<float>(memory_info,
         results_desc_, SP_DESC_RAW_LEN*height/8*width/8, output_shape_desc_.data(), output_shape_desc_.size()));
+    batch_input_shape_ = {1, _height, _width};
+    batch_output_names_ = {"semi", "desc"};
+    batch_output_shapes_ = {{_height, _width}, {SP_DESC_RAW_LEN, _height/8, _width/8}};
     if (params->enable_pca_superpoint) {
         pca_comp_T = load_csv_mat_eigen(_pca_comp).transpose();
         pca_mean = load_csv_vec_eigen(_pca_mean).transpose();
@@ -70,22 +71,51 @@ void SuperPointONNX::inference(const cv::Mat & input, std::vector<cv::Point2f> &
     ((CNNInferenceGeneric*) this)->doInference(_input);
     double inference_time = tic.toc();
 
-    TicToc tic1;
-    auto options = torch::TensorOptions().dtype(torch::kFloat32);
-    
-    auto mProb = at::from_blob(results_semi_, {1, 1, height, width}, options);
-    auto mDesc = at::from_blob(results_desc_, {1, SP_DESC_RAW_LEN, height/8, width/8}, options);
     cv::Mat Prob(height, width, CV_32F, results_semi_);
-    double copy_time = tic1.toc();
 
     TicToc tic2;
-    getKeyPoints(Prob, thres, nms_dist, keypoints, scores, width, height, max_num);
+    getKeyPoints(Prob, thres, nms_dist, nms, keypoints, scores, max_num);
     double nms_time = tic2.toc();
-    computeDescriptors(mProb, mDesc, keypoints, local_descriptors, width, height, pca_comp_T, pca_mean);
+    computeDescriptors(results_desc_, keypoints, local_descriptors, width, height, pca_comp_T, pca_mean);
     double desc_time = tic2.toc();
     if (params->enable_perf_output) {
-        printf("[SuperPointONNX] inference time: %f ms, copy time: %f ms, nms time: %f ms, desc time: %f ms\n", 
-            inference_time, copy_time, nms_time, desc_time);
+        printf("[SuperPointONNX] inference time: %f ms, nms time: %f ms, desc time: %f ms\n", 
+            inference_time, nms_time, desc_time);
+    }
+}
+
+void SuperPointONNX::inference(const std::vector<cv::Mat> & inputs, std::vector<std::vector<cv::Point2f>> & keypoints, 
+        std::vector<std::vector<float>> & local_descriptors, std::vector<std::vector<float>> & scores) {
+    int batch = inputs.size();
+    keypoints.resize(batch);
+    local_descriptors.resize(batch);
+    scores.resize(batch);
+    if (!dynamic_batch) {
+        for (int b = 0; b < batch; b++) {
+            scores[b].clear();
+            inference(inputs[b], keypoints[b], local_descriptors[b], scores[b]);
+        }
+        return;
+    }
+    TicToc tic;
+    prepareBatch(batch);
+    for (int b = 0; b < batch; b++) {
+        preprocessGray(inputs[b], batchInput(b), 1/255.0);
+    }
+    doInferenceBatch();
+    double inference_time = tic.toc();
+
+    TicToc tic2;
+    for (int b = 0; b < batch; b++) {
+        keypoints[b].clear();
+        scores[b].clear();
+        cv::Mat Prob(height, width, CV_32F, (void*) batchOutput(0, b));
+        getKeyPoints(Prob, thres, nms_dist, nms, keypoints[b], scores[b], max_num);
+        computeDescriptors(batchOutput(1, b), keypoints[b], local_descriptors[b], width, height, pca_comp_T, pca_mean);
+    }
+    if (params->enable_perf_output) {
+        printf("[SuperPointONNX] batch %d inference time: %f ms, nms and desc time: %f ms\n", 
+            batch, inference_time, tic2.toc());
     }
 }
 }
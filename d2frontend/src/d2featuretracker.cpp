@@ -4,6 +4,7 @@
 #include <d2common/d2vinsframe.h>
 #include <d2frontend/utils.h>
 #include <d2frontend/loop_cam.h>
+#include <d2frontend/descriptor_matcher.h>
 #include <opencv2/core/cuda.hpp>
 
 #define MIN_HOMOGRAPHY 6
@@ -45,6 +46,7 @@ void D2FeatureTracker::updatebySldWin(const std::vector<VINSFrame*> sld_win) {
                 it++;
             } else {
                 lmanager->popFrame(it->frame_id);
+                keyframe_grids.erase(it->frame_id);
                 it = current_keyframes.erase(it);
             }
         } else {
@@ -59,16 +61,23 @@ void D2FeatureTracker::updatebySldWin(const std::vector<VINSFrame*> sld_win) {
     }
 }
 
-void D2FeatureTracker::updatebyLandmarkDB(const std::map<LandmarkIdType, LandmarkPerId> & vins_landmark_db) {
-    //update by sliding window
+void D2FeatureTracker::updatebyLandmarkDelta(const LandmarkDeltaPtr & delta) {
     const Guard guard2(lmanager_lock);
+    if (delta->version <= landmark_version) {
+        return;
+    }
+    if (delta->version != landmark_version + 1) {
+        printf("[D2FeatureTracker] Landmark delta %ld follows %ld, missed updates are lost\n", delta->version, landmark_version);
+    }
+    landmark_version = delta->version;
     if (_config.enable_motion_prediction_local || _config.enable_search_local_aera_remote) {
         auto & db = lmanager->getLandmarkDB();
-        for (auto & kv : vins_landmark_db) {
-            if (db.find(kv.first) != db.end()) {
-                auto & lm = lmanager->at(kv.first);
-                lm.flag = kv.second.flag;
-                lm.position = kv.second.position;
+        for (auto & update : delta->updates) {
+            auto it = db.find(update.landmark_id);
+            if (it != db.end()) {
+                auto & lm = lmanager->at(update.landmark_id);
+                lm.flag = update.flag;
+                lm.position = update.position;
             }
         }
     }
@@ -98,6 +107,8 @@ bool D2FeatureTracker::trackLocalFrames(VisualImageDescArray & frames) {
         for (auto & frame : frames.images) {
             report.compose(track(frame));
         }
+    } else if(params->camera_configuration == CameraConfig::FOURCORNER_FISHEYE && _config.enable_parallel_tracking) {
+        trackLocalFramesParallel(frames, report);
     } else if(params->camera_configuration == CameraConfig::FOURCORNER_FISHEYE) {
         report.compose(track(frames.images[0], frames.motion_prediction));
         report.compose(track(frames.images[1], frames.motion_prediction));
@@ -129,6 +140,56 @@ bool D2FeatureTracker::trackLocalFrames(VisualImageDescArray & frames) {
     return iskeyframe;
 }
 
+void D2FeatureTracker::trackLocalFramesParallel(VisualImageDescArray & frames, TrackReport & report) {
+    //Matching and optical flow of each camera run on the OpenMP pool, then results are committed in camera order,
+    //so that landmark ids are allocated exactly as in the sequential tracker.
+    int cam_num = frames.images.size();
+    std::vector<std::vector<int>> ids_b_to_a(cam_num);
+    std::vector<LKTrackPending> lk_pending(cam_num);
+    if (_config.enable_lk_optical_flow) {
+        for (auto & frame : frames.images) {
+            initLKInfo(frame);
+        }
+    }
+#pragma omp parallel for num_threads(cam_num)
+    for (int i = 0; i < cam_num; i++) {
+        matchKeyframe(frames.images[i], frames.motion_prediction, ids_b_to_a[i]);
+        if (_config.enable_lk_optical_flow) {
+            computeLK(frames.images[i], lk_pending[i]);
+        }
+    }
+    for (int i = 0; i < cam_num; i++) {
+        report.compose(commitKeyframeMatches(frames.images[i], ids_b_to_a[i]));
+        if (_config.enable_lk_optical_flow) {
+            report.compose(commitLK(frames.images[i], lk_pending[i]));
+        }
+    }
+
+    //Cross camera passes: left, right, type
+    const int lr_pairs[4][3] = {{0, 1, LEFT_RIGHT_IMG_MATCH}, {1, 2, LEFT_RIGHT_IMG_MATCH}, 
+        {2, 3, LEFT_RIGHT_IMG_MATCH}, {0, 3, RIGHT_LEFT_IMG_MATCH}};
+    std::vector<std::vector<int>> ids_lr(4);
+    std::vector<LKTrackPending> lk_pending_lr(4);
+#pragma omp parallel for num_threads(4)
+    for (int i = 0; i < 4; i++) {
+        auto & left = frames.images[lr_pairs[i][0]];
+        auto & right = frames.images[lr_pairs[i][1]];
+        auto type = (TrackLRType) lr_pairs[i][2];
+        matchLeftRight(left, right, type, ids_lr[i]);
+        if (_config.enable_lk_optical_flow) {
+            computeLKLeftRight(left, right, type, lk_pending_lr[i]);
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        auto & left = frames.images[lr_pairs[i][0]];
+        auto & right = frames.images[lr_pairs[i][1]];
+        report.compose(commitLeftRightMatches(left, right, ids_lr[i]));
+        if (_config.enable_lk_optical_flow) {
+            commitLKLeftRight(right, lk_pending_lr[i]);
+        }
+    }
+}
+
 bool D2FeatureTracker::getMatchedPrevKeyframe(const VisualImageDescArray & frame_a, VisualImageDescArray& prev, int & dir_a, int & dir_b) {
     const Guard lock(keyframe_lock);
     if (current_keyframes.size() == 0) {
@@ -322,12 +383,23 @@ void D2FeatureTracker::cvtRemoteLandmarkId(VisualImageDesc & frame) const {
 
 
 TrackReport D2FeatureTracker::track(VisualImageDesc & frame, const Swarm::Pose & motion_prediction) {
-    TrackReport report;
+    std::vector<int> ids_b_to_a;
+    matchKeyframe(frame, motion_prediction, ids_b_to_a);
+    TrackReport report = commitKeyframeMatches(frame, ids_b_to_a);
+    if (_config.enable_lk_optical_flow) {
+        //Enable LK optical flow feature tracker also.
+        //This is for the case that the superpoint features is not tracked well.
+        report.compose(trackLK(frame));
+    }
+    return report;
+}
+
+void D2FeatureTracker::matchKeyframe(const VisualImageDesc & frame, const Swarm::Pose & motion_prediction, std::vector<int> & ids_b_to_a) {
+    ids_b_to_a.clear();
     if (current_keyframes.size() > 0 && current_keyframes.back().frame_id != frame.frame_id) {
         auto & current_keyframe = current_keyframes.back();
         //Then current keyframe has been assigned, feature tracker by LK.
         auto & previous = current_keyframe.images[params->camera_seq[frame.camera_index]];
-        std::vector<int> ids_b_to_a;
         MatchLocalFeatureParams match_param;
         match_param.enable_superglue = _config.enable_superglue_local;
         match_param.enable_prediction = _config.enable_motion_prediction_local;
@@ -336,68 +408,109 @@ TrackReport D2FeatureTracker::track(VisualImageDesc & frame, const Swarm::Pose &
         match_param.search_radius = search_radius;
         match_param.enable_search_in_local = true;
         matchLocalFeatures(previous, frame, ids_b_to_a, match_param);
-        for (size_t i = 0; i < ids_b_to_a.size(); i++) { 
-            if (ids_b_to_a[i] >= 0) {
-                assert(ids_b_to_a[i] < previous.spLandmarkNum() && "too large");
-                auto prev_index = ids_b_to_a[i];
-                auto landmark_id = previous.landmarks[prev_index].landmark_id;
-                auto &cur_lm = frame.landmarks[i];
-                auto &prev_lm = previous.landmarks[prev_index];
-                cur_lm.landmark_id = landmark_id;
-                cur_lm.velocity = cur_lm.pt3d_norm - prev_lm.pt3d_norm;
-                cur_lm.velocity /= (frame.stamp - current_keyframe.stamp);
-                cur_lm.stamp_discover = prev_lm.stamp_discover;
-                lmanager->updateLandmark(cur_lm);
-                report.sum_parallex += (prev_lm.pt3d_norm - cur_lm.pt3d_norm).norm();
-                // printf("[D2FeatureTracker::track] landmark %ld cam_idx %d<->%d frame_cam_idx %d<->%d parallex %.1f%% prev_2d %.1f %.1f cur_2d %.3f %.3f prev_3d %.3f %.3f %.3f cur_3d %.3f %.3f %.3f\n", 
-                //     landmark_id, prev_lm.camera_index, cur_lm.camera_index, previous.camera_index, frame.camera_index,
-                //     (prev_lm.pt3d_norm - cur_lm.pt3d_norm).norm()*100, prev_lm.pt2d.x, prev_lm.pt2d.y, cur_lm.pt2d.x, cur_lm.pt2d.y,
-                //     prev_lm.pt3d_norm.x(), prev_lm.pt3d_norm.y(), prev_lm.pt3d_norm.z(), cur_lm.pt3d_norm.x(), cur_lm.pt3d_norm.y(), cur_lm.pt3d_norm.z());
-                report.parallex_num ++;
-                if (lmanager->at(landmark_id).track.size() >= _config.long_track_frames) {
-                    report.long_track_num ++;
-                } else {
-                    report.unmatched_num ++;
-                }
+    }
+}
+
+TrackReport D2FeatureTracker::commitKeyframeMatches(VisualImageDesc & frame, const std::vector<int> & ids_b_to_a) {
+    TrackReport report;
+    if (ids_b_to_a.size() == 0) {
+        return report;
+    }
+    auto & current_keyframe = current_keyframes.back();
+    auto & previous = current_keyframe.images[params->camera_seq[frame.camera_index]];
+    for (size_t i = 0; i < ids_b_to_a.size(); i++) { 
+        if (ids_b_to_a[i] >= 0) {
+            assert(ids_b_to_a[i] < previous.spLandmarkNum() && "too large");
+            auto prev_index = ids_b_to_a[i];
+            auto landmark_id = previous.landmarks[prev_index].landmark_id;
+            auto &cur_lm = frame.landmarks[i];
+            auto &prev_lm = previous.landmarks[prev_index];
+            cur_lm.landmark_id = landmark_id;
+            cur_lm.velocity = cur_lm.pt3d_norm - prev_lm.pt3d_norm;
+            cur_lm.velocity /= (frame.stamp - current_keyframe.stamp);
+            cur_lm.stamp_discover = prev_lm.stamp_discover;
+            lmanager->updateLandmark(cur_lm);
+            report.sum_parallex += (prev_lm.pt3d_norm - cur_lm.pt3d_norm).norm();
+            // printf("[D2FeatureTracker::track] landmark %ld cam_idx %d<->%d frame_cam_idx %d<->%d parallex %.1f%% prev_2d %.1f %.1f cur_2d %.3f %.3f prev_3d %.3f %.3f %.3f cur_3d %.3f %.3f %.3f\n", 
+            //     landmark_id, prev_lm.camera_index, cur_lm.camera_index, previous.camera_index, frame.camera_index,
+            //     (prev_lm.pt3d_norm - cur_lm.pt3d_norm).norm()*100, prev_lm.pt2d.x, prev_lm.pt2d.y, cur_lm.pt2d.x, cur_lm.pt2d.y,
+            //     prev_lm.pt3d_norm.x(), prev_lm.pt3d_norm.y(), prev_lm.pt3d_norm.z(), cur_lm.pt3d_norm.x(), cur_lm.pt3d_norm.y(), cur_lm.pt3d_norm.z());
+            report.parallex_num ++;
+            if (lmanager->at(landmark_id).track.size() >= _config.long_track_frames) {
+                report.long_track_num ++;
+            } else {
+                report.unmatched_num ++;
             }
         }
     }
-    if (_config.enable_lk_optical_flow) {
-        //Enable LK optical flow feature tracker also.
-        //This is for the case that the superpoint features is not tracked well.
-        report.compose(trackLK(frame));
-    }
     return report;
 }
 
-TrackReport D2FeatureTracker::trackLK(VisualImageDesc & frame) {
-    //Track LK points
-    TrackReport report;
+void D2FeatureTracker::initLKInfo(const VisualImageDesc & frame) {
     if (prev_lk_info.find(frame.camera_index) == prev_lk_info.end()) {
         prev_lk_info[frame.camera_index] = LKImageInfo();
+    }
+}
+
+TrackReport D2FeatureTracker::trackLK(VisualImageDesc & frame) {
+    //Track LK points
+    initLKInfo(frame);
+    LKTrackPending pending;
+    computeLK(frame, pending);
+    return commitLK(frame, pending);
+}
+
+void D2FeatureTracker::computeLK(const VisualImageDesc & frame, LKTrackPending & pending) {
+    //Only optical flow and detection here; landmarks are created in commitLK.
+    const auto & lk_info = prev_lk_info.at(frame.camera_index);
+    pending.lk_pts = lk_info.lk_pts;
+    pending.lk_ids = lk_info.lk_ids;
+    //The pyramid is always built, so it is current for the next frame and for left-right tracking
+    if (_config.lk_use_cuda) {
         cv::cuda::GpuMat image_cuda(frame.raw_image);
-        prev_lk_info[frame.camera_index].pyr = buildImagePyramid(image_cuda);
-    }
-    auto cur_lk_pts = prev_lk_info[frame.camera_index].lk_pts;
-    auto cur_lk_ids = prev_lk_info[frame.camera_index].lk_ids;
-    if (!cur_lk_ids.empty()) {
-        int prev_lk_num = cur_lk_ids.size();
-        cur_lk_pts = opticalflowTrackPyr(frame.raw_image, prev_lk_info[frame.camera_index].pyr, cur_lk_pts, cur_lk_ids, 
-            TrackLRType::WHOLE_IMG_MATCH, true);
+        pending.pyr = buildImagePyramid(image_cuda);
+    } else {
+        pending.pyr_cpu = buildImagePyramid(frame.raw_image);
+    }
+    if (!pending.lk_ids.empty()) {
+        int prev_lk_num = pending.lk_ids.size();
+        if (_config.lk_use_cuda) {
+            pending.lk_pts = opticalflowTrackPyr(frame.raw_image, lk_info.pyr, pending.pyr, pending.lk_pts, pending.lk_ids, 
+                TrackLRType::WHOLE_IMG_MATCH);
+        } else {
+            pending.lk_pts = opticalflowTrackPyr(frame.raw_image, lk_info.pyr_cpu, pending.pyr_cpu, pending.lk_pts, pending.lk_ids, 
+                TrackLRType::WHOLE_IMG_MATCH);
+        }
         if (params->verbose) {
             printf("[D2FeatureTracker::trackLK] track %d LK points, %d lost, track rate %.1f%%\n", 
-                prev_lk_num, prev_lk_num - cur_lk_pts.size(), cur_lk_pts.size() * 100.0 / prev_lk_num);
+                prev_lk_num, prev_lk_num - pending.lk_pts.size(), pending.lk_pts.size() * 100.0 / prev_lk_num);
         }
     }
     auto cur_all_pts = frame.landmarks2D();
-    cur_all_pts.insert(cur_all_pts.end(), cur_lk_pts.begin(), cur_lk_pts.end());
+    cur_all_pts.insert(cur_all_pts.end(), pending.lk_pts.begin(), pending.lk_pts.end());
+    //Discover new points.
+    pending.new_pts.clear();
+    if (!frame.raw_image.empty()) {
+        TicToc t_det;
+        detectPoints(frame.raw_image, pending.new_pts, cur_all_pts, params->total_feature_num, _config.lk_use_cuda, _config.lk_use_fast);
+        if (params->enable_perf_output) {
+            printf("[D2FeatureTracker::trackLK] detect %ld points in %.2fms\n", pending.new_pts.size(), t_det.toc());
+        }
+    } else {
+        printf("[D2FeatureTracker::trackLK] empty image\n");
+    }
+}
+
+TrackReport D2FeatureTracker::commitLK(VisualImageDesc & frame, LKTrackPending & pending) {
+    TrackReport report;
+    auto & cur_lk_pts = pending.lk_pts;
+    auto & cur_lk_ids = pending.lk_ids;
     for (int i = 0; i < cur_lk_pts.size(); i++) {
         auto ret = createLKLandmark(frame, cur_lk_pts[i], cur_lk_ids[i]);
         if (!ret.first) {
             continue;
         }
         auto &lm = ret.second;
-        auto track = lmanager->at(cur_lk_ids[i]).track;
         lm.velocity = extractPointVelocity(lm);
         auto prev_found = getPreviousLandmarkFrame(lm);
         if (prev_found.first) {
@@ -414,19 +527,8 @@ TrackReport D2FeatureTracker::trackLK(VisualImageDesc & frame) {
         report.sum_parallex += (lm.pt3d_norm - prev_found.second.pt3d_norm).norm();
         report.parallex_num ++;
     }
-    //Discover new points.
-    std::vector<cv::Point2f> n_pts;
-    if (!frame.raw_image.empty()) {
-        TicToc t_det;
-        detectPoints(frame.raw_image, n_pts, cur_all_pts, params->total_feature_num, true, _config.lk_use_fast);
-        if (params->enable_perf_output) {
-            printf("[D2FeatureTracker::trackLK] detect %ld points in %.2fms\n", n_pts.size(), t_det.toc());
-        }
-    } else {
-        printf("[D2FeatureTracker::trackLK] empty image\n");
-    }
-    report.unmatched_num += n_pts.size();
-    for (auto & pt : n_pts) {
+    report.unmatched_num += pending.new_pts.size();
+    for (auto & pt : pending.new_pts) {
         auto ret = createLKLandmark(frame, pt);
         if (!ret.first) {
             continue;
@@ -438,10 +540,13 @@ TrackReport D2FeatureTracker::trackLK(VisualImageDesc & frame) {
         cur_lk_pts.emplace_back(pt);
         cur_lk_ids.emplace_back(_id);
     }
-    prev_lk_info[frame.camera_index].lk_pts = cur_lk_pts;
-    prev_lk_info[frame.camera_index].lk_ids = cur_lk_ids;
-    prev_lk_info[frame.camera_index].image  = frame.raw_image.clone();
-    prev_lk_info[frame.camera_index].frame_id = frame.frame_id;
+    auto & lk_info = prev_lk_info[frame.camera_index];
+    lk_info.lk_pts = cur_lk_pts;
+    lk_info.lk_ids = cur_lk_ids;
+    lk_info.pyr = std::move(pending.pyr);
+    lk_info.pyr_cpu = std::move(pending.pyr_cpu);
+    lk_info.image  = frame.raw_image.clone();
+    lk_info.frame_id = frame.frame_id;
     return report;
 }
 
@@ -477,10 +582,17 @@ Vector3d D2FeatureTracker::extractPointVelocity(const LandmarkPerFrame & lpf) co
 }
 
 TrackReport D2FeatureTracker::track(const VisualImageDesc & left_frame, VisualImageDesc & right_frame, bool enable_lk, TrackLRType type) {
-    auto prev_pts = left_frame.landmarks2D();
-    auto cur_pts = right_frame.landmarks2D();
     std::vector<int> ids_b_to_a;
-    TrackReport report;
+    matchLeftRight(left_frame, right_frame, type, ids_b_to_a);
+    TrackReport report = commitLeftRightMatches(left_frame, right_frame, ids_b_to_a);
+    if (_config.enable_lk_optical_flow && enable_lk) {
+        trackLK(left_frame, right_frame, type);
+    }
+    return report;
+}
+
+void D2FeatureTracker::matchLeftRight(const VisualImageDesc & left_frame, const VisualImageDesc & right_frame, 
+        TrackLRType type, std::vector<int> & ids_b_to_a) {
     double search_radius_lr = search_radius;
     MatchLocalFeatureParams match_param;
     match_param.enable_superglue = _config.enable_superglue_local;
@@ -490,6 +602,11 @@ TrackReport D2FeatureTracker::track(const VisualImageDesc & left_frame, VisualIm
     match_param.prediction_using_extrinsic = true;
     match_param.enable_search_in_local = true;
     matchLocalFeatures(left_frame, right_frame, ids_b_to_a, match_param);
+}
+
+TrackReport D2FeatureTracker::commitLeftRightMatches(const VisualImageDesc & left_frame, VisualImageDesc & right_frame, 
+        const std::vector<int> & ids_b_to_a) {
+    TrackReport report;
     for (size_t i = 0; i < ids_b_to_a.size(); i++) { 
         if (ids_b_to_a[i] >= 0) {
             assert(ids_b_to_a[i] < left_frame.spLandmarkNum() && "too large");
@@ -504,24 +621,52 @@ TrackReport D2FeatureTracker::track(const VisualImageDesc & left_frame, VisualIm
             report.stereo_point_num ++;
         }
     }
-    if (_config.enable_lk_optical_flow && enable_lk) {
-        trackLK(left_frame, right_frame, type);
-    }
     return report;
 }
 
 TrackReport D2FeatureTracker::trackLK(const VisualImageDesc & left_frame, VisualImageDesc & right_frame, TrackLRType type) {
     //Track LK points
     //This function MUST run after track(...)
+    LKTrackPending pending;
+    computeLKLeftRight(left_frame, right_frame, type, pending);
+    return commitLKLeftRight(right_frame, pending);
+}
+
+void D2FeatureTracker::computeLKLeftRight(const VisualImageDesc & left_frame, const VisualImageDesc & right_frame, 
+        TrackLRType type, LKTrackPending & pending) {
+    const auto & lk_info = prev_lk_info.at(left_frame.camera_index);
+    pending.lk_pts = lk_info.lk_pts;
+    pending.lk_ids = lk_info.lk_ids;
+    assert(left_frame.frame_id == lk_info.frame_id);
+    if (pending.lk_ids.empty()) {
+        return;
+    }
+    //Reuse the pyramid of the right image if it has been tracked already in this frame
+    auto it = prev_lk_info.find(right_frame.camera_index);
+    bool right_cached = it != prev_lk_info.end() && it->second.frame_id == right_frame.frame_id;
+    if (_config.lk_use_cuda) {
+        if (right_cached && !it->second.pyr.empty()) {
+            pending.lk_pts = opticalflowTrackPyr(right_frame.raw_image, lk_info.pyr, it->second.pyr, pending.lk_pts, pending.lk_ids, type);
+        } else {
+            cv::cuda::GpuMat image_cuda(right_frame.raw_image);
+            auto right_pyr = buildImagePyramid(image_cuda);
+            pending.lk_pts = opticalflowTrackPyr(right_frame.raw_image, lk_info.pyr, right_pyr, pending.lk_pts, pending.lk_ids, type);
+        }
+    } else {
+        if (right_cached && !it->second.pyr_cpu.empty()) {
+            pending.lk_pts = opticalflowTrackPyr(right_frame.raw_image, lk_info.pyr_cpu, it->second.pyr_cpu, pending.lk_pts, pending.lk_ids, type);
+        } else {
+            auto right_pyr = buildImagePyramid(right_frame.raw_image);
+            pending.lk_pts = opticalflowTrackPyr(right_frame.raw_image, lk_info.pyr_cpu, right_pyr, pending.lk_pts, pending.lk_ids, type);
+        }
+    }
+    // printf("[trackLK] indices %d<->%d track type %d LK points: %lu\n", left_frame.camera_index, right_frame.camera_index, type, pending.lk_pts.size());
+}
+
+TrackReport D2FeatureTracker::commitLKLeftRight(VisualImageDesc & right_frame, const LKTrackPending & pending) {
     TrackReport report;
-    auto cur_lk_pts = prev_lk_info[left_frame.camera_index].lk_pts;
-    auto cur_lk_ids = prev_lk_info[left_frame.camera_index].lk_ids;
-    auto cur_lk_pyr = prev_lk_info[left_frame.camera_index].pyr;
-    assert(left_frame.frame_id == prev_lk_info[left_frame.camera_index].frame_id);
-    if (!cur_lk_ids.empty()) {
-        cur_lk_pts = opticalflowTrackPyr(right_frame.raw_image, cur_lk_pyr, cur_lk_pts, cur_lk_ids, type, false);
-    }
-    // printf("[trackLK] indices %d<->%d track type %d LK points: %lu\n", left_frame.camera_index, right_frame.camera_index, type, cur_lk_pts.size());
+    auto & cur_lk_pts = pending.lk_pts;
+    auto & cur_lk_ids = pending.lk_ids;
     for (int i = 0; i < cur_lk_pts.size(); i++) {
         auto ret = createLKLandmark(right_frame, cur_lk_pts[i], cur_lk_ids[i]);
         if (!ret.first) {
@@ -602,9 +747,32 @@ void D2FeatureTracker::processFrame(VisualImageDescArray & frames, bool is_keyfr
         frame.pose_drone = frames.motion_prediction;
     }
     frames.pose_drone = frames.motion_prediction;
+    if (search_radius > 0 && !_config.enable_motion_prediction_local) {
+        //Built once here and reused by every frame tracked against this keyframe. With motion prediction the query
+        //points are predicted anew for each frame, so a grid over the keyframe points cannot gate them.
+        auto & grids = keyframe_grids[frames.frame_id];
+        for (auto & frame: frames.images) {
+            grids[frame.camera_index] = LandmarkGridIndex::fromSuperPoints(frame, search_radius);
+        }
+    }
     current_keyframes.emplace_back(frames);
 }
 
+const LandmarkGridIndex * D2FeatureTracker::getKeyframeGrid(const VisualImageDesc & img_desc) const {
+    if (img_desc.drone_id != params->self_id) {
+        return nullptr;
+    }
+    auto it = keyframe_grids.find(img_desc.frame_id);
+    if (it == keyframe_grids.end()) {
+        return nullptr;
+    }
+    auto it_cam = it->second.find(img_desc.camera_index);
+    if (it_cam == it->second.end() || it_cam->second.empty()) {
+        return nullptr;
+    }
+    return &it_cam->second;
+}
+
 cv::Mat D2FeatureTracker::drawToImage(const VisualImageDesc & frame, bool is_keyframe, const TrackReport & report, bool is_right, bool is_remote) const {
     // ROS_INFO("Drawing ... %d", keyframe_count);
     cv::Mat img = frame.raw_image;
@@ -838,16 +1006,21 @@ bool D2FeatureTracker::matchLocalFeatures(const VisualImageDesc & img_desc_a, co
         if (param.type == WHOLE_IMG_MATCH) {
             const cv::Mat desc_a(raw_desc_a.size()/params->superpoint_dims, params->superpoint_dims, CV_32F, const_cast<float *>(raw_desc_a.data()));
             const cv::Mat desc_b(raw_desc_b.size()/params->superpoint_dims, params->superpoint_dims, CV_32F, const_cast<float *>(raw_desc_b.data()));
-            if (_config.enable_knn_match) {
-                if (img_desc_a.drone_id  == img_desc_b.drone_id && img_desc_a.camera_id == img_desc_b.camera_id) {
-                    // Is continuous frame
-                    _matches = matchKNN(desc_a, desc_b, _config.knn_match_ratio, pts_pred_a_on_b, pts_b, search_radius);
-                } else {
-                    _matches = matchKNN(desc_a, desc_b, _config.knn_match_ratio, pts_pred_a_on_b, pts_b, search_radius);
-                }
+            //Without prediction pts_pred_a_on_b are the keyframe points, so its cached grid is used for gating
+            const LandmarkGridIndex * grid_a = nullptr;
+            if (!param.enable_prediction && search_radius > 0) {
+                grid_a = getKeyframeGrid(img_desc_a);
+            }
+            if (_config.enable_knn_match && grid_a != nullptr && grid_a->size() == desc_a.rows) {
+                DescriptorMatcher matcher(params->superpoint_dims, search_radius);
+                matcher.setTrain(raw_desc_b.data(), desc_b.rows);
+                _matches = matcher.matchRatio(raw_desc_a.data(), *grid_a, _config.knn_match_ratio, pts_b);
+            } else if (_config.enable_knn_match) {
+                _matches = matchKNN(desc_a, desc_b, _config.knn_match_ratio, pts_pred_a_on_b, pts_b, search_radius);
             } else {
-                cv::BFMatcher bfmatcher(cv::NORM_L2, true);
-                bfmatcher.match(desc_a, desc_b, _matches); //Query train result
+                DescriptorMatcher matcher(params->superpoint_dims);
+                matcher.setTrain(raw_desc_b.data(), desc_b.rows);
+                _matches = matcher.matchCrossCheck(raw_desc_a.data(), desc_a.rows); //Query train result
             }
         } else {
             //TODO: motion prediction for quadcam on stereo
@@ -859,7 +1032,6 @@ bool D2FeatureTracker::matchLocalFeatures(const VisualImageDesc & img_desc_a, co
                     printf("[D2FeatureTracker] matchLocalFeatures failed: no feature to match.\n");
                 return false;
             }
-            cv::BFMatcher bfmatcher(cv::NORM_L2, true);
             const cv::Mat desc_a(tmp_to_idx_a.size(), params->superpoint_dims, CV_32F, const_cast<float *>(features_a.first.data()));
             const cv::Mat desc_b(tmp_to_idx_b.size(), params->superpoint_dims, CV_32F, const_cast<float *>(features_b.first.data()));
             if (_config.enable_knn_match) {
@@ -871,8 +1043,9 @@ bool D2FeatureTracker::matchLocalFeatures(const VisualImageDesc & img_desc_a, co
                 }
                 _matches = matchKNN(desc_a, desc_b, _config.knn_match_ratio, features_a.second, features_b.second, search_radius);
             } else {
-                cv::BFMatcher bfmatcher(cv::NORM_L2, true);
-                bfmatcher.match(desc_a, desc_b, _matches);
+                DescriptorMatcher matcher(params->superpoint_dims);
+                matcher.setTrain(features_b.first.data(), desc_b.rows);
+                _matches = matcher.matchCrossCheck(features_a.first.data(), desc_a.rows);
             }
             for (auto & match : _matches) {
                 match.queryIdx = tmp_to_idx_a[match.queryIdx];
@@ -881,10 +1054,7 @@ bool D2FeatureTracker::matchLocalFeatures(const VisualImageDesc & img_desc_a, co
         }
     }
     std::vector<cv::Point2f> matched_pts_a_normed, matched_pts_b_normed, matched_pts_a, matched_pts_b;
-    if (params->show) {
-        landmark_predictions_viz[img_desc_b.camera_id] = std::vector<cv::Point2f>();
-        landmark_predictions_matched_viz[img_desc_b.camera_id] = std::vector<cv::Point2f>();
-    }
+    std::vector<cv::Point2f> predictions_viz, predictions_matched_viz;
     for (auto match : _matches) {
         ids_a.push_back(match.queryIdx);
         ids_b.push_back(match.trainIdx);
@@ -893,12 +1063,18 @@ bool D2FeatureTracker::matchLocalFeatures(const VisualImageDesc & img_desc_a, co
         matched_pts_a.push_back(pts_a[match.queryIdx]);
         matched_pts_b.push_back(pts_b[match.trainIdx]);
         if (params->show && param.enable_prediction) {
-            landmark_predictions_viz[img_desc_b.camera_id].push_back(pts_pred_a_on_b[match.queryIdx]);
-            landmark_predictions_matched_viz[img_desc_b.camera_id].push_back(pts_b[match.trainIdx]);
+            predictions_viz.push_back(pts_pred_a_on_b[match.queryIdx]);
+            predictions_matched_viz.push_back(pts_b[match.trainIdx]);
             // printf("Point %d: (%f, %f) -> (%f, %f)\n", match.queryIdx, 
             //     pts_pred_a_on_b[match.queryIdx].x, pts_pred_a_on_b[match.queryIdx].y, pts_b[match.trainIdx].x, pts_b[match.trainIdx].y);
         }
     }
+    if (params->show) {
+        //May be called from several tracking threads
+        std::lock_guard<std::mutex> lock(viz_lock);
+        landmark_predictions_viz[img_desc_b.camera_id] = predictions_viz;
+        landmark_predictions_matched_viz[img_desc_b.camera_id] = predictions_matched_viz;
+    }
     if (img_desc_a.drone_id != img_desc_b.drone_id &&
             params->ftconfig->check_essential && !param.enable_superglue) {
         //only perform this for remote
@@ -58,43 +58,63 @@ StereoFrame D2Frontend::findImagesRaw(const nav_msgs::Odometry & odometry) {
 }
 
 void D2Frontend::stereoImagesCallback(const sensor_msgs::ImageConstPtr left, const sensor_msgs::ImageConstPtr right) {
-    auto _l = getImageFromMsg(left);
-    auto _r = getImageFromMsg(right);
-    StereoFrame sframe(_l->header.stamp, _l->image, _r->image, params->extrinsics[0], params->extrinsics[1], params->self_id);
+    std::shared_ptr<const void> holder_l, holder_r;
+    auto _l = getImageFromMsg(left, holder_l);
+    auto _r = getImageFromMsg(right, holder_r);
+    StereoFrame sframe(left->header.stamp, _l, _r, params->extrinsics[0], params->extrinsics[1], params->self_id);
+    sframe.image_holders = {holder_l, holder_r};
     processStereoframe(sframe);
 }
 
 void D2Frontend::depthImagesCallback(const sensor_msgs::ImageConstPtr left, const sensor_msgs::ImageConstPtr depth) {
-    auto _l = getImageFromMsg(left);
-    auto _d = getImageFromMsg(depth);
-    StereoFrame sframe(left->header.stamp, _l->image, _d->image, params->extrinsics[0], params->self_id);
+    std::shared_ptr<const void> holder_l, holder_d;
+    auto _l = getImageFromMsg(left, holder_l);
+    cv::Mat _d;
+    if (depth->encoding == "16UC1" || depth->encoding == "mono16") {
+        //Depth is read as millimeters in unsigned short, keep it as is
+        _d = cv_bridge::toCvShare(depth)->image;
+        holder_d = holdMessage(depth);
+    } else {
+        _d = getImageFromMsg(depth, holder_d);
+    }
+    StereoFrame sframe(left->header.stamp, _l, _d, params->extrinsics[0], params->self_id);
+    sframe.image_holders = {holder_l, holder_d};
     processStereoframe(sframe);
 }
 
 void D2Frontend::monoImageCallback(const sensor_msgs::ImageConstPtr & image) {
-    auto _l = getImageFromMsg(image);
-    auto img = _l->image;
-    //Horizon split image to four images:
+    std::shared_ptr<const void> holder;
+    auto img = getGrayImageFromMsg(image, gray_pool, holder);
+    //Horizon split image to four images, as views of the same buffer:
     std::vector<cv::Mat> imgs;
     const int num_imgs = 4;
     for (int i = 0; i < 4; i++) {
         imgs.emplace_back(img(cv::Rect(i * img.cols /num_imgs, 0, img.cols /num_imgs, img.rows)));
-        if (imgs.back().channels() == 3) {
-            cv::cvtColor(imgs.back(), imgs.back(), cv::COLOR_BGR2GRAY);
-        }
     }
     if (params->show_raw_image) {
         cv::namedWindow("raw_image", cv::WINDOW_NORMAL | cv::WINDOW_GUI_EXPANDED);
         cv::imshow("RawImage", img);
     }
     StereoFrame sframe(image->header.stamp, imgs, params->extrinsics, params->self_id);
+    sframe.image_holders = {holder};
     processStereoframe(sframe);
 }
 
 void D2Frontend::processStereoframe(const StereoFrame & stereoframe) {
     static int count = 0;
     // ROS_INFO("[D2Frontend::processStereoframe] %d", count ++);
+    if (params->enable_pipeline) {
+        extract_queue->push(stereoframe);
+        return;
+    }
     auto vframearry = loop_cam->processStereoframe(stereoframe);
+    if (trackFrame(vframearry)) {
+        backendFrameCallback(vframearry);
+    }
+}
+
+bool D2Frontend::trackFrame(VisualImageDescArray & vframearry) {
+    //Returns if the frame should be sent to backend
     vframearry.motion_prediction = getMotionPredict(vframearry.stamp);
     bool is_keyframe = feature_tracker->trackLocalFrames(vframearry);
     vframearry.prevent_adding_db = !is_keyframe;
@@ -103,16 +123,70 @@ void D2Frontend::processStereoframe(const StereoFrame & stereoframe) {
     if (!params->show) {
         vframearry.releaseRawImages();
     }
-    if (vframearry.send_to_backend) {
+    return vframearry.send_to_backend;
+}
+
+void D2Frontend::extractThread() {
+    while (ros::ok() && !extract_queue->isClosed()) {
+        StereoFrame stereoframe;
+        double wait_ms = 0;
+        if (!extract_queue->pop(stereoframe, wait_ms)) {
+            continue;
+        }
+        Utility::TicToc tic;
+        auto vframearry = loop_cam->processStereoframe(stereoframe);
+        extract_queue->stats.add(wait_ms, tic.toc());
+        track_queue->push(std::move(vframearry));
+    }
+}
+
+void D2Frontend::trackThread() {
+    while (ros::ok() && !track_queue->isClosed()) {
+        VisualImageDescArray vframearry;
+        double wait_ms = 0;
+        if (!track_queue->pop(vframearry, wait_ms)) {
+            continue;
+        }
+        Utility::TicToc tic;
+        bool send_to_backend = trackFrame(vframearry);
+        track_queue->stats.add(wait_ms, tic.toc());
+        if (send_to_backend) {
+            backend_queue->push(std::move(vframearry));
+        }
+    }
+}
+
+void D2Frontend::backendThread() {
+    while (ros::ok() && !backend_queue->isClosed()) {
+        VisualImageDescArray vframearry;
+        double wait_ms = 0;
+        if (!backend_queue->pop(vframearry, wait_ms)) {
+            continue;
+        }
+        Utility::TicToc tic;
         backendFrameCallback(vframearry);
+        backend_queue->stats.add(wait_ms, tic.toc());
     }
 }
 
+int D2Frontend::loopQueuePriority(const VisualImageDescArray & viokf) {
+    //Local keyframes and the first frames of a newly seen drone, then frames answering a broadcast, then other remote frames
+    lock_guard guard(loop_lock);
+    int count = loop_drone_frames[viokf.drone_id] ++;
+    if (viokf.drone_id == params->self_id || count < params->loopdetectorconfig->inter_drone_init_frames) {
+        return 2;
+    }
+    if (viokf.isMatchedFrame()) {
+        return 1;
+    }
+    return 0;
+}
+
 void D2Frontend::addToLoopQueue(const VisualImageDescArray & viokf) {
     if (params->enable_loop) {
-        lock_guard guard(loop_lock);
-        Utility::TicToc tic;
-        loop_queue.push(viokf);
+        if (!loop_queue->push(viokf, loopQueuePriority(viokf)) && params->verbose) {
+            printf("[D2Frontend] Loop queue full, drop frame %ld from drone %d\n", viokf.frame_id, viokf.drone_id);
+        }
     }
 }
 
@@ -166,20 +240,32 @@ void D2Frontend::processRemoteImage(VisualImageDescArray & frame_desc, bool succ
 
 
 void D2Frontend::loopDetectionThread() {
-    while (ros::ok()) {
-        if (loop_queue.size() > 0) {
-            VisualImageDescArray vframearry;
-            {
-                lock_guard guard(loop_lock);
-                vframearry = loop_queue.front();
-                loop_queue.pop();
-            }
-            if (loop_queue.size() > 10) {
-                ROS_WARN("[D2Frontend] Loop queue size is %d", loop_queue.size());
-            }
-            loop_detector->processImageArray(vframearry);
+    while (ros::ok() && !loop_queue->isClosed()) {
+        VisualImageDescArray vframearry;
+        double wait_ms = 0;
+        if (!loop_queue->pop(vframearry, wait_ms)) {
+            continue;
+        }
+        Utility::TicToc tic;
+        LoopVerifyTask task;
+        bool need_verify = loop_detector->queryImageArray(vframearry, task);
+        loop_queue->stats.add(wait_ms, tic.toc());
+        if (need_verify) {
+            loop_verify_queue->push(std::move(task));
+        }
+    }
+}
+
+void D2Frontend::loopVerifyThread() {
+    while (ros::ok() && !loop_verify_queue->isClosed()) {
+        LoopVerifyTask task;
+        double wait_ms = 0;
+        if (!loop_verify_queue->pop(task, wait_ms)) {
+            continue;
         }
-        usleep(10000);
+        Utility::TicToc tic;
+        loop_detector->verifyLoop(task);
+        loop_verify_queue->stats.add(wait_ms, tic.toc());
     }
 }
 
@@ -197,6 +283,49 @@ void D2Frontend::onRemoteFrameROS(const swarm_msgs::ImageArrayDescriptor & remot
 
 D2Frontend::D2Frontend () {}
 
+D2Frontend::~D2Frontend() {
+    D2Frontend::stop();
+}
+
+void D2Frontend::stop() {
+    if (stopped) {
+        return;
+    }
+    stopped = true;
+    //Upstream stages first, so no stage pushes into a closed queue while it still has work
+    for (auto queue : {extract_queue, track_queue, backend_queue}) {
+        if (queue != nullptr) {
+            queue->close();
+        }
+    }
+    for (auto th_stage : {&th_extract, &th_track, &th_backend}) {
+        if (th_stage->joinable()) {
+            th_stage->join();
+        }
+    }
+    if (loop_queue != nullptr) {
+        loop_queue->close();
+    }
+    if (th_loop_det.joinable()) {
+        th_loop_det.join();
+    }
+    if (loop_verify_queue != nullptr) {
+        loop_verify_queue->close();
+    }
+    if (th_loop_verify.joinable()) {
+        th_loop_verify.join();
+    }
+    //Both loop stages have exited, so the database is no longer modified
+    if (loop_detector != nullptr && params->loopdetectorconfig->save_database_path != "") {
+        loop_detector->saveDatabase(params->loopdetectorconfig->save_database_path);
+    }
+    //The LCM thread is blocked in lcm handle and cannot be woken up
+    if (th.joinable()) {
+        th.detach();
+    }
+    ROS_INFO("[D2Frontend] Stopped.");
+}
+
 void D2Frontend::Init(ros::NodeHandle & nh) {
     //Init Loop Net
     params = new D2FrontendParams(nh);
@@ -209,11 +338,18 @@ void D2Frontend::Init(ros::NodeHandle & nh) {
     feature_tracker->cams = loop_cam->cams;
     loop_detector = new LoopDetector(params->self_id, *(params->loopdetectorconfig));
     loop_detector->loop_cam = loop_cam;
+    loop_queue = new PriorityFrameQueue<VisualImageDescArray>("loop_query", params->loop_queue_size);
+    //Verification never blocks the query stage, so database inserts keep flowing; stale tasks are dropped instead.
+    loop_verify_queue = new BoundedFrameQueue<LoopVerifyTask>("loop_verify", params->loop_queue_size, FrameDropPolicy::DROP_OLDEST);
 
     loop_detector->on_loop_cb = [&] (LoopEdge & loop_con) {
         this->onLoopConnection(loop_con, true);
     };
 
+    loop_detector->on_relocalization_cb = [&] (LoopEdge & loop_con) {
+        relocalization_pub.publish(loop_con);
+    };
+
     loop_detector->broadcast_keyframe_cb = [&] (VisualImageDescArray & viokf) {
         loop_net->broadcastVisualImageDescArray(viokf, true);
     };
@@ -257,6 +393,8 @@ void D2Frontend::Init(ros::NodeHandle & nh) {
     keyframe_pub = nh.advertise<swarm_msgs::node_frame>("keyframe", 10);
 
     loopconn_pub = nh.advertise<swarm_msgs::LoopEdge>("loop", 10);
+    //Loops against the loaded database, relative to the keyframes of the session that saved it
+    relocalization_pub = nh.advertise<swarm_msgs::LoopEdge>("relocalization", 10);
     
     if (params->enable_sub_remote_frame) {
         ROS_INFO("[SWARM_LOOP] Subscribing remote image from bag");
@@ -271,8 +409,21 @@ void D2Frontend::Init(ros::NodeHandle & nh) {
         loop_net->scanRecvPackets();
     });
 
+    if (params->enable_pipeline) {
+        //Frame N+1 is extracted while frame N is tracked. Only tracked frames know if they are keyframes.
+        ROS_INFO("[D2Frontend] Pipelined frontend: queue size %d drop policy %d", params->pipeline_queue_size, params->pipeline_drop_policy);
+        extract_queue = new BoundedFrameQueue<StereoFrame>("extract", params->pipeline_queue_size, params->pipeline_drop_policy);
+        track_queue = new BoundedFrameQueue<VisualImageDescArray>("track", params->pipeline_queue_size, params->pipeline_drop_policy);
+        backend_queue = new BoundedFrameQueue<VisualImageDescArray>("backend", params->pipeline_queue_size, params->pipeline_drop_policy, 
+            [] (const VisualImageDescArray & frame) { return frame.is_keyframe; });
+        th_extract = std::thread(&D2Frontend::extractThread, this);
+        th_track = std::thread(&D2Frontend::trackThread, this);
+        th_backend = std::thread(&D2Frontend::backendThread, this);
+    }
+
     // loop_timer = nh.createTimer(ros::Duration(0.01), &D2Frontend::loopTimerCallback, this);
     th_loop_det = std::thread(&D2Frontend::loopDetectionThread, this);
+    th_loop_verify = std::thread(&D2Frontend::loopVerifyThread, this);
     th = std::thread([&] {
         while(0 == loop_net->lcmHandle()) {
         }
@@ -19,6 +19,7 @@ int main(int argc, char **argv)
     D2FrontendNode frontend(n);
     ros::MultiThreadedSpinner spinner(3);
     spinner.spin();
+    frontend.stop();
     return 0;
 }
 
@@ -43,6 +43,18 @@ namespace D2FrontEnd {
         nh.param<bool>("enable_sub_remote_frame", enable_sub_remote_frame, false);
         nh.param<std::string>("output_path", OUTPUT_PATH, "");
         enable_perf_output = (int) fsSettings["enable_perf_output"];
+        if (!fsSettings["enable_pipeline"].empty()) {
+            enable_pipeline = (int) fsSettings["enable_pipeline"];
+        }
+        if (!fsSettings["pipeline_queue_size"].empty()) {
+            pipeline_queue_size = fsSettings["pipeline_queue_size"];
+        }
+        if (!fsSettings["loop_queue_size"].empty()) {
+            loop_queue_size = fsSettings["loop_queue_size"];
+        }
+        if (!fsSettings["pipeline_drop_policy"].empty()) {
+            pipeline_drop_policy = (FrameDropPolicy) (int) fsSettings["pipeline_drop_policy"];
+        }
         print_network_status = (int) fsSettings["print_network_status"];
         verbose = (int) fsSettings["verbose"];
         ftconfig->write_to_file = (int) fsSettings["write_tracking_image_to_file"];
@@ -73,6 +85,23 @@ namespace D2FrontEnd {
         nh.param<std::string>("netvlad_model_path", loopcamconfig->netvlad_model, "");
         loopcamconfig->cnn_enable_tensorrt = (int) fsSettings["cnn_enable_tensorrt"];
         loopcamconfig->cnn_enable_tensorrt_int8 = (int) fsSettings["cnn_enable_tensorrt_int8"];
+        //ONNX runtime: execution provider and thread pools shared by all the networks
+        auto & onnx_config = onnxRuntimeConfig();
+        if (!fsSettings["cnn_use_cuda"].empty()) {
+            onnx_config.use_cuda = (int) fsSettings["cnn_use_cuda"];
+        }
+        if (!fsSettings["cnn_intra_op_threads"].empty()) {
+            onnx_config.intra_op_threads = fsSettings["cnn_intra_op_threads"];
+        }
+        if (!fsSettings["cnn_inter_op_threads"].empty()) {
+            onnx_config.inter_op_threads = fsSettings["cnn_inter_op_threads"];
+        }
+        if (!fsSettings["cnn_enable_mem_pattern"].empty()) {
+            onnx_config.enable_mem_pattern = (int) fsSettings["cnn_enable_mem_pattern"];
+        }
+        if (!fsSettings["cnn_enable_cpu_mem_arena"].empty()) {
+            onnx_config.enable_cpu_mem_arena = (int) fsSettings["cnn_enable_cpu_mem_arena"];
+        }
         if (loopcamconfig->cnn_enable_tensorrt_int8) {
             loopcamconfig->netvlad_int8_calib_table_name = (std::string) fsSettings["netvlad_int8_calib_table_name"];
             loopcamconfig->superpoint_int8_calib_table_name = (std::string) fsSettings["superpoint_int8_calib_table_name"];
@@ -93,6 +122,9 @@ namespace D2FrontEnd {
         ftconfig->check_essential = (int) fsSettings["check_essential"];
         ftconfig->enable_lk_optical_flow = (int) fsSettings["enable_lk_optical_flow"];
         ftconfig->lk_use_fast = (int) fsSettings["lk_use_fast"];
+        if (!fsSettings["lk_use_cuda"].empty()) {
+            ftconfig->lk_use_cuda = (int) fsSettings["lk_use_cuda"];
+        }
         ftconfig->remote_min_match_num = fsSettings["remote_min_match_num"];
         ftconfig->double_counting_common_feature = (int) fsSettings["double_counting_common_feature"];
         ftconfig->enable_superglue_local = (int) fsSettings["enable_superglue_local"];
@@ -114,6 +146,9 @@ namespace D2FrontEnd {
         } else {
             printf("[D2FrontendParams] enable_search_local_aera not found, use default\n");
         }
+        if (!fsSettings["enable_parallel_tracking"].empty()) {
+            ftconfig->enable_parallel_tracking = (int) fsSettings["enable_parallel_tracking"];
+        }
         if (!fsSettings["feature_min_dist"].empty()) {
             feature_min_dist = fsSettings["feature_min_dist"];
         } else {
@@ -126,6 +161,61 @@ namespace D2FrontEnd {
         loopdetectorconfig->loop_inlier_feature_num = fsSettings["loop_inlier_feature_num"];
         loopdetectorconfig->knn_match_ratio = fsSettings["knn_match_ratio"];
         loopdetectorconfig->gravity_check_thres = fsSettings["gravity_check_thres"];
+        if (!fsSettings["loop_ransac_threads"].empty()) {
+            loop_ransac_threads = (int) fsSettings["loop_ransac_threads"];
+        }
+        if (!fsSettings["loop_ransac_seed"].empty()) {
+            loop_ransac_seed = (int) fsSettings["loop_ransac_seed"];
+        }
+        if (!fsSettings["loop_database_load_path"].empty()) {
+            loopdetectorconfig->load_database_path = (std::string) fsSettings["loop_database_load_path"];
+        }
+        if (!fsSettings["loop_database_save_path"].empty()) {
+            loopdetectorconfig->save_database_path = (std::string) fsSettings["loop_database_save_path"];
+        }
+        if (!fsSettings["loop_candidate_num"].empty()) {
+            loopdetectorconfig->loop_candidate_num = (int) fsSettings["loop_candidate_num"];
+        }
+        if (!fsSettings["loop_verify_num"].empty()) {
+            loopdetectorconfig->loop_verify_num = (int) fsSettings["loop_verify_num"];
+        }
+        if (!fsSettings["loop_precheck_keypoints"].empty()) {
+            loopdetectorconfig->loop_precheck_keypoints = (int) fsSettings["loop_precheck_keypoints"];
+        }
+        if (!fsSettings["keyframe_db_full_num"].empty()) {
+            loopdetectorconfig->keyframe_db_full_num = (int) fsSettings["keyframe_db_full_num"];
+        }
+        if (!fsSettings["keyframe_db_memory_budget_mb"].empty()) {
+            loopdetectorconfig->keyframe_db_memory_budget_mb = (double) fsSettings["keyframe_db_memory_budget_mb"];
+        }
+        if (!fsSettings["keyframe_db_evict_radius"].empty()) {
+            loopdetectorconfig->keyframe_db_evict_radius = (double) fsSettings["keyframe_db_evict_radius"];
+        }
+        if (!fsSettings["place_index_type"].empty()) {
+            auto & place_index = loopdetectorconfig->place_index;
+            place_index.type = static_cast<PlaceIndexType>((int) fsSettings["place_index_type"]);
+            if (!fsSettings["place_index_train_threshold"].empty()) {
+                place_index.train_threshold = (int) fsSettings["place_index_train_threshold"];
+            }
+            if (!fsSettings["place_index_ivf_nlist"].empty()) {
+                place_index.ivf_nlist = (int) fsSettings["place_index_ivf_nlist"];
+            }
+            if (!fsSettings["place_index_ivf_nprobe"].empty()) {
+                place_index.ivf_nprobe = (int) fsSettings["place_index_ivf_nprobe"];
+            }
+            if (!fsSettings["place_index_pq_m"].empty()) {
+                place_index.pq_m = (int) fsSettings["place_index_pq_m"];
+            }
+            if (!fsSettings["place_index_hnsw_m"].empty()) {
+                place_index.hnsw_m = (int) fsSettings["place_index_hnsw_m"];
+            }
+            if (!fsSettings["place_index_hnsw_ef_search"].empty()) {
+                place_index.hnsw_ef_search = (int) fsSettings["place_index_hnsw_ef_search"];
+            }
+            if (!fsSettings["place_index_max_search_k"].empty()) {
+                place_index.max_search_k = (int) fsSettings["place_index_max_search_k"];
+            }
+        }
         nh.param<bool>("enable_loop", enable_loop, true);
         nh.param<bool>("is_4dof", loopdetectorconfig->is_4dof, true);
         nh.param<int>("match_index_dist", loopdetectorconfig->match_index_dist, 10);
@@ -197,7 +287,7 @@ namespace D2FrontEnd {
             raw_camera_ptrs = camera_ptrs;
             camera_ptrs.clear();
             for (auto cam: raw_camera_ptrs) { 
-                auto ptr = new FisheyeUndist(cam, 0, undistort_fov, true, FisheyeUndist::UndistortCylindrical, 
+                auto ptr = new FisheyeUndist(cam, 0, undistort_fov, undistort_use_cuda, FisheyeUndist::UndistortCylindrical, 
                     width_undistort, height_undistort, photometric);
                 auto cylind_cam = ptr->cam_top;
                 camera_ptrs.push_back(cylind_cam);
@@ -221,6 +311,12 @@ namespace D2FrontEnd {
         width_undistort = (int) fsSettings["width_undistort"];
         height_undistort = (int) fsSettings["height_undistort"];
         undistort_fov = fsSettings["undistort_fov"];
+        if (!fsSettings["undistort_use_cuda"].empty()) {
+            undistort_use_cuda = (int) fsSettings["undistort_use_cuda"];
+        }
+        if (!fsSettings["undistort_map_cache_dir"].empty()) {
+            FisheyeUndist::mapCacheDir() = (std::string) fsSettings["undistort_map_cache_dir"];
+        }
         width = (int) fsSettings["image_width"];
         height = (int) fsSettings["image_height"];
         std::string camera_seq_str = fsSettings["camera_seq"]; // Back-right Back-left Front-left Front-right
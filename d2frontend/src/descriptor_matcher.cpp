@@ -0,0 +1,285 @@
+#include <d2frontend/descriptor_matcher.h>
+#include <algorithm>
+#include <cmath>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace D2FrontEnd {
+
+float descDot(const float * a, const float * b, int dims) {
+    int i = 0;
+    float sum = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (; i + 16 <= dims; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= dims; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    s = _mm_hadd_ps(s, s);
+    s = _mm_hadd_ps(s, s);
+    sum = _mm_cvtss_f32(s);
+#elif defined(__ARM_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    for (; i + 8 <= dims; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    for (; i + 4 <= dims; i += 4) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    acc0 = vaddq_f32(acc0, acc1);
+    float32x2_t s = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+    sum = vget_lane_f32(vpadd_f32(s, s), 0);
+#endif
+    for (; i < dims; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+int32_t descDot(const int8_t * a, const int8_t * b, int dims) {
+    int i = 0;
+    int32_t sum = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 16 <= dims; i += 16) {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_hadd_epi32(s, s);
+    s = _mm_hadd_epi32(s, s);
+    sum = _mm_cvtsi128_si32(s);
+#elif defined(__ARM_NEON)
+    int32x4_t acc = vdupq_n_s32(0);
+    for (; i + 16 <= dims; i += 16) {
+        int8x16_t va = vld1q_s8(a + i);
+        int8x16_t vb = vld1q_s8(b + i);
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+        acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(va), vget_high_s8(vb)));
+    }
+    int32x2_t s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    sum = vget_lane_s32(vpadd_s32(s, s), 0);
+#endif
+    for (; i < dims; i++) {
+        sum += (int32_t) a[i] * (int32_t) b[i];
+    }
+    return sum;
+}
+
+static inline void pushTop2(Top2Match & m, int j, float dist) {
+    if (dist < m.dist[0]) {
+        m.dist[1] = m.dist[0];
+        m.idx[1] = m.idx[0];
+        m.dist[0] = dist;
+        m.idx[0] = j;
+    } else if (dist < m.dist[1]) {
+        m.dist[1] = dist;
+        m.idx[1] = j;
+    }
+}
+
+DescriptorMatcher::DescriptorMatcher(int _dims, double _search_radius):
+    dims(_dims), search_radius(_search_radius) {
+}
+
+void DescriptorMatcher::setTrain(const float * _desc_b, int _num_b, const std::vector<cv::Point2f> & pts_b, 
+        const LandmarkGridIndex * grid) {
+    desc_b = _desc_b;
+    desc_b_int8 = nullptr;
+    num_b = _num_b;
+    sqnorm_b.resize(num_b);
+    for (int j = 0; j < num_b; j++) {
+        sqnorm_b[j] = descDot(desc_b + j*dims, desc_b + j*dims, dims);
+    }
+    setTrainGrid(pts_b, grid);
+}
+
+void DescriptorMatcher::setTrain(const int8_t * _desc_b, float _scale_b, int _num_b, const std::vector<cv::Point2f> & pts_b,
+        const LandmarkGridIndex * grid) {
+    desc_b = nullptr;
+    desc_b_int8 = _desc_b;
+    scale_b = _scale_b;
+    num_b = _num_b;
+    sqnorm_b.resize(num_b);
+    for (int j = 0; j < num_b; j++) {
+        sqnorm_b[j] = descDot(desc_b_int8 + j*dims, desc_b_int8 + j*dims, dims) * scale_b * scale_b;
+    }
+    setTrainGrid(pts_b, grid);
+}
+
+void DescriptorMatcher::setTrainGrid(const std::vector<cv::Point2f> & pts_b, const LandmarkGridIndex * grid) {
+    grid_b = nullptr;
+    use_own_grid = false;
+    if (search_radius <= 0) {
+        return;
+    }
+    if (grid != nullptr && grid->size() == num_b) {
+        grid_b = grid;
+    } else if (pts_b.size() == num_b && num_b > 0) {
+        own_grid = LandmarkGridIndex(pts_b, search_radius);
+        use_own_grid = true;
+    }
+}
+
+template<typename Func>
+void DescriptorMatcher::forEachCandidate(const cv::Point2f * pt_a, Func func) const {
+    auto grid = trainGrid();
+    if (grid == nullptr || pt_a == nullptr) {
+        for (int j = 0; j < num_b; j++) {
+            func(j);
+        }
+        return;
+    }
+    grid->radiusSearch(*pt_a, search_radius, func);
+}
+
+float DescriptorMatcher::distance(const float * desc_a, float sqnorm_a, int j) const {
+    float d2 = sqnorm_a + sqnorm_b[j] - 2*descDot(desc_a, desc_b + j*dims, dims);
+    return std::sqrt(std::max(d2, 0.0f));
+}
+
+float DescriptorMatcher::distance(const int8_t * desc_a, float sqnorm_a, float scale_a, int j) const {
+    float d2 = sqnorm_a + sqnorm_b[j] - 2*scale_a*scale_b*descDot(desc_a, desc_b_int8 + j*dims, dims);
+    return std::sqrt(std::max(d2, 0.0f));
+}
+
+std::vector<Top2Match> DescriptorMatcher::knn2(const float * desc_a, int num_a, const std::vector<cv::Point2f> & pts_a) const {
+    std::vector<Top2Match> ret(num_a);
+    bool gated = pts_a.size() == num_a;
+    for (int i = 0; i < num_a; i++) {
+        const float * da = desc_a + i*dims;
+        float sqnorm_a = descDot(da, da, dims);
+        auto & m = ret[i];
+        auto func = [&](int j) {
+            pushTop2(m, j, distance(da, sqnorm_a, j));
+        };
+        forEachCandidate(gated ? &pts_a[i] : nullptr, func);
+    }
+    return ret;
+}
+
+std::vector<Top2Match> DescriptorMatcher::knn2(const int8_t * desc_a, float scale_a, int num_a, const std::vector<cv::Point2f> & pts_a) const {
+    std::vector<Top2Match> ret(num_a);
+    bool gated = pts_a.size() == num_a;
+    for (int i = 0; i < num_a; i++) {
+        const int8_t * da = desc_a + i*dims;
+        float sqnorm_a = descDot(da, da, dims) * scale_a * scale_a;
+        auto & m = ret[i];
+        auto func = [&](int j) {
+            pushTop2(m, j, distance(da, sqnorm_a, scale_a, j));
+        };
+        forEachCandidate(gated ? &pts_a[i] : nullptr, func);
+    }
+    return ret;
+}
+
+std::vector<Top2Match> DescriptorMatcher::knn2(const float * desc_a, const LandmarkGridIndex & grid_a, 
+        const std::vector<cv::Point2f> & pts_b) const {
+    int num_a = grid_a.size();
+    std::vector<Top2Match> ret(num_a);
+    std::vector<float> sqnorm_a(num_a);
+    for (int i = 0; i < num_a; i++) {
+        sqnorm_a[i] = descDot(desc_a + i*dims, desc_a + i*dims, dims);
+    }
+    //Same candidate pairs as gating on a grid over b, iterated from the train side.
+    for (int j = 0; j < num_b && j < pts_b.size(); j++) {
+        grid_a.radiusSearch(pts_b[j], search_radius, [&](int i) {
+            pushTop2(ret[i], j, distance(desc_a + i*dims, sqnorm_a[i], j));
+        });
+    }
+    return ret;
+}
+
+static std::vector<cv::DMatch> ratioTest(const std::vector<Top2Match> & knn, double ratio) {
+    std::vector<cv::DMatch> good_matches;
+    for (int i = 0; i < knn.size(); i++) {
+        auto & m = knn[i];
+        if (m.idx[1] < 0) {
+            continue;
+        }
+        if (m.dist[0] < ratio * m.dist[1]) {
+            good_matches.emplace_back(i, m.idx[0], m.dist[0]);
+        }
+    }
+    return good_matches;
+}
+
+std::vector<cv::DMatch> DescriptorMatcher::matchRatio(const float * desc_a, int num_a, double ratio,
+        const std::vector<cv::Point2f> & pts_a) const {
+    return ratioTest(knn2(desc_a, num_a, pts_a), ratio);
+}
+
+std::vector<cv::DMatch> DescriptorMatcher::matchRatio(const int8_t * desc_a, float scale_a, int num_a, double ratio,
+        const std::vector<cv::Point2f> & pts_a) const {
+    return ratioTest(knn2(desc_a, scale_a, num_a, pts_a), ratio);
+}
+
+std::vector<cv::DMatch> DescriptorMatcher::matchRatio(const float * desc_a, const LandmarkGridIndex & grid_a, double ratio,
+        const std::vector<cv::Point2f> & pts_b) const {
+    return ratioTest(knn2(desc_a, grid_a, pts_b), ratio);
+}
+
+template<typename DistFunc>
+std::vector<cv::DMatch> DescriptorMatcher::crossCheck(int num_a, const std::vector<cv::Point2f> & pts_a, 
+        DistFunc dist_func) const {
+    std::vector<int> best_a(num_a, -1), best_b(num_b, -1);
+    std::vector<float> dist_a(num_a, FLT_MAX), dist_b(num_b, FLT_MAX);
+    bool gated = pts_a.size() == num_a;
+    for (int i = 0; i < num_a; i++) {
+        auto func = [&](int j) {
+            float dist = dist_func(i, j);
+            if (dist < dist_a[i]) {
+                dist_a[i] = dist;
+                best_a[i] = j;
+            }
+            if (dist < dist_b[j]) {
+                dist_b[j] = dist;
+                best_b[j] = i;
+            }
+        };
+        forEachCandidate(gated ? &pts_a[i] : nullptr, func);
+    }
+    std::vector<cv::DMatch> matches;
+    for (int i = 0; i < num_a; i++) {
+        if (best_a[i] >= 0 && best_b[best_a[i]] == i) {
+            matches.emplace_back(i, best_a[i], dist_a[i]);
+        }
+    }
+    return matches;
+}
+
+std::vector<cv::DMatch> DescriptorMatcher::matchCrossCheck(const float * desc_a, int num_a,
+        const std::vector<cv::Point2f> & pts_a) const {
+    std::vector<float> sqnorm_a(num_a);
+    for (int i = 0; i < num_a; i++) {
+        sqnorm_a[i] = descDot(desc_a + i*dims, desc_a + i*dims, dims);
+    }
+    return crossCheck(num_a, pts_a, [&](int i, int j) {
+        return distance(desc_a + i*dims, sqnorm_a[i], j);
+    });
+}
+
+std::vector<cv::DMatch> DescriptorMatcher::matchCrossCheck(const int8_t * desc_a, float scale_a, int num_a,
+        const std::vector<cv::Point2f> & pts_a) const {
+    std::vector<float> sqnorm_a(num_a);
+    for (int i = 0; i < num_a; i++) {
+        sqnorm_a[i] = descDot(desc_a + i*dims, desc_a + i*dims, dims) * scale_a * scale_a;
+    }
+    return crossCheck(num_a, pts_a, [&](int i, int j) {
+        return distance(desc_a + i*dims, sqnorm_a[i], scale_a, j);
+    });
+}
+
+}
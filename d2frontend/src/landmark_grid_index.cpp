@@ -0,0 +1,49 @@
+#include <d2frontend/landmark_grid_index.h>
+#include <d2common/d2frontend_types.h>
+
+#define MAX_GRID_CELLS_PER_AXIS 128
+
+namespace D2FrontEnd {
+LandmarkGridIndex::LandmarkGridIndex(const std::vector<cv::Point2f> & _pts, float _cell_size):
+    cell_size(_cell_size), pts(_pts) {
+    if (cell_size <= 0 || pts.size() == 0) {
+        return;
+    }
+    float max_x = pts[0].x, max_y = pts[0].y;
+    min_x = pts[0].x;
+    min_y = pts[0].y;
+    for (auto & pt : pts) {
+        min_x = std::min(min_x, pt.x);
+        min_y = std::min(min_y, pt.y);
+        max_x = std::max(max_x, pt.x);
+        max_y = std::max(max_y, pt.y);
+    }
+    //Enlarge the cells if the radius is tiny compared with the image
+    cell_size = std::max({cell_size, (max_x - min_x) / MAX_GRID_CELLS_PER_AXIS, (max_y - min_y) / MAX_GRID_CELLS_PER_AXIS});
+    cols = std::min((int)((max_x - min_x) / cell_size) + 1, MAX_GRID_CELLS_PER_AXIS);
+    rows = std::min((int)((max_y - min_y) / cell_size) + 1, MAX_GRID_CELLS_PER_AXIS);
+    //Counting sort of the points into cells
+    int num = pts.size();
+    std::vector<int> cell_of(num);
+    cell_start.assign(cols*rows + 1, 0);
+    for (int j = 0; j < num; j++) {
+        int cx = std::min((int)((pts[j].x - min_x) / cell_size), cols - 1);
+        int cy = std::min((int)((pts[j].y - min_y) / cell_size), rows - 1);
+        cell_of[j] = cy*cols + cx;
+        cell_start[cell_of[j] + 1] ++;
+    }
+    for (int c = 0; c < cols*rows; c++) {
+        cell_start[c + 1] += cell_start[c];
+    }
+    cell_index.resize(num);
+    std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+    for (int j = 0; j < num; j++) {
+        cell_index[fill[cell_of[j]]++] = j;
+    }
+}
+
+LandmarkGridIndex LandmarkGridIndex::fromSuperPoints(const D2Common::VisualImageDesc & img_desc, float cell_size) {
+    return LandmarkGridIndex(img_desc.landmarks2D(true), cell_size);
+}
+
+}
@@ -8,6 +8,7 @@
 #include <opencv2/core/eigen.hpp>
 #include <d2frontend/d2featuretracker.h>
 #include <d2common/fisheye_undistort.h>
+#include <d2frontend/descriptor_matcher.h>
 
 using namespace std::chrono;
 
@@ -124,13 +125,9 @@ void matchLocalFeatures(std::vector<cv::Point2f> & pts_up, std::vector<cv::Point
         std::vector<float> & _desc_up, std::vector<float> & _desc_down, 
         std::vector<int> & ids_up, std::vector<int> & ids_down) {
     // printf("matchLocalFeatures %ld %ld: ", pts_up.size(), pts_down.size());
-    const cv::Mat desc_up( _desc_up.size()/params->superpoint_dims, params->superpoint_dims, CV_32F, _desc_up.data());
-    const cv::Mat desc_down( _desc_down.size()/params->superpoint_dims, params->superpoint_dims, CV_32F, _desc_down.data());
-
-    cv::BFMatcher bfmatcher(cv::NORM_L2, true);
-
-    std::vector<cv::DMatch> _matches;
-    bfmatcher.match(desc_up, desc_down, _matches);
+    DescriptorMatcher matcher(params->superpoint_dims);
+    matcher.setTrain(_desc_down.data(), _desc_down.size()/params->superpoint_dims);
+    std::vector<cv::DMatch> _matches = matcher.matchCrossCheck(_desc_up.data(), _desc_up.size()/params->superpoint_dims);
 
     std::vector<cv::Point2f> _pts_up, _pts_down;
     std::vector<int> ids;
@@ -163,8 +160,14 @@ VisualImageDescArray LoopCam::processStereoframe(const StereoFrame & msg) {
     static int t_count = 0;
     static double tt_sum = 0;
 
+    std::vector<cv::Mat> undist_imgs;
+    std::vector<VisualImageDesc> fisheye_frames;
     if (camera_configuration == CameraConfig::FOURCORNER_FISHEYE) {
         visual_array.images.resize(4);
+        for (unsigned int i = 0; i < msg.left_images.size(); i ++) {
+            undist_imgs.emplace_back(undistortImage(msg, i));
+        }
+        fisheye_frames = extractorImgDescDeepnet(msg.stamp, undist_imgs, msg.left_camera_indices, msg.left_camera_ids, false);
     }
 
     for (unsigned int i = 0; i < msg.left_images.size(); i ++) {
@@ -184,7 +187,7 @@ VisualImageDescArray LoopCam::processStereoframe(const StereoFrame & msg) {
             }
         } else if (camera_configuration == CameraConfig::FOURCORNER_FISHEYE) {
             auto seq = params->camera_seq[i];
-            visual_array.images[seq] = generateImageDescriptor(msg, i, tmp);
+            visual_array.images[seq] = generateImageDescriptor(msg, i, undist_imgs[i], fisheye_frames[i], tmp);
         }
 
         if (_show.cols == 0) {
@@ -198,6 +201,11 @@ VisualImageDescArray LoopCam::processStereoframe(const StereoFrame & msg) {
     t_count+= 1;
     printf("[D2Frontend::LoopCam] KF Count %d loop_cam cost avg %.1fms cur %.1fms\n", kf_count, tt_sum/t_count, tt.toc());
 
+    for (auto & img : visual_array.images) {
+        if (!img.raw_image.empty() || !img.raw_depth_image.empty()) {
+            img.raw_image_holders = msg.image_holders;
+        }
+    }
     visual_array.frame_id = msg.keyframe_id;
     visual_array.pose_drone = msg.pose_drone;
     visual_array.drone_id = self_id;
@@ -223,16 +231,29 @@ VisualImageDesc LoopCam::generateImageDescriptor(const StereoFrame & msg, int vc
         ides.stamp = msg.stamp.toSec();
         return ides;
     }
+    cv::Mat undist = undistortImage(msg, vcam_id);
+    VisualImageDesc vframe = extractorImgDescDeepnet(msg.stamp, undist, msg.left_camera_indices[vcam_id], msg.left_camera_ids[vcam_id], false);
+    return generateImageDescriptor(msg, vcam_id, undist, vframe, _show);
+}
+
+cv::Mat LoopCam::undistortImage(const StereoFrame & msg, int vcam_id) {
     cv::Mat undist = msg.left_images[vcam_id];
     TicToc tt;
     if (_config.enable_undistort_image) {
-        undist = cv::Mat(undistortors[vcam_id]->undist_id_cuda(undist, 0, true));
+        if (undistortors[vcam_id]->enable_cuda) {
+            undist = cv::Mat(undistortors[vcam_id]->undist_id_cuda(undist, 0, true));
+        } else {
+            undist = undistortors[vcam_id]->undist_id(undist, 0, true);
+        }
     }
     if (params->enable_perf_output) {
         printf("[D2Frontend::LoopCam] undist image cost %.1fms\n", tt.toc());
     }
-    VisualImageDesc vframe = extractorImgDescDeepnet(msg.stamp, undist, msg.left_camera_indices[vcam_id], msg.left_camera_ids[vcam_id], false);
+    return undist;
+}
 
+VisualImageDesc LoopCam::generateImageDescriptor(const StereoFrame & msg, int vcam_id, const cv::Mat & undist, 
+        VisualImageDesc vframe, cv::Mat &_show) {
     if (vframe.image_desc.size() == 0)
     {
         ROS_WARN("Failed on deepnet: vframe.image_desc.size() == 0.");
@@ -510,11 +531,7 @@ std::vector<VisualImageDesc> LoopCam::generateStereoImageDescriptor(const Stereo
     return ret;
 }
 
-VisualImageDesc LoopCam::extractorImgDescDeepnet(ros::Time stamp, cv::Mat img, int camera_index, 
-        int camera_id, bool superpoint_mode)
-{
-    auto start = high_resolution_clock::now();
-
+VisualImageDesc LoopCam::initImageDesc(ros::Time stamp, cv::Mat & img, int camera_index, int camera_id) const {
     VisualImageDesc vframe;
     vframe.stamp = stamp.toSec();
     vframe.camera_index = camera_index;
@@ -522,9 +539,18 @@ VisualImageDesc LoopCam::extractorImgDescDeepnet(ros::Time stamp, cv::Mat img, i
     vframe.drone_id = self_id;
 
     if (camera_configuration == CameraConfig::STEREO_FISHEYE) {
+        //The image may view a ROS message shared with other subscribers, so mask a copy
+        img = img.clone();
         cv::Mat roi = img(cv::Rect(0, img.rows*3/4, img.cols, img.rows/4));
         roi.setTo(cv::Scalar(0, 0, 0));
     }
+    return vframe;
+}
+
+VisualImageDesc LoopCam::extractorImgDescDeepnet(ros::Time stamp, cv::Mat img, int camera_index, 
+        int camera_id, bool superpoint_mode)
+{
+    VisualImageDesc vframe = initImageDesc(stamp, img, camera_index, camera_id);
     std::vector<cv::Point2f> landmarks_2d;
     if (_config.superpoint_max_num > 0) {
         //We only inference when superpoint max num > 0
@@ -539,7 +565,41 @@ VisualImageDesc LoopCam::extractorImgDescDeepnet(ros::Time stamp, cv::Mat img, i
             vframe.image_desc = netvlad_onnx->inference(img);
         }
     }
+    addLandmarks(vframe, img, landmarks_2d);
+    return vframe;
+}
+
+std::vector<VisualImageDesc> LoopCam::extractorImgDescDeepnet(ros::Time stamp, const std::vector<cv::Mat> & imgs, 
+        const std::vector<int> & camera_indices, const std::vector<CamIdType> & camera_ids, bool superpoint_mode) {
+    std::vector<VisualImageDesc> vframes;
+    std::vector<cv::Mat> _imgs = imgs;
+    for (unsigned int i = 0; i < _imgs.size(); i++) {
+        vframes.emplace_back(initImageDesc(stamp, _imgs[i], camera_indices[i], camera_ids[i]));
+    }
+    std::vector<std::vector<cv::Point2f>> landmarks_2d(_imgs.size());
+    if (_config.superpoint_max_num > 0 && _config.cnn_use_onnx) {
+        std::vector<std::vector<float>> descs, scores;
+        superpoint_onnx->inference(_imgs, landmarks_2d, descs, scores);
+        for (unsigned int i = 0; i < _imgs.size(); i++) {
+            vframes[i].landmark_descriptor = std::move(descs[i]);
+            vframes[i].landmark_scores = std::move(scores[i]);
+        }
+    }
+    if (!superpoint_mode && _config.cnn_use_onnx) {
+        auto descs = netvlad_onnx->inference(_imgs);
+        for (unsigned int i = 0; i < _imgs.size(); i++) {
+            vframes[i].image_desc = std::move(descs[i]);
+        }
+    }
+    for (unsigned int i = 0; i < _imgs.size(); i++) {
+        addLandmarks(vframes[i], _imgs[i], landmarks_2d[i]);
+    }
+    return vframes;
+}
 
+void LoopCam::addLandmarks(VisualImageDesc & vframe, const cv::Mat & img, const std::vector<cv::Point2f> & landmarks_2d) {
+    auto camera_index = vframe.camera_index;
+    auto camera_id = vframe.camera_id;
     for (unsigned int i = 0; i < landmarks_2d.size(); i++)
     {
         auto pt_up = landmarks_2d[i];
@@ -566,7 +626,5 @@ VisualImageDesc LoopCam::extractorImgDescDeepnet(ros::Time stamp, cv::Mat img, i
             fsp << std::endl;
         }
     } 
-
-    return vframe;
 }
-}
\ No newline at end of file
+}
@@ -10,26 +10,45 @@
 #include <opengv/sac/Ransac.hpp>
 #include <opengv/sac/Lmeds.hpp>
 #include <d2frontend/utils.h>
+#include <d2frontend/descriptor_matcher.h>
 #include <algorithm>
-#include <faiss/IndexFlat.h>
+#include <fstream>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std::chrono; 
 using namespace D2Common;
 
 #define USE_FUNDMENTAL
 #define MAX_LOOP_ID 100000000
+#define LOOP_DB_MAGIC 0x4244324c //"L2DB"
+#define LOOP_DB_VERSION 1
+#define LOOP_DB_LOADED_ID_OFFSET ((int64_t) 1 << 40)
+#define LOOP_DB_EVICT_CANDIDATES 32
+
+static bool isLoadedFrame(int64_t frame_id) {
+    return frame_id >= LOOP_DB_LOADED_ID_OFFSET;
+}
 
 namespace D2FrontEnd {
 
 void LoopDetector::processImageArray(VisualImageDescArray & image_array) {
+    LoopVerifyTask task;
+    if (queryImageArray(image_array, task)) {
+        verifyLoop(task);
+    }
+}
+
+bool LoopDetector::queryImageArray(VisualImageDescArray & image_array, LoopVerifyTask & task) {
     //Lock frame_mutex with Guard
     std::lock_guard<std::recursive_mutex> guard(frame_mutex);
     TicToc tt;
     static double t_sum = 0;
     static int t_count = 0;
     
-    auto start = high_resolution_clock::now();
-    
     if (t0 < 0) {
         t0 = image_array.stamp;
     }
@@ -39,10 +58,13 @@ void LoopDetector::processImageArray(VisualImageDescArray & image_array) {
 
     if (image_array.images.size() == 0) {
         ROS_WARN("[LoopDetector] FlattenDesc must carry more than zero images");
-        return;
+        return false;
     }
 
-    ego_motion_traj.push(ros::Time(image_array.stamp), image_array.pose_drone);
+    {
+        const std::lock_guard<std::mutex> lock(traj_mutex);
+        ego_motion_traj.push(ros::Time(image_array.stamp), image_array.pose_drone);
+    }
 
     int drone_id = image_array.drone_id;
     int images_num = image_array.images.size();
@@ -56,12 +78,12 @@ void LoopDetector::processImageArray(VisualImageDescArray & image_array) {
                 self_id, image_array.frame_id, drone_id, image_array.images.size(), image_array.spLandmarkNum(), image_array.is_lazy_frame, image_array.matched_frame);
         }
         // printf("[LoopDetector@%d] Frame %ld matched to drone %ld, giveup\n", self_id, image_array.frame_id, image_array.matched_drone);
-        return;
+        return false;
     }
 
     if (drone_id!= this->self_id && databaseSize() == 0) {
         ROS_INFO("[LoopDetector] Empty local database, will giveup remote image");
-        return;
+        return false;
     }
 
     bool new_node = all_nodes.find(image_array.drone_id) == all_nodes.end();
@@ -76,7 +98,7 @@ void LoopDetector::processImageArray(VisualImageDescArray & image_array) {
     if (dir_count < _config.MIN_DIRECTION_LOOP) {
         ROS_INFO("[LoopDetector@%d] Give up image_array %ld with less than %d(%d) available images",
             self_id, image_array.frame_id, _config.MIN_DIRECTION_LOOP, dir_count);
-        return;
+        return false;
     }
 
     if (image_array.spLandmarkNum() >= _config.loop_inlier_feature_num || is_lazy_frame) {
@@ -97,13 +119,18 @@ void LoopDetector::processImageArray(VisualImageDescArray & image_array) {
                     break;
                 }
             }
+            const std::lock_guard<std::mutex> lock(show_mutex);
             msgid2cvimgs[image_array.frame_id] = imgs;
         }
 
         bool success = false;
-        VisualImageDescArray _old_fisheye_img;
-        int camera_index = 1;
-        int camera_index_old = -1;
+        bool need_verify = false;
+        auto & candidates = task.candidates;
+        auto & candidate_dirs = task.candidate_dirs;
+        int & camera_index = task.camera_index;
+        candidates.clear();
+        candidate_dirs.clear();
+        camera_index = 1;
         if (is_matched_frame) {
             if (!hasFrame(image_array.matched_frame)) {
                 success = false;
@@ -112,9 +139,10 @@ void LoopDetector::processImageArray(VisualImageDescArray & image_array) {
                 // printf("[LoopDetector] frame %ld is matched to local frame %ld in db\n", image_array.frame_id, image_array.matched_frame);
                 success = true;
                 const std::lock_guard<std::mutex> lock(keyframe_database_mutex);
-                _old_fisheye_img = keyframe_database.at(image_array.matched_frame);
+                candidates.emplace_back(keyframe_database.at(image_array.matched_frame));
+                touchKeyframe(image_array.matched_frame);
                 camera_index = 0; //TODO: this is a hack
-                camera_index_old = 0;
+                candidate_dirs.emplace_back(0);
                 if (is_lazy_frame) {
                     //In this case, it's a keyframe that has been broadcasted and should be recorded in database
                     printf("[LoopDetector] frame %ld is matched to local frame %ld in db and we find it in cache\n", 
@@ -130,13 +158,14 @@ void LoopDetector::processImageArray(VisualImageDescArray & image_array) {
             }
         } else {
             if (databaseSize() > _config.match_index_dist || drone_id != self_id && databaseSize() > _config.match_index_dist_remote) {
-                success = queryImageArrayFromDatabase(image_array, _old_fisheye_img, camera_index, camera_index_old);
+                success = queryImageArrayFromDatabase(image_array, candidates, camera_index, candidate_dirs);
                 auto stop = high_resolution_clock::now(); 
             }
         }
         if (success) {
             if (!is_matched_frame && is_lazy_frame) {
                 //In this case, we need to send the matched frame to the drone
+                auto & _old_fisheye_img = candidates[0];
                 _old_fisheye_img.matched_drone = image_array.drone_id;
                 _old_fisheye_img.matched_frame = image_array.frame_id;
                 printf("[LoopDetector@%d] Lazy frame %d is matched with %d try to broadcast this frame\n", 
@@ -145,18 +174,7 @@ void LoopDetector::processImageArray(VisualImageDescArray & image_array) {
                     broadcast_keyframe_cb(_old_fisheye_img);
                 }
             } else {
-                printf("Compute loop connection %ld and %ld\n", image_array.frame_id, _old_fisheye_img.frame_id);
-                swarm_msgs::LoopEdge ret;
-                if (_old_fisheye_img.drone_id == self_id) {
-                    success = computeLoop(_old_fisheye_img, image_array, camera_index_old, camera_index, ret);
-                } else if (image_array.drone_id == self_id) {
-                    success = computeLoop(image_array, _old_fisheye_img, camera_index, camera_index_old, ret);
-                } else {
-                    ROS_WARN("[LoopDetector%d] Will not compute loop, drone id is %d", self_id, image_array.drone_id);
-                }
-                if (success) {
-                    onLoopConnection(ret);
-                }
+                need_verify = true;
             }
         } else {
             if (params->verbose)
@@ -170,12 +188,55 @@ void LoopDetector::processImageArray(VisualImageDescArray & image_array) {
                 addImageArrayToDatabase(image_array, false);
             }
         }
+        t_sum += tt.toc();
+        t_count += 1;
+        if (params->verbose || params->enable_perf_output)
+            printf("[LoopDetector] LoopDetect query avg %.1fms cur %.1fms\n", t_sum/t_count, tt.toc());
+        if (need_verify) {
+            //The database keeps its own copy
+            task.frame = std::move(image_array);
+            return true;
+        }
     }
+    return false;
+}
 
+bool LoopDetector::verifyLoop(LoopVerifyTask & task) {
+    //Runs without frame_mutex: candidates and the frame are copies, landmarks are guarded by landmark_mutex.
+    const std::lock_guard<std::mutex> lock(verify_mutex);
+    TicToc tt;
+    static double t_sum = 0;
+    static int t_count = 0;
+    auto & image_array = task.frame;
+    auto & candidates = task.candidates;
+    auto & candidate_dirs = task.candidate_dirs;
+    int camera_index = task.camera_index;
+    if (candidates.size() > 1) {
+        rankCandidates(image_array, camera_index, candidates, candidate_dirs);
+    }
+    //Full verification on the best candidates only, stop at the first loop
+    bool success = false;
+    for (int i = 0; i < candidates.size() && i < std::max(_config.loop_verify_num, 1) && !success; i++) {
+        auto & _old_fisheye_img = candidates[i];
+        int camera_index_old = candidate_dirs[i];
+        printf("Compute loop connection %ld and %ld\n", image_array.frame_id, _old_fisheye_img.frame_id);
+        swarm_msgs::LoopEdge ret;
+        if (_old_fisheye_img.drone_id == self_id) {
+            success = computeLoop(_old_fisheye_img, image_array, camera_index_old, camera_index, ret);
+        } else if (image_array.drone_id == self_id) {
+            success = computeLoop(image_array, _old_fisheye_img, camera_index, camera_index_old, ret);
+        } else {
+            ROS_WARN("[LoopDetector%d] Will not compute loop, drone id is %d", self_id, image_array.drone_id);
+        }
+        if (success) {
+            onLoopConnection(ret);
+        }
+    }
     t_sum += tt.toc();
     t_count += 1;
     if (params->verbose || params->enable_perf_output)
-        printf("[LoopDetector] Full LoopDetect avg %.1fms cur %.1fms\n", t_sum/t_count, tt.toc());
+        printf("[LoopDetector] LoopDetect verify avg %.1fms cur %.1fms\n", t_sum/t_count, tt.toc());
+    return success;
 }
 
 
@@ -190,117 +251,266 @@ cv::Mat LoopDetector::decode_image(const VisualImageDesc & _img_desc) {
 }
 
 int LoopDetector::addImageArrayToDatabase(VisualImageDescArray & new_fisheye_desc, bool add_to_faiss) {
+    auto frame_id = new_fisheye_desc.frame_id;
     if (add_to_faiss) {
         for (size_t i = 0; i < new_fisheye_desc.images.size(); i++) {
             auto & img_desc = new_fisheye_desc.images[i];
             if (img_desc.spLandmarkNum() > 0 && img_desc.image_desc.size() > 0) {
                 int index = addImageDescToDatabase(img_desc);
-                index_to_frame_id[index] = new_fisheye_desc.frame_id;
+                index_to_frame_id[index] = frame_id;
                 imgid2dir[index] = i;
+                frame_id_to_indices[frame_id].push_back(index);
                 // ROS_INFO("[LoopDetector] Add keyframe from %d(dir %d) to local keyframe database index: %d", img_desc.drone_id, i, index);
             }
             if (params->camera_configuration == CameraConfig::PINHOLE_DEPTH) {
                 break;
             }
-            const std::lock_guard<std::mutex> lock(keyframe_database_mutex);
         }
     }
-    keyframe_database[new_fisheye_desc.frame_id] = new_fisheye_desc;
-    printf("[LoopDetector] Add KF %ld with %d images from %d to local keyframe database. Total frames: %ld\n", 
-            new_fisheye_desc.frame_id, new_fisheye_desc.images.size(), new_fisheye_desc.drone_id, keyframe_database.size());
+    const std::lock_guard<std::mutex> lock(keyframe_database_mutex);
+    auto it = keyframe_database.find(frame_id);
+    if (it != keyframe_database.end()) {
+        keyframe_db_bytes -= it->second.memoryBytes();
+        updateKeyframeCoverage(frame_id, -1);
+    } else {
+        for (auto & img : new_fisheye_desc.images) {
+            for (auto & lm : img.landmarks) {
+                if (lm.type == LandmarkType::SuperPointLandmark) {
+                    landmark_refs[lm.landmark_id] ++;
+                }
+            }
+        }
+        full_keyframes.push_back(frame_id);
+    }
+    auto & frame = keyframe_database[frame_id];
+    frame = new_fisheye_desc;
+    keyframe_db_bytes += frame.memoryBytes();
+    updateKeyframeCoverage(frame_id, 1);
+    touchKeyframe(frame_id);
+    compactKeyframes();
+    enforceMemoryBudget();
+    printf("[LoopDetector] Add KF %ld with %d images from %d to local keyframe database. Total frames: %ld %.1fMB\n", 
+            frame_id, new_fisheye_desc.images.size(), new_fisheye_desc.drone_id, keyframe_database.size(), 
+            keyframe_db_bytes / 1024.0 / 1024.0);
     // new_fisheye_desc.printSize();
-    return new_fisheye_desc.frame_id;
+    return frame_id;
+}
+
+void LoopDetector::touchKeyframe(int64_t frame_id) {
+    auto it = keyframe_lru_pos.find(frame_id);
+    if (it != keyframe_lru_pos.end()) {
+        keyframe_lru.splice(keyframe_lru.end(), keyframe_lru, it->second);
+    } else {
+        keyframe_lru_pos[frame_id] = keyframe_lru.insert(keyframe_lru.end(), frame_id);
+    }
+}
+
+void LoopDetector::compactKeyframes() {
+    if (_config.keyframe_db_full_num < 0) {
+        return;
+    }
+    while (full_keyframes.size() > _config.keyframe_db_full_num) {
+        auto frame_id = full_keyframes.front();
+        full_keyframes.pop_front();
+        auto it = keyframe_database.find(frame_id);
+        if (it == keyframe_database.end()) {
+            continue;
+        }
+        keyframe_db_bytes -= it->second.memoryBytes();
+        it->second.compact();
+        keyframe_db_bytes += it->second.memoryBytes();
+    }
+}
+
+void LoopDetector::enforceMemoryBudget() {
+    if (_config.keyframe_db_memory_budget_mb <= 0) {
+        return;
+    }
+    size_t budget = _config.keyframe_db_memory_budget_mb * 1024 * 1024;
+    int evicted = 0;
+    while (keyframe_db_bytes > budget && keyframe_lru.size() > 1) {
+        //Among the least recently used keyframes, prefer one whose place is covered by a newer keyframe.
+        int64_t victim = keyframe_lru.front();
+        int checked = 0;
+        for (auto it = keyframe_lru.begin(); it != keyframe_lru.end() && checked < LOOP_DB_EVICT_CANDIDATES; it++, checked++) {
+            auto coverage = keyframe_coverage.find(*it);
+            if (coverage != keyframe_coverage.end() && coverage->second > 0) {
+                victim = *it;
+                break;
+            }
+        }
+        evictKeyframe(victim);
+        evicted ++;
+    }
+    if (evicted > 0 && params->verbose) {
+        printf("[LoopDetector] Evicted %d keyframes, database %ld frames %.1fMB\n", evicted, keyframe_database.size(),
+            keyframe_db_bytes / 1024.0 / 1024.0);
+    }
+}
+
+std::array<int64_t, 4> LoopDetector::keyframeCell(const VisualImageDescArray & frame) const {
+    Vector3d pos = frame.pose_drone.pos() / _config.keyframe_db_evict_radius;
+    return {frame.drone_id, (int64_t) std::floor(pos.x()), (int64_t) std::floor(pos.y()), (int64_t) std::floor(pos.z())};
+}
+
+void LoopDetector::updateKeyframeCoverage(int64_t frame_id, int sign) {
+    if (_config.keyframe_db_evict_radius <= 0) {
+        return;
+    }
+    auto & frame = keyframe_database.at(frame_id);
+    auto cell = keyframeCell(frame);
+    if (sign < 0) {
+        auto & ids = keyframe_cells[cell];
+        ids.erase(std::remove(ids.begin(), ids.end(), frame_id), ids.end());
+        if (ids.empty()) {
+            keyframe_cells.erase(cell);
+        }
+    }
+    //Neighbours within the radius are in the 27 surrounding cells
+    double radius2 = _config.keyframe_db_evict_radius * _config.keyframe_db_evict_radius;
+    for (int dx = -1; dx <= 1; dx++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dz = -1; dz <= 1; dz++) {
+                auto it = keyframe_cells.find({cell[0], cell[1] + dx, cell[2] + dy, cell[3] + dz});
+                if (it == keyframe_cells.end()) {
+                    continue;
+                }
+                for (auto other_id : it->second) {
+                    auto & other = keyframe_database.at(other_id);
+                    if (other_id == frame_id || (other.pose_drone.pos() - frame.pose_drone.pos()).squaredNorm() >= radius2) {
+                        continue;
+                    }
+                    if (other.stamp > frame.stamp) {
+                        keyframe_coverage[frame_id] += sign;
+                    } else if (other.stamp < frame.stamp) {
+                        keyframe_coverage[other_id] += sign;
+                    }
+                }
+            }
+        }
+    }
+    if (sign > 0) {
+        keyframe_cells[cell].push_back(frame_id);
+    } else {
+        keyframe_coverage.erase(frame_id);
+    }
+}
+
+void LoopDetector::evictKeyframe(int64_t frame_id) {
+    auto it = keyframe_database.find(frame_id);
+    if (it != keyframe_database.end()) {
+        keyframe_db_bytes -= it->second.memoryBytes();
+        updateKeyframeCoverage(frame_id, -1);
+        std::lock_guard<std::recursive_mutex> guard(landmark_mutex);
+        for (auto & img : it->second.images) {
+            for (auto & lm : img.landmarks) {
+                auto ref = landmark_refs.find(lm.landmark_id);
+                if (lm.type == LandmarkType::SuperPointLandmark && ref != landmark_refs.end() && --ref->second <= 0) {
+                    landmark_refs.erase(ref);
+                    landmark_db.erase(lm.landmark_id);
+                }
+            }
+        }
+        keyframe_database.erase(it);
+    }
+    //The global descriptors stay in the place recognition index; their results are skipped from now on.
+    auto indices = frame_id_to_indices.find(frame_id);
+    if (indices != frame_id_to_indices.end()) {
+        for (auto index : indices->second) {
+            index_to_frame_id.erase(index);
+            imgid2dir.erase(index);
+        }
+        frame_id_to_indices.erase(indices);
+    }
+    auto lru = keyframe_lru_pos.find(frame_id);
+    if (lru != keyframe_lru_pos.end()) {
+        keyframe_lru.erase(lru->second);
+        keyframe_lru_pos.erase(lru);
+    }
+    const std::lock_guard<std::mutex> lock(show_mutex);
+    msgid2cvimgs.erase(frame_id);
 }
 
 int LoopDetector::addImageDescToDatabase(VisualImageDesc & img_desc_a) {
     if (img_desc_a.drone_id == self_id) {
-        local_index.add(1, img_desc_a.image_desc.data());
-        return local_index.ntotal - 1;
+        return local_index.add(img_desc_a.image_desc.data());
     } else {
-        remote_index.add(1, img_desc_a.image_desc.data());
-        return remote_index.ntotal - 1 + REMOTE_MAGIN_NUMBER;
+        return remote_index.add(img_desc_a.image_desc.data()) + REMOTE_MAGIN_NUMBER;
     }
     return -1;
 }
 
 
-int LoopDetector::queryFrameIndexFromDatabase(const VisualImageDesc & img_desc, double & similarity) {
+int LoopDetector::queryFrameIndexFromDatabase(const VisualImageDesc & img_desc, int max_num, 
+        std::vector<std::pair<double, int>> & candidates) {
     double thres = _config.loop_detection_netvlad_thres;
-    int ret = -1;
+    candidates.clear();
     if (img_desc.drone_id == self_id) {
         //Then this is self drone
-        double similarity_local, similarity_remote;
-        int ret_remote = queryIndexFromDatabase(img_desc, remote_index, true, thres, _config.match_index_dist, similarity_remote);
-        int ret_local = queryIndexFromDatabase(img_desc, local_index, false, thres, _config.match_index_dist, similarity_local);
-        if (ret_remote >=0 && ret_local >= 0) {
-            if (similarity_local > similarity_remote) {
-                similarity = similarity_local;
-                return ret_local;
-            } else {
-                similarity = similarity_remote;
-                return similarity_remote;
-            }
-        } else if (ret_remote >=0) {
-            similarity = similarity_remote;
-            return similarity_remote;
-        } else if (ret_local >= 0) {
-            similarity = similarity_local;
-            return ret_local;
+        queryIndexFromDatabase(img_desc, remote_index, true, thres, _config.match_index_dist, max_num, candidates);
+        queryIndexFromDatabase(img_desc, local_index, false, thres, _config.match_index_dist, max_num, candidates);
+        //Most similar first; on ties the remote result stays first
+        std::stable_sort(candidates.begin(), candidates.end(), [](const std::pair<double, int> & a, const std::pair<double, int> & b) {
+            return a.first > b.first;
+        });
+        if (candidates.size() > max_num) {
+            candidates.resize(max_num);
         }
     } else {
-        ret = queryIndexFromDatabase(img_desc, local_index, false, thres, _config.match_index_dist_remote, similarity);
+        queryIndexFromDatabase(img_desc, local_index, false, thres, _config.match_index_dist_remote, max_num, candidates);
     }
-    return ret;
+    return candidates.size();
 }
 
-int LoopDetector::queryIndexFromDatabase(const VisualImageDesc & img_desc, faiss::IndexFlatIP & index, bool remote_db, 
-        double thres, int max_index, double & similarity) {
-    float similiarity[1024] = {0};
-    faiss::idx_t labels[1024];
+int LoopDetector::queryIndexFromDatabase(const VisualImageDesc & img_desc, const PlaceRecognitionIndex & index, bool remote_db, 
+        double thres, int max_index, int max_num, std::vector<std::pair<double, int>> & candidates) {
+    std::vector<float> similiarity;
+    std::vector<faiss::idx_t> labels;
 
     int index_offset = 0;
     if (remote_db) {
         index_offset = REMOTE_MAGIN_NUMBER;
     }
-    for (int i = 0; i < 1000; i++) {
-        labels[i] = -1;
-    }
-    int search_num = std::min(SEARCH_NEAREST_NUM + max_index, (int) index.ntotal);
+    //Each keyframe has up to MAX_DIRS descriptors, over-fetch so max_num distinct keyframes can be found
+    int search_num = index.search(img_desc.image_desc.data(), SEARCH_NEAREST_NUM + max_index + max_num*_config.MAX_DIRS - 1,
+        similiarity, labels);
     if (search_num <= 0) {
-        return -1;
+        return 0;
+    }
+    //Candidates are distinct keyframes, also across the local and remote queries
+    std::set<int64_t> frame_ids;
+    for (auto & candidate : candidates) {
+        frame_ids.insert(index_to_frame_id.at(candidate.second));
     }
-    index.search(1, img_desc.image_desc.data(), search_num, similiarity, labels);
-    int return_frame_id = -1, return_drone_id = -1;
-    int k = -1;
-    for (int i = 0; i < search_num; i++) {
+    int return_frame_id = -1;
+    int count = 0;
+    for (int i = 0; i < search_num && count < max_num; i++) {
         if (labels[i] < 0) {
             continue;
         }
         if (index_to_frame_id.find(labels[i] + index_offset) == index_to_frame_id.end()) {
-            ROS_WARN("[LoopDetector] Can't find image %d; skipping", labels[i] + index_offset);
+            //Evicted keyframe
+            if (params->verbose) {
+                printf("[LoopDetector] Can't find image %ld; skipping\n", labels[i] + index_offset);
+            }
             continue;
         }
-        // int return_frame_id = index_to_frame_id.at(labels[i] + index_offset);
         return_frame_id = labels[i] + index_offset;
-        const std::lock_guard<std::mutex> lock(keyframe_database_mutex);
-        return_drone_id = keyframe_database.at(index_to_frame_id.at(return_frame_id)).drone_id;
-        // ROS_INFO("Return Label %d/%d/%d from %d, distance %f/%f", labels[i] + index_offset, index.ntotal, index.ntotal - max_index , return_drone_id, similiarity[i], thres);
-        if (labels[i] <= index.ntotal - max_index && similiarity[i] > thres) {
-            //Is same id, max index make sense
-            k = i;
-            thres = similarity = similiarity[i];
-            return return_frame_id;
+        // ROS_INFO("Return Label %d/%d/%d, distance %f/%f", labels[i] + index_offset, index.ntotal, index.ntotal - max_index, similiarity[i], thres);
+        if (labels[i] <= index.size() - max_index && similiarity[i] > thres) {
+            //Is same id, max index make sense. Results are most similar first, so the best direction of a keyframe is kept.
+            if (frame_ids.insert(index_to_frame_id.at(return_frame_id)).second) {
+                candidates.emplace_back(similiarity[i], return_frame_id);
+                count ++;
+            }
         }
     }
-    // ROS_INFO("Database return %ld on drone %d, radius %f frame_id %d", labels[k] + index_offset, return_drone_id, similiarity[k], return_frame_id);
-    return -1;
+    return count;
 }
 
 
 bool LoopDetector::queryImageArrayFromDatabase(const VisualImageDescArray & img_desc_a,
-    VisualImageDescArray & ret, int & camera_index_new, int & camera_index_old) {
-    double best_similarity = -1;
-    int best_image_index = -1;
+    std::vector<VisualImageDescArray> & rets, int & camera_index_new, std::vector<int> & camera_indices_old) {
     //Strict use camera_index 1 now
     camera_index_new = 0;
     if (loop_cam->getCameraConfiguration() == CameraConfig::STEREO_FISHEYE) {
@@ -316,33 +526,80 @@ bool LoopDetector::queryImageArrayFromDatabase(const VisualImageDescArray & img_
         exit(-1);
     }
 
+    rets.clear();
+    camera_indices_old.clear();
     if (img_desc_a.images[camera_index_new].spLandmarkNum() > 0 || img_desc_a.is_lazy_frame) {
-        double similarity = -1;
-        int index = queryFrameIndexFromDatabase(img_desc_a.images.at(camera_index_new), similarity);
-        if (index != -1 && similarity > best_similarity) {
-            best_image_index = index;
-            best_similarity = similarity;
-        }
-
-        if (best_image_index != -1) {
-            const std::lock_guard<std::mutex> lock(keyframe_database_mutex);
-            int frame_id = index_to_frame_id[best_image_index];
-            camera_index_old = imgid2dir[best_image_index];
-            printf("[LoopDetector] Query image for %ld: ret frame_id %d index %d drone %d with camera %d similarity %f\n", 
-                img_desc_a.frame_id, frame_id, best_image_index, keyframe_database.at(frame_id).drone_id, camera_index_old, best_similarity);
-            ret = keyframe_database.at(frame_id);
-            return true;
+        std::vector<std::pair<double, int>> candidates;
+        queryFrameIndexFromDatabase(img_desc_a.images.at(camera_index_new), std::max(_config.loop_candidate_num, 1), candidates);
+        const std::lock_guard<std::mutex> lock(keyframe_database_mutex);
+        for (auto & candidate : candidates) {
+            //Candidates are already distinct keyframes
+            int64_t frame_id = index_to_frame_id[candidate.second];
+            int camera_index_old = imgid2dir[candidate.second];
+            printf("[LoopDetector] Query image for %ld: ret frame_id %ld index %d drone %d with camera %d similarity %f\n", 
+                img_desc_a.frame_id, frame_id, candidate.second, keyframe_database.at(frame_id).drone_id, camera_index_old, candidate.first);
+            rets.emplace_back(keyframe_database.at(frame_id));
+            camera_indices_old.emplace_back(camera_index_old);
+            touchKeyframe(frame_id);
         }
     }
+    return rets.size() > 0;
+}
 
-    camera_index_old = -1;
-    ret.frame_id = -1;
-    return false;
+void LoopDetector::rankCandidates(const VisualImageDescArray & frame_array, int camera_index,
+        std::vector<VisualImageDescArray> & candidates, std::vector<int> & candidate_dirs) const {
+    //Cheap geometric pre-check: ratio-test matches of a keypoint subset of the query against each candidate
+    TicToc tic;
+    int dims = params->superpoint_dims;
+    auto & img_a = frame_array.images[camera_index];
+    int num_a = img_a.spLandmarkNum();
+    std::vector<int8_t> buf_a, subset;
+    float scale_a;
+    auto desc_a = img_a.landmarkDescriptorInt8(buf_a, scale_a);
+    int step = _config.loop_precheck_keypoints > 0 ? std::max(1, num_a / _config.loop_precheck_keypoints) : 1;
+    int num_sub = 0;
+    for (int i = 0; i < num_a; i += step) {
+        subset.insert(subset.end(), desc_a + i*dims, desc_a + (i + 1)*dims);
+        num_sub ++;
+    }
+    std::vector<int> scores(candidates.size(), 0);
+    for (int i = 0; i < candidates.size(); i++) {
+        if (candidate_dirs[i] < 0 || candidate_dirs[i] >= candidates[i].images.size()) {
+            continue;
+        }
+        auto & img_b = candidates[i].images[candidate_dirs[i]];
+        std::vector<int8_t> buf_b;
+        float scale_b;
+        auto desc_b = img_b.landmarkDescriptorInt8(buf_b, scale_b);
+        DescriptorMatcher matcher(dims);
+        matcher.setTrain(desc_b, scale_b, img_b.spLandmarkNum());
+        scores[i] = matcher.matchRatio(subset.data(), scale_a, num_sub, _config.knn_match_ratio).size();
+    }
+    std::vector<int> order(candidates.size());
+    for (int i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    //Ties keep the NetVLAD order
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return scores[a] > scores[b];
+    });
+    std::vector<VisualImageDescArray> _candidates;
+    std::vector<int> _candidate_dirs;
+    for (auto i : order) {
+        _candidates.emplace_back(std::move(candidates[i]));
+        _candidate_dirs.emplace_back(candidate_dirs[i]);
+    }
+    candidates = std::move(_candidates);
+    candidate_dirs = std::move(_candidate_dirs);
+    if (params->verbose) {
+        printf("[LoopDetector] Pre-check %ld candidates with %d keypoints in %.1fms, best %ld matches %d\n", 
+            candidates.size(), num_sub, tic.toc(), candidates[0].frame_id, scores[order[0]]);
+    }
 }
 
 
 int LoopDetector::databaseSize() const {
-    return local_index.ntotal + remote_index.ntotal;
+    return local_index.size() + remote_index.size();
 }
 
 
@@ -351,9 +608,15 @@ bool LoopDetector::checkLoopOdometryConsistency(LoopEdge & loop_conn) const {
         //Is inter_loop, odometry consistency check is disabled.
         return true;
     }
+    if (isLoadedFrame(loop_conn.keyframe_id_a) || isLoadedFrame(loop_conn.keyframe_id_b)) {
+        //Loaded keyframes are from a previous session, the odometry of this session does not cover them.
+        return true;
+    }
 
     Swarm::LoopEdge edge(loop_conn);
+    std::unique_lock<std::mutex> lock(traj_mutex);
     auto odom = ego_motion_traj.get_relative_pose_by_appro_ts(edge.ts_a, edge.ts_b);
+    lock.unlock();
     Eigen::Matrix6d cov_vec = odom.second + edge.getCovariance();
     auto dp = Swarm::Pose::DeltaPose(edge.relative_pose, odom.first);
     auto md = Swarm::computeSquaredMahalanobisDistance(dp.log_map(), cov_vec);
@@ -401,39 +664,41 @@ bool LoopDetector::computeCorrespondFeaturesOnImageArray(const VisualImageDescAr
     Eigen::Quaterniond main_quat_new =  extrinsic_a.att();
     Eigen::Quaterniond main_quat_old =  extrinsic_b.att();
 
-    int matched_dir_count = 0;
-    for (size_t i = 0; i < dirs_a.size(); i++) {
+    //Match the direction pairs in parallel, then gather them in direction order.
+    int dir_num = dirs_a.size();
+    std::vector<std::vector<Vector3d>> _lm_norm_3d_b(dir_num), _lm_pos_a(dir_num);
+    std::vector<std::vector<int>> _idx_a(dir_num), _idx_b(dir_num), _camera_indices(dir_num);
+    std::vector<int> succ(dir_num, 0);
+    //SuperGlue inference is not reentrant
+#pragma omp parallel for num_threads(dir_num) if(!_config.enable_superglue && dir_num > 1)
+    for (int i = 0; i < dir_num; i++) {
         int dir_a = dirs_a[i];
         int dir_b = dirs_b[i];
-        std::vector<Vector3d> _lm_norm_3d_b;
-        std::vector<Vector3d> _lm_pos_a;
-        std::vector<int> _idx_a;
-        std::vector<int> _idx_b;
-        std::vector<int> _camera_indices;
-
         if (dir_a < frame_array_a.images.size() && dir_b < frame_array_b.images.size() && dir_a >= 0 && dir_b >= 0) {
-            bool succ = computeCorrespondFeatures(frame_array_a.images[dir_a],frame_array_b.images[dir_b],
-                _lm_pos_a, _idx_a, _lm_norm_3d_b, _idx_b, _camera_indices);
+            succ[i] = computeCorrespondFeatures(frame_array_a.images[dir_a],frame_array_b.images[dir_b],
+                _lm_pos_a[i], _idx_a[i], _lm_norm_3d_b[i], _idx_b[i], _camera_indices[i]);
             // ROS_INFO("[LoopDetector] computeCorrespondFeatures on camera_index %d:%d gives %d common features", dir_b, dir_a, _lm_pos_a.size());
-            if (!succ) {
-                continue;
-            }
         }
+    }
 
-        if ( _lm_pos_a.size() >= _config.MIN_MATCH_PRE_DIR ) {
+    int matched_dir_count = 0;
+    for (int i = 0; i < dir_num; i++) {
+        if (!succ[i]) {
+            continue;
+        }
+        int dir_a = dirs_a[i];
+        int dir_b = dirs_b[i];
+        if ( _lm_pos_a[i].size() >= _config.MIN_MATCH_PRE_DIR ) {
             matched_dir_count ++;            
         }
 
-        Swarm::Pose _extrinsic_a(frame_array_a.images[dir_a].extrinsic);
-        Swarm::Pose _extrinsic_b(frame_array_b.images[dir_b].extrinsic);
-
-        for (size_t id = 0; id < _lm_norm_3d_b.size(); id++) {
-            index2dirindex_a.push_back(std::make_pair(dir_a, _idx_a[id]));
-            index2dirindex_b.push_back(std::make_pair(dir_b, _idx_b[id]));
+        for (size_t id = 0; id < _lm_norm_3d_b[i].size(); id++) {
+            index2dirindex_a.push_back(std::make_pair(dir_a, _idx_a[i][id]));
+            index2dirindex_b.push_back(std::make_pair(dir_b, _idx_b[i][id]));
         }
-        lm_pos_a.insert(lm_pos_a.end(), _lm_pos_a.begin(), _lm_pos_a.end());
-        lm_norm_3d_b.insert(lm_norm_3d_b.end(), _lm_norm_3d_b.begin(), _lm_norm_3d_b.end());
-        cam_indices.insert(cam_indices.end(), _camera_indices.begin(), _camera_indices.end());
+        lm_pos_a.insert(lm_pos_a.end(), _lm_pos_a[i].begin(), _lm_pos_a[i].end());
+        lm_norm_3d_b.insert(lm_norm_3d_b.end(), _lm_norm_3d_b[i].begin(), _lm_norm_3d_b[i].end());
+        cam_indices.insert(cam_indices.end(), _camera_indices[i].begin(), _camera_indices[i].end());
     }
 
     if(lm_norm_3d_b.size() > _config.loop_inlier_feature_num && matched_dir_count >= _config.MIN_DIRECTION_LOOP) {
@@ -456,28 +721,37 @@ bool LoopDetector::computeCorrespondFeatures(const VisualImageDesc & img_desc_a,
     if (_config.enable_superglue) {
         auto kpts_a = img_desc_a.landmarks2D(true, true);
         auto kpts_b = img_desc_b.landmarks2D(true, true);
-        auto & desc0 = img_desc_a.landmark_descriptor;
-        auto & desc1 = img_desc_b.landmark_descriptor;
+        auto desc0 = img_desc_a.landmarkDescriptorFloat();
+        auto desc1 = img_desc_b.landmarkDescriptorFloat();
         auto & scores0 = img_desc_a.landmark_scores;
         auto & scores1 = img_desc_b.landmark_scores;
         _matches = superglue->inference(kpts_a, kpts_b, desc0, desc1, scores0, scores1);
-    } else{ 
+    } else if (img_desc_a.isCompacted() || img_desc_b.isCompacted()) {
+        //Compacted keyframes only keep int8 descriptors, match both sides in int8
+        std::vector<int8_t> buf_a, buf_b;
+        float scale_a, scale_b;
+        auto desc_a = img_desc_a.landmarkDescriptorInt8(buf_a, scale_a);
+        auto desc_b = img_desc_b.landmarkDescriptorInt8(buf_b, scale_b);
+        DescriptorMatcher matcher(params->superpoint_dims);
+        matcher.setTrain(desc_b, scale_b, img_desc_b.spLandmarkNum());
+        if (_config.enable_knn_match) {
+            _matches = matcher.matchRatio(desc_a, scale_a, img_desc_a.spLandmarkNum(), _config.knn_match_ratio);
+        } else {
+            _matches = matcher.matchCrossCheck(desc_a, scale_a, img_desc_a.spLandmarkNum());
+        }
+    } else { 
         assert(img_desc_a.spLandmarkNum() * params->superpoint_dims == img_desc_a.landmark_descriptor.size() && "Desciptor size of new img desc must equal to to landmarks*256!!!");
         assert(img_desc_b.spLandmarkNum() * params->superpoint_dims == img_desc_b.landmark_descriptor.size() && "Desciptor size of old img desc must equal to to landmarks*256!!!");
-        cv::Mat descriptors_a( img_desc_a.spLandmarkNum(), params->superpoint_dims, CV_32F);
-        memcpy(descriptors_a.data, img_desc_a.landmark_descriptor.data(), img_desc_a.landmark_descriptor.size()*sizeof(float));
-        cv::Mat descriptors_b( img_desc_b.spLandmarkNum(), params->superpoint_dims, CV_32F);
-        memcpy(descriptors_b.data, img_desc_b.landmark_descriptor.data(), img_desc_b.landmark_descriptor.size()*sizeof(float));
+        DescriptorMatcher matcher(params->superpoint_dims);
+        matcher.setTrain(img_desc_b.landmark_descriptor.data(), img_desc_b.spLandmarkNum());
         if (_config.enable_knn_match) {
-            _matches = matchKNN(descriptors_a, descriptors_b, _config.knn_match_ratio);
+            _matches = matcher.matchRatio(img_desc_a.landmark_descriptor.data(), img_desc_a.spLandmarkNum(), _config.knn_match_ratio);
         } else {
-            cv::BFMatcher bfmatcher(cv::NORM_L2, true);
-            bfmatcher.match(descriptors_a, descriptors_b, _matches);
+            _matches = matcher.matchCrossCheck(img_desc_a.landmark_descriptor.data(), img_desc_a.spLandmarkNum());
         }
-        
     }
     Point2fVector lm_b_2d, lm_a_2d;
-    std::lock_guard<std::recursive_mutex> guard(landmark_mutex);
+    std::unique_lock<std::recursive_mutex> guard(landmark_mutex);
     for (auto match : _matches) {
         int index_a = match.queryIdx;
         int index_b = match.trainIdx;
@@ -500,6 +774,8 @@ bool LoopDetector::computeCorrespondFeatures(const VisualImageDesc & img_desc_a,
             lm_norm_3d_b.push_back(pt3d_norm_b);
             cam_indices.push_back(img_desc_b.camera_index);
     }
+    //Directions are matched concurrently, only the landmark lookup is serialized
+    guard.unlock();
 
     if (lm_b_2d.size() < 4) {
         return false;
@@ -613,8 +889,10 @@ void LoopDetector::drawMatched(const VisualImageDescArray & frame_array_a,
     cv::Mat show;
     char title[100] = {0};
     std::vector<cv::Mat> _matched_imgs;
-    auto & imgs_a = msgid2cvimgs[frame_array_a.frame_id];
-    auto & imgs_b = msgid2cvimgs[frame_array_b.frame_id];
+    std::unique_lock<std::mutex> lock(show_mutex);
+    auto imgs_a = msgid2cvimgs[frame_array_a.frame_id];
+    auto imgs_b = msgid2cvimgs[frame_array_b.frame_id];
+    lock.unlock();
     _matched_imgs.resize(imgs_b.size());
     for (size_t i = 0; i < imgs_b.size(); i ++) {
         int dir_a = ((-main_dir_b + main_dir_a + _config.MAX_DIRS) % _config.MAX_DIRS + i)% _config.MAX_DIRS;
@@ -692,19 +970,42 @@ void LoopDetector::drawMatched(const VisualImageDescArray & frame_array_a,
     cv::waitKey(10);
 }
 void LoopDetector::onLoopConnection(LoopEdge & loop_conn) {
+    if (isLoadedFrame(loop_conn.keyframe_id_a) || isLoadedFrame(loop_conn.keyframe_id_b)) {
+        if (on_relocalization_cb) {
+            on_relocalization_cb(loop_conn);
+        }
+        return;
+    }
     on_loop_cb(loop_conn);
 }
 
-void LoopDetector::updatebyLandmarkDB(const std::map<LandmarkIdType, LandmarkPerId> & vins_landmark_db) {
+void LoopDetector::updatebyLandmarkDelta(const LandmarkDeltaPtr & delta) {
+    //Same lock order as evictKeyframe
+    const std::lock_guard<std::mutex> lock(keyframe_database_mutex);
     std::lock_guard<std::recursive_mutex> guard(landmark_mutex);
-    for (auto it : vins_landmark_db) {
-        auto landmark_id = it.first;
-        if (landmark_db.find(landmark_id) == landmark_db.end()) {
-            landmark_db[landmark_id] = it.second;
-        } else {
-            if (it.second.flag == LandmarkFlag::INITIALIZED || it.second.flag == LandmarkFlag::ESTIMATED) {
-                landmark_db[landmark_id] = it.second;
-            }
+    if (delta->version <= landmark_version) {
+        return;
+    }
+    if (delta->version != landmark_version + 1) {
+        printf("[LoopDetector] Landmark delta %ld follows %ld, missed updates are lost\n", delta->version, landmark_version);
+    }
+    landmark_version = delta->version;
+    for (auto & update : delta->updates) {
+        auto landmark_id = update.landmark_id;
+        if (landmark_refs.find(landmark_id) == landmark_refs.end()) {
+            //No retained keyframe observes it, so it would never be evicted. Landmarks in the VIO window are sent
+            //again after each solve, so one whose keyframe is added later still gets a position.
+            continue;
+        }
+        auto lm = landmark_db.find(landmark_id);
+        if (lm == landmark_db.end() || update.flag == LandmarkFlag::INITIALIZED || update.flag == LandmarkFlag::ESTIMATED) {
+            //Only the position and the flag are used for loop closure, the tracks are not kept
+            auto & dst = landmark_db[landmark_id];
+            dst.landmark_id = update.landmark_id;
+            dst.drone_id = update.drone_id;
+            dst.base_frame_id = update.base_frame_id;
+            dst.position = update.position;
+            dst.flag = update.flag;
         }
     }
 }
@@ -714,7 +1015,9 @@ void LoopDetector::updatebySldWin(const std::vector<VINSFrame*> sld_win) {
     for (auto frame : sld_win) {
         auto frame_id = frame->frame_id;
         if (keyframe_database.find(frame_id) != keyframe_database.end()) {
+            updateKeyframeCoverage(frame_id, -1);
             keyframe_database.at(frame_id).pose_drone = frame->odom.pose();
+            updateKeyframeCoverage(frame_id, 1);
         }
     }
 }
@@ -724,15 +1027,298 @@ bool LoopDetector::hasFrame(FrameIdType frame_id) {
     return keyframe_database.find(frame_id) != keyframe_database.end();
 }
 
+struct LoopDBLandmark {
+    LandmarkIdType landmark_id;
+    int32_t drone_id;
+    int32_t flag;
+    double position[3];
+};
+
+template<typename T>
+void appendPOD(std::vector<uint8_t> & buf, const T & v) {
+    const uint8_t * p = reinterpret_cast<const uint8_t*>(&v);
+    buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+class MappedDBReader: public faiss::IOReader {
+    //Reads from the mapped database file. The whole file is decoded eagerly and unmapped afterwards,
+    //so the mapping only saves a copy into a read buffer.
+public:
+    const uint8_t * data = nullptr;
+    size_t length = 0;
+    size_t pos = 0;
+    size_t operator()(void * ptr, size_t size, size_t nitems) override {
+        if (size == 0) {
+            return 0;
+        }
+        size_t n = std::min(nitems, (length - pos) / size);
+        memcpy(ptr, data + pos, n * size);
+        pos += n * size;
+        return n;
+    }
+    template<typename T>
+    bool read(T & v) {
+        return (*this)(&v, sizeof(T), 1) == 1;
+    }
+    const uint8_t * skip(size_t size) {
+        if (length - pos < size) {
+            return nullptr;
+        }
+        auto ret = data + pos;
+        pos += size;
+        return ret;
+    }
+};
+
+bool LoopDetector::saveDatabase(const std::string & path) {
+    std::lock_guard<std::recursive_mutex> guard(frame_mutex);
+    TicToc tic;
+    std::vector<uint8_t> buf;
+    appendPOD(buf, (uint32_t) LOOP_DB_MAGIC);
+    appendPOD(buf, (uint32_t) LOOP_DB_VERSION);
+    appendPOD(buf, (int32_t) params->netvlad_dims);
+    appendPOD(buf, (int32_t) self_id);
+    {
+        const std::lock_guard<std::mutex> lock(keyframe_database_mutex);
+        appendPOD(buf, (uint64_t) keyframe_database.size());
+        for (auto & it : keyframe_database) {
+            //Float descriptors, images are dropped
+            auto lcm_msg = it.second.toLCM(true, false, true);
+            for (auto & img : lcm_msg.images) {
+                img.image_size = 0;
+                img.image.clear();
+            }
+            int32_t size = lcm_msg.getEncodedSize();
+            appendPOD(buf, size);
+            size_t offset = buf.size();
+            buf.resize(offset + size);
+            lcm_msg.encode(buf.data() + offset, 0, size);
+        }
+    }
+    appendPOD(buf, (uint64_t) index_to_frame_id.size());
+    for (auto & it : index_to_frame_id) {
+        appendPOD(buf, (int32_t) it.first);
+        appendPOD(buf, (int64_t) it.second);
+        appendPOD(buf, (int32_t) (imgid2dir.count(it.first) ? imgid2dir.at(it.first) : 0));
+    }
+    {
+        std::lock_guard<std::recursive_mutex> guard(landmark_mutex);
+        appendPOD(buf, (uint64_t) landmark_db.size());
+        for (auto & it : landmark_db) {
+            LoopDBLandmark lm{it.first, it.second.drone_id, (int32_t) it.second.flag,
+                {it.second.position.x(), it.second.position.y(), it.second.position.z()}};
+            appendPOD(buf, lm);
+        }
+    }
+    for (auto index : {&local_index, &remote_index}) {
+        faiss::VectorIOWriter writer;
+        index->write(&writer);
+        appendPOD(buf, (uint64_t) writer.data.size());
+        buf.insert(buf.end(), writer.data.begin(), writer.data.end());
+    }
+    //Write then rename, so a crash never leaves a truncated database behind
+    std::string tmp_path = path + ".tmp";
+    std::ofstream ofs(tmp_path, std::ios::binary);
+    if (!ofs.is_open()) {
+        printf("[LoopDetector] Failed to open %s for writing\n", tmp_path.c_str());
+        return false;
+    }
+    ofs.write((const char*) buf.data(), buf.size());
+    ofs.close();
+    if (!ofs || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        printf("[LoopDetector] Failed to write database %s\n", path.c_str());
+        return false;
+    }
+    printf("[LoopDetector] Saved %ld keyframes %.1fMB to %s in %.1fms\n", keyframe_database.size(), 
+        buf.size() / 1024.0 / 1024.0, path.c_str(), tic.toc());
+    return true;
+}
+
+bool LoopDetector::loadDatabase(const std::string & path) {
+    std::lock_guard<std::recursive_mutex> guard(frame_mutex);
+    TicToc tic;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        printf("[LoopDetector] Database %s not found\n", path.c_str());
+        return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    void * mapped = st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        printf("[LoopDetector] Failed to map database %s\n", path.c_str());
+        return false;
+    }
+    MappedDBReader reader;
+    reader.data = (const uint8_t*) mapped;
+    reader.length = st.st_size;
+    bool success = false;
+    uint32_t magic = 0, version = 0;
+    int32_t dims = 0, db_self_id = 0;
+    uint64_t num = 0;
+    std::map<int64_t, VisualImageDescArray> keyframes;
+    std::map<int, int64_t> _index_to_frame_id;
+    std::map<int, int> _imgid2dir;
+    std::map<LandmarkIdType, LandmarkPerId> landmarks;
+    PlaceRecognitionIndex _local_index(params->netvlad_dims, _config.place_index);
+    PlaceRecognitionIndex _remote_index(params->netvlad_dims, _config.place_index);
+    do {
+        if (!reader.read(magic) || !reader.read(version) || magic != LOOP_DB_MAGIC || version != LOOP_DB_VERSION) {
+            printf("[LoopDetector] %s is not a loop database of version %d\n", path.c_str(), LOOP_DB_VERSION);
+            break;
+        }
+        if (!reader.read(dims) || !reader.read(db_self_id) || dims != params->netvlad_dims) {
+            printf("[LoopDetector] Database descriptor dims %d mismatch %ld\n", dims, params->netvlad_dims);
+            break;
+        }
+        if (!reader.read(num)) {
+            break;
+        }
+        bool ok = true;
+        for (uint64_t i = 0; i < num && ok; i++) {
+            int32_t size = 0;
+            const uint8_t * data = nullptr;
+            ImageArrayDescriptor_t lcm_msg;
+            ok = reader.read(size) && (data = reader.skip(size)) != nullptr && lcm_msg.decode(data, 0, size) >= 0;
+            if (ok) {
+                VisualImageDescArray frame(lcm_msg);
+                frame.frame_id += LOOP_DB_LOADED_ID_OFFSET;
+                for (auto & img : frame.images) {
+                    img.frame_id += LOOP_DB_LOADED_ID_OFFSET;
+                    for (auto & lm : img.landmarks) {
+                        lm.frame_id += LOOP_DB_LOADED_ID_OFFSET;
+                        lm.landmark_id += LOOP_DB_LOADED_ID_OFFSET;
+                    }
+                }
+                keyframes[frame.frame_id] = frame;
+            }
+        }
+        if (!ok || !reader.read(num)) {
+            break;
+        }
+        for (uint64_t i = 0; i < num && ok; i++) {
+            int32_t index = 0, dir = 0;
+            int64_t frame_id = 0;
+            ok = reader.read(index) && reader.read(frame_id) && reader.read(dir);
+            _index_to_frame_id[index] = frame_id + LOOP_DB_LOADED_ID_OFFSET;
+            _imgid2dir[index] = dir;
+        }
+        if (!ok || !reader.read(num)) {
+            break;
+        }
+        for (uint64_t i = 0; i < num && ok; i++) {
+            LoopDBLandmark lm;
+            ok = reader.read(lm);
+            LandmarkPerId lm_per_id;
+            lm_per_id.landmark_id = lm.landmark_id + LOOP_DB_LOADED_ID_OFFSET;
+            lm_per_id.drone_id = lm.drone_id;
+            lm_per_id.flag = (LandmarkFlag) lm.flag;
+            lm_per_id.position = Vector3d(lm.position[0], lm.position[1], lm.position[2]);
+            landmarks[lm_per_id.landmark_id] = lm_per_id;
+        }
+        if (!ok) {
+            break;
+        }
+        for (auto index : {&_local_index, &_remote_index}) {
+            uint64_t index_size = 0;
+            ok = ok && reader.read(index_size) && index_size <= reader.length - reader.pos;
+            size_t start = reader.pos;
+            ok = ok && index->read(&reader) && reader.pos - start == index_size;
+        }
+        if (!ok) {
+            printf("[LoopDetector] Place recognition index section of %s is corrupted\n", path.c_str());
+            break;
+        }
+        //Every index entry must point to a descriptor of the index and to a loaded keyframe
+        for (auto & it : _index_to_frame_id) {
+            int local_num = _local_index.size(), remote_num = _remote_index.size();
+            bool in_index = it.first >= REMOTE_MAGIN_NUMBER ? it.first - REMOTE_MAGIN_NUMBER < remote_num :
+                (it.first >= 0 && it.first < local_num);
+            if (!in_index || keyframes.find(it.second) == keyframes.end()) {
+                printf("[LoopDetector] Index %d of %s does not match the keyframes\n", it.first, path.c_str());
+                ok = false;
+                break;
+            }
+        }
+        success = ok;
+    } while (0);
+    munmap(mapped, st.st_size);
+    if (!success) {
+        ROS_WARN("[LoopDetector] Failed to load database %s, starting with an empty database", path.c_str());
+        return false;
+    }
+    if (db_self_id != self_id) {
+        ROS_WARN("[LoopDetector] Database %s was built by drone %d, loaded by drone %d", path.c_str(), db_self_id, self_id);
+    }
+    {
+        std::lock_guard<std::recursive_mutex> guard(landmark_mutex);
+        landmark_db = landmarks;
+    }
+    {
+        //The query path reads the index maps under keyframe_database_mutex
+        const std::lock_guard<std::mutex> lock(keyframe_database_mutex);
+        keyframe_database = keyframes;
+        for (auto & it : keyframe_database) {
+            all_nodes.insert(it.second.drone_id);
+        }
+        index_to_frame_id = _index_to_frame_id;
+        imgid2dir = _imgid2dir;
+        local_index = std::move(_local_index);
+        remote_index = std::move(_remote_index);
+        //Loaded keyframes are old: compact them and rebuild the memory bookkeeping
+        frame_id_to_indices.clear();
+        for (auto & it : index_to_frame_id) {
+            frame_id_to_indices[it.second].push_back(it.first);
+        }
+        std::vector<std::pair<double, int64_t>> stamps;
+        landmark_refs.clear();
+        keyframe_db_bytes = 0;
+        for (auto & it : keyframe_database) {
+            if (_config.keyframe_db_full_num >= 0) {
+                it.second.compact();
+            }
+            for (auto & img : it.second.images) {
+                for (auto & lm : img.landmarks) {
+                    if (lm.type == LandmarkType::SuperPointLandmark) {
+                        landmark_refs[lm.landmark_id] ++;
+                    }
+                }
+            }
+            keyframe_db_bytes += it.second.memoryBytes();
+            stamps.emplace_back(it.second.stamp, it.first);
+        }
+        std::sort(stamps.begin(), stamps.end());
+        keyframe_cells.clear();
+        keyframe_coverage.clear();
+        for (auto & it : stamps) {
+            updateKeyframeCoverage(it.second, 1);
+        }
+        full_keyframes.clear();
+        keyframe_lru.clear();
+        keyframe_lru_pos.clear();
+        for (auto & it : stamps) {
+            touchKeyframe(it.second);
+        }
+        enforceMemoryBudget();
+    }
+    printf("[LoopDetector] Loaded %ld keyframes %ld landmarks from %s in %.1fms\n", keyframe_database.size(),
+        landmark_db.size(), path.c_str(), tic.toc());
+    return true;
+}
+
 LoopDetector::LoopDetector(int _self_id, const LoopDetectorConfig & config):
         self_id(_self_id),
         _config(config),
-        local_index(params->netvlad_dims), 
-        remote_index(params->netvlad_dims), 
+        local_index(params->netvlad_dims, config.place_index), 
+        remote_index(params->netvlad_dims, config.place_index), 
     ego_motion_traj(_self_id, true, _config.pos_covariance_per_meter, _config.yaw_covariance_per_meter) {
     if (_config.enable_superglue) {
         superglue = new SuperGlueOnnx(_config.superglue_model_path);
     }
+    if (_config.load_database_path != "") {
+        loadDatabase(_config.load_database_path);
+    }
 }
 
 }
\ No newline at end of file
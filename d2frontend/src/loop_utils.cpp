@@ -11,6 +11,7 @@
 #include <opengv/sac/Ransac.hpp>
 #include <opengv/sac/Lmeds.hpp>
 #include <d2frontend/loop_detector.h>
+#include <d2frontend/descriptor_matcher.h>
 #include <opencv2/cudaoptflow.hpp>
 #include <opencv2/cudaimgproc.hpp>
 #include <opencv2/cudawarping.hpp>
@@ -22,6 +23,7 @@ using D2Common::Utility::TicToc;
 
 #define PYR_LEVEL 3
 #define WIN_SIZE cv::Size(21, 21)
+#define PNP_RANSAC_ITERATIONS 50
 
 namespace D2FrontEnd {
 
@@ -63,6 +65,33 @@ cv_bridge::CvImagePtr getImageFromMsg(const sensor_msgs::ImageConstPtr &img_msg)
     return ptr;
 }
 
+std::shared_ptr<const void> holdMessage(const sensor_msgs::ImageConstPtr &img_msg) {
+    //ROS messages are boost::shared_ptr; the deleter keeps a copy of it alive.
+    return std::shared_ptr<const void>(img_msg.get(), [img_msg] (const void *) {});
+}
+
+cv::Mat getImageFromMsg(const sensor_msgs::ImageConstPtr &img_msg, std::shared_ptr<const void> & holder) {
+    //Share the message buffer when no conversion is needed; holder then keeps the message alive.
+    holder.reset();
+    if (img_msg->encoding == "8UC1" || img_msg->encoding == "mono8" || 
+            img_msg->encoding == sensor_msgs::image_encodings::BGR8) {
+        holder = holdMessage(img_msg);
+        return cv_bridge::toCvShare(img_msg)->image;
+    }
+    return getImageFromMsg(img_msg)->image;
+}
+
+cv::Mat getGrayImageFromMsg(const sensor_msgs::ImageConstPtr &img_msg, ImageBufferPool & pool, 
+        std::shared_ptr<const void> & holder) {
+    cv::Mat img = getImageFromMsg(img_msg, holder);
+    if (img.channels() == 1) {
+        return img;
+    }
+    cv::Mat gray = pool.acquire(img.rows, img.cols, CV_8UC1, holder);
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    return gray;
+}
+
 Swarm::Pose AffineRestoCamPose(Eigen::Matrix4d affine) {
     Eigen::Matrix3d R;
     Eigen::Vector3d T;
@@ -221,25 +250,14 @@ std::vector<cv::DMatch> matchKNN(const cv::Mat & desc_a, const cv::Mat & desc_b,
         const std::vector<cv::Point2f> pts_a,
         const std::vector<cv::Point2f> pts_b,
         double search_local_dist) {
-    //Match descriptors with OpenCV knnMatch
-    std::vector<std::vector<cv::DMatch>> matches;
-    cv::BFMatcher bfmatcher(cv::NORM_L2);
-    bfmatcher.knnMatch(desc_a, desc_b, matches, 2);
-    std::vector<cv::DMatch> good_matches;
-    for (auto & match : matches) {
-        if (match.size() < 2) {
-            continue;
-        }
-        if (match[0].distance < knn_match_ratio * match[1].distance) {
-            if (search_local_dist > 0) {
-                if (cv::norm(pts_a[match[0].queryIdx] - pts_b[match[0].trainIdx]) > search_local_dist) {
-                    continue;
-                }
-            }
-            good_matches.push_back(match[0]);
-        }
-    }
-    return good_matches;
+    //Match descriptors with the SIMD matcher; the spatial gate is applied before computing descriptor distances
+    assert(desc_a.isContinuous() && desc_b.isContinuous() && desc_a.type() == CV_32F && desc_b.type() == CV_32F);
+    if (desc_a.rows == 0 || desc_b.rows == 0) {
+        return std::vector<cv::DMatch>();
+    }
+    DescriptorMatcher matcher(desc_a.cols, search_local_dist);
+    matcher.setTrain(desc_b.ptr<float>(), desc_b.rows, pts_b);
+    return matcher.matchRatio(desc_a.ptr<float>(), desc_a.rows, knn_match_ratio, pts_a);
 }
 
 
@@ -355,8 +373,27 @@ std::vector<cv::Point2f> opticalflowTrack(const cv::Mat & cur_img, const cv::Mat
     return cur_pts;
 } 
 
-std::vector<cv::Point2f> opticalflowTrackPyr(const cv::Mat & cur_img, std::vector<cv::cuda::GpuMat> & prev_pyr, 
-        std::vector<cv::Point2f> & prev_pts, std::vector<LandmarkIdType> & ids, TrackLRType type, bool update_pyr) {
+static void calcLKWithPyr(const std::vector<cv::cuda::GpuMat> & prev_pyr, const std::vector<cv::cuda::GpuMat> & cur_pyr, 
+        const std::vector<cv::Point2f> & prev_pts, std::vector<cv::Point2f> & cur_pts, std::vector<uchar> & status) {
+    cv::cuda::GpuMat gpu_prev_pts(prev_pts);
+    cv::cuda::GpuMat gpu_cur_pts(cur_pts);
+    cv::cuda::GpuMat gpu_status;
+    cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> d_pyrLK_sparse = cv::cuda::SparsePyrLKOpticalFlow::create(WIN_SIZE, PYR_LEVEL, 30, true);
+    d_pyrLK_sparse->calc(prev_pyr, cur_pyr, gpu_prev_pts, gpu_cur_pts, gpu_status);
+    gpu_status.download(status);
+    gpu_cur_pts.download(cur_pts);
+}
+
+static void calcLKWithPyr(const std::vector<cv::Mat> & prev_pyr, const std::vector<cv::Mat> & cur_pyr, 
+        const std::vector<cv::Point2f> & prev_pts, std::vector<cv::Point2f> & cur_pts, std::vector<uchar> & status) {
+    std::vector<float> err;
+    cv::calcOpticalFlowPyrLK(prev_pyr, cur_pyr, prev_pts, cur_pts, status, err, WIN_SIZE, PYR_LEVEL, 
+            cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, 30, 0.01), cv::OPTFLOW_USE_INITIAL_FLOW);
+}
+
+template<typename PyrType>
+std::vector<cv::Point2f> opticalflowTrackPyrImpl(const cv::Mat & cur_img, const PyrType & prev_pyr, const PyrType & cur_pyr,
+        std::vector<cv::Point2f> & prev_pts, std::vector<LandmarkIdType> & ids, TrackLRType type) {
     if (prev_pts.size() == 0) {
         return std::vector<cv::Point2f>();
     }
@@ -365,10 +402,6 @@ std::vector<cv::Point2f> opticalflowTrackPyr(const cv::Mat & cur_img, std::vecto
     std::vector<cv::Point2f> cur_pts;
     float move_cols = cur_img.cols*90.0/params->undistort_fov; //slightly lower than 0.5 cols when fov=200
 
-    if (prev_pts.size() == 0) {
-        return std::vector<cv::Point2f>();
-    }
-
     if (type == WHOLE_IMG_MATCH) {
         cur_pts = prev_pts;
     } else  {
@@ -400,20 +433,10 @@ std::vector<cv::Point2f> opticalflowTrackPyr(const cv::Mat & cur_img, std::vecto
     if (cur_pts.size() == 0) {
         return std::vector<cv::Point2f>();
     }
-    std::vector<float> err;
     std::vector<uchar> reverse_status;
     std::vector<cv::Point2f> reverse_pts;
-
-    cv::cuda::GpuMat gpu_cur_img(cur_img);
-    cv::cuda::GpuMat gpu_prev_pts(prev_pts);
-    cv::cuda::GpuMat gpu_cur_pts(cur_pts);
-    cv::cuda::GpuMat gpu_status;
-    cv::cuda::GpuMat reverse_gpu_status;
-    auto cur_pyr = buildImagePyramid(gpu_cur_img);
-    cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> d_pyrLK_sparse = cv::cuda::SparsePyrLKOpticalFlow::create(WIN_SIZE, PYR_LEVEL, 30, true);
-    d_pyrLK_sparse->calc(prev_pyr, cur_pyr, gpu_prev_pts, gpu_cur_pts, gpu_status);
-    gpu_status.download(status);
-    gpu_cur_pts.download(cur_pts);
+    //Forward and backward check share the same two pyramids
+    calcLKWithPyr(prev_pyr, cur_pyr, prev_pts, cur_pts, status);
     reverse_pts = cur_pts;
     for (unsigned int i = 0; i < prev_pts.size(); i++) {
         auto & pt = reverse_pts[i];
@@ -424,10 +447,7 @@ std::vector<cv::Point2f> opticalflowTrackPyr(const cv::Mat & cur_img, std::vecto
             pt.x += move_cols;
         }
     }
-    cv::cuda::GpuMat reverse_gpu_pts(reverse_pts);
-    d_pyrLK_sparse->calc(cur_pyr, prev_pyr, gpu_cur_pts, reverse_gpu_pts, reverse_gpu_status);
-    reverse_gpu_pts.download(reverse_pts);
-    reverse_gpu_status.download(reverse_status);
+    calcLKWithPyr(cur_pyr, prev_pyr, cur_pts, reverse_pts, reverse_status);
 
     for(size_t i = 0; i < status.size(); i++)
     {
@@ -447,11 +467,34 @@ std::vector<cv::Point2f> opticalflowTrackPyr(const cv::Mat & cur_img, std::vecto
     reduceVector(prev_pts, status);
     reduceVector(cur_pts, status);
     reduceVector(ids, status);
+    return cur_pts;
+}
+
+std::vector<cv::Point2f> opticalflowTrackPyr(const cv::Mat & cur_img, std::vector<cv::cuda::GpuMat> & prev_pyr, 
+        std::vector<cv::Point2f> & prev_pts, std::vector<LandmarkIdType> & ids, TrackLRType type, bool update_pyr) {
+    if (prev_pts.size() == 0) {
+        return std::vector<cv::Point2f>();
+    }
+    cv::cuda::GpuMat gpu_cur_img(cur_img);
+    auto cur_pyr = buildImagePyramid(gpu_cur_img);
+    auto cur_pts = opticalflowTrackPyrImpl(cur_img, prev_pyr, cur_pyr, prev_pts, ids, type);
     if (update_pyr) {
         prev_pyr = cur_pyr;
     }
     return cur_pts;
-} 
+}
+
+std::vector<cv::Point2f> opticalflowTrackPyr(const cv::Mat & cur_img, const std::vector<cv::cuda::GpuMat> & prev_pyr, 
+        const std::vector<cv::cuda::GpuMat> & cur_pyr, std::vector<cv::Point2f> & prev_pts, std::vector<LandmarkIdType> & ids, 
+        TrackLRType type) {
+    return opticalflowTrackPyrImpl(cur_img, prev_pyr, cur_pyr, prev_pts, ids, type);
+}
+
+std::vector<cv::Point2f> opticalflowTrackPyr(const cv::Mat & cur_img, const std::vector<cv::Mat> & prev_pyr, 
+        const std::vector<cv::Mat> & cur_pyr, std::vector<cv::Point2f> & prev_pts, std::vector<LandmarkIdType> & ids, 
+        TrackLRType type) {
+    return opticalflowTrackPyrImpl(cur_img, prev_pyr, cur_pyr, prev_pts, ids, type);
+}
 
 
 void detectPoints(const cv::Mat & img, std::vector<cv::Point2f> & n_pts, std::vector<cv::Point2f> & cur_pts, 
@@ -612,6 +655,16 @@ int computeRelativePosePnP(const std::vector<Vector3d> lm_positions_a, const std
     return success;
 }
 
+class SeededAbsolutePoseSacProblem: public opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem {
+public:
+    SeededAbsolutePoseSacProblem(adapter_t & adapter, algorithm_t algorithm, unsigned int seed):
+        AbsolutePoseSacProblem(adapter, algorithm, false) {
+        //The generator binds a copy of rng_alg_, so rebind it after seeding
+        rng_alg_.seed(seed);
+        rng_gen_.reset(new std::function<int()>(std::bind(*rng_dist_, rng_alg_)));
+    }
+};
+
 Swarm::Pose computePosePnPnonCentral(const std::vector<Vector3d> & lm_positions_a, const std::vector<Vector3d> & lm_3d_norm_b,
         const std::vector<Swarm::Pose> & cam_extrinsics, const std::vector<int> & camera_indices, std::vector<int> &inliers) {
     opengv::bearingVectors_t bearings;
@@ -629,21 +682,36 @@ Swarm::Pose computePosePnPnonCentral(const std::vector<Vector3d> & lm_positions_
         camOffsets.push_back(cam_extrinsics[i].pos());
     }
 
-    //Solve with GP3P + RANSAC
-    opengv::absolute_pose::NoncentralAbsoluteAdapter adapter(
-        bearings, camCorrespondences, points, camOffsets, camRotations);
-    opengv::sac::Ransac<
-        opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem> ransac;
-    std::shared_ptr<opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem> absposeproblem_ptr(new opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem(
-        adapter, opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem::GP3P));
-    ransac.sac_model_ = absposeproblem_ptr;
-    // ransac.threshold_ = 1.0 - cos(atan(sqrt(10.0)*0.5/460.0));
-    ransac.threshold_ = 0.5/params->focal_length;
-    ransac.max_iterations_ = 50;
-    ransac.computeModel();
+    //Solve with GP3P + RANSAC. The hypotheses are split over threads, each with its own seeded sampler; 
+    //the model with most inliers wins (lowest thread on ties), so the result does not depend on scheduling.
+    int threads = std::max(params->loop_ransac_threads, 1);
+    std::vector<opengv::transformation_t> models(threads, opengv::transformation_t::Identity());
+    std::vector<std::vector<int>> thread_inliers(threads);
+#pragma omp parallel for num_threads(threads)
+    for (int i = 0; i < threads; i++) {
+        opengv::absolute_pose::NoncentralAbsoluteAdapter thread_adapter(
+            bearings, camCorrespondences, points, camOffsets, camRotations);
+        opengv::sac::Ransac<
+            opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem> ransac;
+        ransac.sac_model_ = std::make_shared<SeededAbsolutePoseSacProblem>(thread_adapter, 
+            opengv::sac_problems::absolute_pose::AbsolutePoseSacProblem::GP3P, params->loop_ransac_seed + i);
+        // ransac.threshold_ = 1.0 - cos(atan(sqrt(10.0)*0.5/460.0));
+        ransac.threshold_ = 0.5/params->focal_length;
+        ransac.max_iterations_ = (PNP_RANSAC_ITERATIONS + threads - 1) / threads;
+        if (ransac.computeModel()) {
+            models[i] = ransac.model_coefficients_;
+            thread_inliers[i] = ransac.inliers_;
+        }
+    }
+    int best = 0;
+    for (int i = 1; i < threads; i++) {
+        if (thread_inliers[i].size() > thread_inliers[best].size()) {
+            best = i;
+        }
+    }
     //Obtain relative pose results
-    inliers = ransac.inliers_;
-    auto best_transformation = ransac.model_coefficients_;
+    inliers = thread_inliers[best];
+    auto best_transformation = models[best];
     Matrix3d R = best_transformation.block<3, 3>(0, 0);
     Vector3d t = best_transformation.block<3, 1>(0, 3);
     Swarm::Pose p_drone_old_in_new_init(R, t);
@@ -661,6 +729,8 @@ Swarm::Pose computePosePnPnonCentral(const std::vector<Vector3d> & lm_positions_
         camCorrespondences.push_back(camera_indices[i]);
         points.push_back(lm_positions_a[i]);
     }
+    opengv::absolute_pose::NoncentralAbsoluteAdapter adapter(
+        bearings, camCorrespondences, points, camOffsets, camRotations);
     adapter.sett(t);
     adapter.setR(R);
     opengv::transformation_t nonlinear_transformation =
@@ -712,4 +782,11 @@ std::vector<cv::cuda::GpuMat> buildImagePyramid(const cv::cuda::GpuMat& prevImg,
 
     return prevPyr;
 }
-}
\ No newline at end of file
+
+std::vector<cv::Mat> buildImagePyramid(const cv::Mat& prevImg, int maxLevel_) {
+    //With derivatives, so that calcOpticalFlowPyrLK does not recompute them on every call
+    std::vector<cv::Mat> prevPyr;
+    cv::buildOpticalFlowPyramid(prevImg, prevPyr, WIN_SIZE, maxLevel_, true);
+    return prevPyr;
+}
+}
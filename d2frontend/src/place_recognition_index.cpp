@@ -0,0 +1,98 @@
+#include <d2frontend/place_recognition_index.h>
+#include <d2common/utils.hpp>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/index_io.h>
+#include <faiss/impl/FaissException.h>
+#include <algorithm>
+
+using D2Common::Utility::TicToc;
+
+namespace D2FrontEnd {
+PlaceRecognitionIndex::PlaceRecognitionIndex(int _dims, const PlaceIndexConfig & _config):
+    config(_config), dims(_dims), index(new faiss::IndexFlatIP(_dims)) {
+}
+
+int PlaceRecognitionIndex::add(const float * desc) {
+    index->add(1, desc);
+    if (!approximate && config.type != PLACE_INDEX_FLAT && index->ntotal >= config.train_threshold) {
+        buildApproximate();
+    }
+    return index->ntotal - 1;
+}
+
+void PlaceRecognitionIndex::buildApproximate() {
+    TicToc tic;
+    int num = index->ntotal;
+    std::vector<float> xb((size_t) num * dims);
+    index->reconstruct_n(0, num, xb.data());
+    std::unique_ptr<faiss::Index> new_index;
+    if (config.type == PLACE_INDEX_IVF_PQ) {
+        if (dims % config.pq_m != 0) {
+            printf("[PlaceRecognitionIndex] pq_m %d does not divide dims %d, keep flat index\n", config.pq_m, dims);
+            config.type = PLACE_INDEX_FLAT;
+            return;
+        }
+        //Quantizer is owned by the IVF index
+        auto quantizer = new faiss::IndexFlatIP(dims);
+        auto ivf = new faiss::IndexIVFPQ(quantizer, dims, config.ivf_nlist, config.pq_m, 8, faiss::METRIC_INNER_PRODUCT);
+        ivf->own_fields = true;
+        ivf->nprobe = config.ivf_nprobe;
+        ivf->train(num, xb.data());
+        new_index.reset(ivf);
+    } else {
+        auto hnsw = new faiss::IndexHNSWFlat(dims, config.hnsw_m, faiss::METRIC_INNER_PRODUCT);
+        hnsw->hnsw.efSearch = config.hnsw_ef_search;
+        new_index.reset(hnsw);
+    }
+    //Same insertion order, so ids are kept
+    new_index->add(num, xb.data());
+    index = std::move(new_index);
+    approximate = true;
+    printf("[PlaceRecognitionIndex] Switched to %s index with %d descriptors in %.1fms\n",
+        config.type == PLACE_INDEX_IVF_PQ ? "IVF-PQ" : "HNSW", num, tic.toc());
+}
+
+int PlaceRecognitionIndex::search(const float * desc, int k, std::vector<float> & similarity,
+        std::vector<faiss::idx_t> & labels) const {
+    k = std::min({k, config.max_search_k, (int) index->ntotal});
+    if (k <= 0) {
+        similarity.clear();
+        labels.clear();
+        return 0;
+    }
+    similarity.assign(k, 0);
+    labels.assign(k, -1);
+    index->search(1, desc, k, similarity.data(), labels.data());
+    return k;
+}
+
+int PlaceRecognitionIndex::size() const {
+    return index->ntotal;
+}
+
+void PlaceRecognitionIndex::write(faiss::IOWriter * writer) const {
+    faiss::write_index(index.get(), writer);
+}
+
+bool PlaceRecognitionIndex::read(faiss::IOReader * reader) {
+    std::unique_ptr<faiss::Index> new_index;
+    try {
+        new_index.reset(faiss::read_index(reader));
+    } catch (const faiss::FaissException & e) {
+        //Truncated or corrupted data
+        printf("[PlaceRecognitionIndex] Failed to read index: %s\n", e.what());
+        return false;
+    }
+    if (new_index == nullptr || new_index->d != dims) {
+        printf("[PlaceRecognitionIndex] Index dims mismatch, expect %d\n", dims);
+        return false;
+    }
+    index = std::move(new_index);
+    approximate = dynamic_cast<faiss::IndexFlat*>(index.get()) == nullptr;
+    if (!approximate && config.type != PLACE_INDEX_FLAT && index->ntotal >= config.train_threshold) {
+        buildApproximate();
+    }
+    return true;
+}
+}
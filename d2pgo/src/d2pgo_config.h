@@ -26,6 +26,7 @@ struct SwarmLocalOutlierRejectionParams {
     bool redundant = true;
     bool is_4dof = true;
     bool incremental_pcm = true;
+    int pcm_threads = 4;
 };
 
 struct D2PGOConfig {
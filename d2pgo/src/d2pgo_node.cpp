@@ -188,6 +188,9 @@ protected:
         config.is_realtime = true;
         config.enable_pcm = (int)fsSettings["enable_pcm"];
         config.pcm_rej.pcm_thres = fsSettings["pcm_thres"];
+        if (!fsSettings["pcm_threads"].empty()) {
+            config.pcm_rej.pcm_threads = fsSettings["pcm_threads"];
+        }
         config.enable_rotation_initialization = false;
         config.enable_gravity_prior = (int)fsSettings["enable_gravity_prior"];
         config.rot_init_config.gravity_sqrt_info = fsSettings["gravity_sqrt_info"];
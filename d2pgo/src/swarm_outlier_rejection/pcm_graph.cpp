@@ -0,0 +1,116 @@
+#include "pcm_graph.hpp"
+#include "fast_max-clique_finder/src/graphIO.h"
+#include <algorithm>
+
+namespace D2PGO {
+
+inline int popcount(uint64_t v) {
+    return __builtin_popcountll(v);
+}
+
+int PCMGraph::addVertex() {
+    adj.emplace_back(std::vector<uint64_t>(words(), 0));
+    degrees.push_back(0);
+    return adj.size() - 1;
+}
+
+void PCMGraph::addEdge(int i, int j) {
+    if (i == j || connected(i, j)) {
+        return;
+    }
+    for (int v : {i, j}) {
+        if (adj[v].size() < words()) {
+            adj[v].resize(words(), 0);
+        }
+    }
+    adj[i][j / 64] |= (uint64_t) 1 << (j % 64);
+    adj[j][i / 64] |= (uint64_t) 1 << (i % 64);
+    degrees[i] ++;
+    degrees[j] ++;
+    search_from = std::min(search_from, std::max(i, j));
+}
+
+bool PCMGraph::connected(int i, int j) const {
+    return j / 64 < adj[i].size() && (adj[i][j / 64] >> (j % 64) & 1);
+}
+
+void PCMGraph::growClique(int v, std::vector<int> & clique) const {
+    //Greedy: repeatedly add the candidate with most neighbours among the remaining candidates.
+    //Candidates that cannot be in a clique larger than the current best are pruned by degree.
+    const int best = max_clique.size();
+    const int n_words = words();
+    std::vector<uint64_t> cand(n_words, 0);
+    int cand_num = 0;
+    for (int w = 0; w < adj[v].size(); w++) {
+        uint64_t bits = adj[v][w];
+        while (bits) {
+            int u = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (degrees[u] + 1 > best) {
+                cand[w] |= (uint64_t) 1 << (u % 64);
+                cand_num ++;
+            }
+        }
+    }
+    clique.assign(1, v);
+    while (cand_num > 0 && clique.size() + cand_num > best) {
+        int best_u = -1, best_cnt = -1;
+        for (int w = 0; w < n_words; w++) {
+            uint64_t bits = cand[w];
+            while (bits) {
+                int u = w * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                int cnt = 0;
+                for (int k = 0; k < adj[u].size(); k++) {
+                    cnt += popcount(adj[u][k] & cand[k]);
+                }
+                if (cnt > best_cnt) {
+                    best_cnt = cnt;
+                    best_u = u;
+                }
+            }
+        }
+        clique.push_back(best_u);
+        cand_num = 0;
+        for (int w = 0; w < n_words; w++) {
+            cand[w] &= w < adj[best_u].size() ? adj[best_u][w] : 0;
+            cand_num += popcount(cand[w]);
+        }
+    }
+}
+
+const std::vector<int> & PCMGraph::updateMaxClique(int first_new) {
+    std::vector<int> clique;
+    first_new = std::max(std::min(first_new, search_from), 0);
+    search_from = size();
+    for (int v = first_new; v < size(); v++) {
+        //A clique containing v has at most degree(v) + 1 vertices
+        if (degrees[v] + 1 <= max_clique.size()) {
+            continue;
+        }
+        growClique(v, clique);
+        if (clique.size() > max_clique.size()) {
+            max_clique = clique;
+        }
+    }
+    return max_clique;
+}
+
+void PCMGraph::toFMC(FMC::CGraphIO & gio) const {
+    gio.m_vi_Vertices.clear();
+    gio.m_vi_Edges.clear();
+    gio.m_vi_Vertices.push_back(0);
+    for (int i = 0; i < size(); i++) {
+        for (int w = 0; w < adj[i].size(); w++) {
+            uint64_t bits = adj[i][w];
+            while (bits) {
+                gio.m_vi_Edges.push_back(w * 64 + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+        }
+        gio.m_vi_Vertices.push_back(gio.m_vi_Edges.size());
+    }
+    gio.CalculateVertexDegrees();
+}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+namespace FMC {
+class CGraphIO;
+}
+
+namespace D2PGO {
+class PCMGraph {
+    //Pairwise consistency graph of the loops of one drone pair. Each adjacency row is a bitset,
+    //so a neighbourhood intersection costs one AND per 64 loops.
+    std::vector<std::vector<uint64_t>> adj;
+    std::vector<int> degrees;
+    std::vector<int> max_clique;
+    //Lowest vertex a clique changed since the last update may start from
+    int search_from = 0;
+    int words() const {
+        return (adj.size() + 63) / 64;
+    }
+    void growClique(int v, std::vector<int> & clique) const;
+public:
+    int size() const {
+        return adj.size();
+    }
+    int addVertex();
+    void addEdge(int i, int j);
+    bool connected(int i, int j) const;
+    int degree(int i) const {
+        return degrees[i];
+    }
+    //A larger clique must contain a new vertex or a new edge, so only vertices from first_new
+    //(or from the newer end of an edge added between older vertices) are searched.
+    //The previous clique is kept otherwise.
+    const std::vector<int> & updateMaxClique(int first_new);
+    const std::vector<int> & maxClique() const {
+        return max_clique;
+    }
+    //CSR graph for the fast max-clique finder
+    void toFMC(FMC::CGraphIO & gio) const;
+};
+}
@@ -1,5 +1,6 @@
 #include "swarm_outlier_rejection.hpp"
 #include <fstream>
+#include <Eigen/Cholesky>
 #include <stdio.h>
 #include "fast_max-clique_finder/src/graphIO.h"
 #include "fast_max-clique_finder/src/findClique.h"
@@ -11,6 +12,7 @@ using D2Common::FrameIdType;
 
 
 #define PCM_DEBUG_OUTPUT
+#define PCM_ODOM_CACHE_SIZE 100000
 
 namespace D2PGO {
 std::fstream pcm_errors;
@@ -111,137 +113,153 @@ std::vector<Swarm::LoopEdge> SwarmLocalOutlierRejection::OutlierRejectionLoopEdg
     return good_loops;
 }
 
-void SwarmLocalOutlierRejection::OutlierRejectionLoopEdgesPCM(const std::vector<Swarm::LoopEdge > & new_loops, int id_a, int id_b) {
-    std::map<FrameIdType, int> bad_pair_count;
+const std::pair<Swarm::Pose, Matrix6d> & SwarmLocalOutlierRejection::relativeOdom(int drone_id, FrameIdType frame_a, FrameIdType frame_b) {
+    OdomKey key(drone_id, frame_a, frame_b);
+    auto it = odom_cache.find(key);
+    if (it != odom_cache.end()) {
+        return it->second;
+    }
+    if (odom_cache.size() > PCM_ODOM_CACHE_SIZE) {
+        odom_cache.clear();
+    }
+    return odom_cache[key] = ego_motion_trajs.at(drone_id).get_relative_pose_by_frame_id(frame_a, frame_b, param.is_4dof);
+}
 
+double SwarmLocalOutlierRejection::squaredMahalanobisDistance(const Eigen::Matrix<double, 6, 1> & logmap, const Matrix6d & cov) {
+    //r^T (L L^T)^-1 r = |L^-1 r|^2, a triangular solve instead of a full inversion
+    Eigen::LLT<Matrix6d> llt(cov);
+    if (llt.info() != Eigen::Success) {
+        return Swarm::computeSquaredMahalanobisDistance(logmap, cov);
+    }
+    return llt.matrixL().solve(logmap).squaredNorm();
+}
+
+void SwarmLocalOutlierRejection::OutlierRejectionLoopEdgesPCM(const std::vector<Swarm::LoopEdge > & new_loops, int id_a, int id_b) {
     auto & pcm_graph = loop_pcm_graph[id_a][id_b];
     auto & _all_loops = all_loops[id_a][id_b];
+    auto & _all_covs = all_loop_covs[id_a][id_b];
+    int first_new = pcm_graph.size();
 
     TicToc tic1;
 
-    for (size_t i = 0; i < new_loops.size(); i++) {
-        auto & edge1 = new_loops[i];
-        //Now only process inter-edges
-        while (pcm_graph.size() < _all_loops.size() + 1) {
-            pcm_graph.emplace_back(std::vector<int>(0));
-        }
-
-        auto p_edge1 = edge1.relative_pose;
-        Matrix6d _cov_mat_1 = edge1.getCovariance();
+    //Covariance of each loop is computed once when it is added
+    for (auto & edge : new_loops) {
+        pcm_graph.addVertex();
+        _all_loops.push_back(edge);
+        _all_covs.push_back(edge.getCovariance());
+    }
 
-        for (size_t j = 0; j < _all_loops.size(); j++) {
+    //Each new loop is checked against all loops before it. The odometry lookups touch the
+    //trajectories and the cache, so they are done here; the pairs are then evaluated in parallel.
+    std::vector<PCMPair> pairs;
+    for (int i = first_new; i < _all_loops.size(); i++) {
+        auto & edge1 = _all_loops[i];
+        for (int j = 0; j < i; j++) {
             auto & edge2 = _all_loops[j];
-            auto _cov_mat_2 = edge2.getCovariance();;
-            Matrix6d _covariance = _cov_mat_1 + _cov_mat_2;
-
             int same_robot_pair = edge2.same_robot_pair(edge1);
-            if (same_robot_pair > 0) {
-                //Now we can compute the consistency error.
-                std::pair<Swarm::Pose, Matrix6d> odom_a, odom_b;
-                Swarm::Pose p_edge2;
-                double traj_a = 0, traj_b = 0;
-
-                if (same_robot_pair == 1) {
-                    p_edge2 = edge2.relative_pose;
-                    //ODOM is tsa->tsb
-                    odom_a = ego_motion_trajs.at(edge1.id_a).get_relative_pose_by_frame_id(edge1.keyframe_id_a, edge2.keyframe_id_a, param.is_4dof);
-                    odom_b = ego_motion_trajs.at(edge1.id_b).get_relative_pose_by_frame_id(edge1.keyframe_id_b, edge2.keyframe_id_b, param.is_4dof);
-                    if (param.debug_write_debug) {
-                        traj_a = ego_motion_trajs.at(edge1.id_a).trajectory_length_by_ts(edge1.ts_a, edge2.ts_a);
-                        traj_b = ego_motion_trajs.at(edge1.id_b).trajectory_length_by_ts(edge1.ts_b, edge2.ts_b);
-                    }
-
-                    _covariance += odom_a.second + odom_b.second;
-
-                }  else if (same_robot_pair == 2) {
-                    p_edge2 = edge2.relative_pose.inverse();
-                    odom_a = ego_motion_trajs.at(edge1.id_a).get_relative_pose_by_frame_id(edge1.keyframe_id_a, edge2.keyframe_id_b, param.is_4dof);
-                    odom_b = ego_motion_trajs.at(edge1.id_b).get_relative_pose_by_frame_id(edge1.keyframe_id_b, edge2.keyframe_id_a, param.is_4dof);
-                    
-                    if (param.debug_write_debug) {
-                        traj_a = ego_motion_trajs.at(edge1.id_a).trajectory_length_by_ts(edge1.ts_a, edge2.ts_b);
-                        traj_b = ego_motion_trajs.at(edge1.id_b).trajectory_length_by_ts(edge1.ts_b, edge2.ts_a);
-                    }
-
-                    _covariance += odom_a.second + odom_b.second;
-                }
-
-                Swarm::Pose err_pose = odom_a.first*p_edge2*odom_b.first.inverse()*p_edge1.inverse();
-                auto logmap = err_pose.log_map();
-                double smd = Swarm::computeSquaredMahalanobisDistance(logmap, _covariance);
+            if (same_robot_pair <= 0) {
+                continue;
+            }
+            PCMPair pair;
+            pair.i = i;
+            pair.j = j;
+            pair.same_robot_pair = same_robot_pair;
+            if (same_robot_pair == 1) {
+                //ODOM is tsa->tsb
+                pair.odom_a = relativeOdom(edge1.id_a, edge1.keyframe_id_a, edge2.keyframe_id_a);
+                pair.odom_b = relativeOdom(edge1.id_b, edge1.keyframe_id_b, edge2.keyframe_id_b);
+            } else {
+                pair.odom_a = relativeOdom(edge1.id_a, edge1.keyframe_id_a, edge2.keyframe_id_b);
+                pair.odom_b = relativeOdom(edge1.id_b, edge1.keyframe_id_b, edge2.keyframe_id_a);
+            }
+            pairs.emplace_back(pair);
+        }
+    }
 
-                if (smd < param.pcm_thres) {
-                    //Add edge i to j
-                    pcm_graph[_all_loops.size()].push_back(j);
-                    pcm_graph[j].push_back(_all_loops.size());
-                }
+#pragma omp parallel for num_threads(param.pcm_threads) schedule(dynamic, 64)
+    for (int k = 0; k < pairs.size(); k++) {
+        auto & pair = pairs[k];
+        auto & edge1 = _all_loops[pair.i];
+        auto & edge2 = _all_loops[pair.j];
+        Swarm::Pose p_edge2 = pair.same_robot_pair == 1 ? edge2.relative_pose : edge2.relative_pose.inverse();
+        pair.covariance = _all_covs[pair.i] + _all_covs[pair.j] + pair.odom_a.second + pair.odom_b.second;
+        pair.err_pose = pair.odom_a.first*p_edge2*pair.odom_b.first.inverse()*edge1.relative_pose.inverse();
+        pair.logmap = pair.err_pose.log_map();
+        pair.smd = squaredMahalanobisDistance(pair.logmap, pair.covariance);
+    }
 
-                if (param.debug_write_debug) {
-                    fprintf(f_logs, "\n");
-                    fprintf(f_logs, "EdgePair %ld->%ld\n", edge1.id, edge2.id);
-                    fprintf(f_logs, "Edge1 %ld->%ld DOF %d Pose %s cov_1 [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", 
-                        edge1.keyframe_id_a, edge1.keyframe_id_b, edge1.res_count, edge1.relative_pose.toStr().c_str(),
-                        _cov_mat_1(0, 0), _cov_mat_1(1, 1), _cov_mat_1(2, 2), _cov_mat_1(3, 3), _cov_mat_1(4, 4), _cov_mat_1(5, 5));
-                    fprintf(f_logs, "Edge2 %ld->%ld DOF %d Pose %s cov_2 [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", 
-                        edge2.keyframe_id_a, edge2.keyframe_id_b, edge2.res_count, edge2.relative_pose.toStr().c_str(),
-                        _cov_mat_2(0, 0), _cov_mat_2(1, 1), _cov_mat_2(2, 2), _cov_mat_2(3, 3), _cov_mat_2(4, 4), _cov_mat_2(5, 5));
-                        
-                    auto cov = odom_a.second;
-                    fprintf(f_logs, "odom_a %s traj len %.2f cov (T, Q) [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", odom_a.first.toStr().c_str(), 
-                        traj_a, cov(0, 0), cov(1, 1), cov(2, 2), cov(3, 3), cov(4, 4), cov(5, 5));
-                    cov = odom_b.second;
-                    fprintf(f_logs, "odom_b %s traj len %.2f cov (T, Q) [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", odom_b.first.toStr().c_str(), 
-                        traj_b, cov(0, 0), cov(1, 1), cov(2, 2), cov(3, 3), cov(4, 4), cov(5, 5));
-                    fprintf(f_logs, "err_pose %s logmap [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", err_pose.toStr().c_str(), 
-                        logmap(0), logmap(1), logmap(2), logmap(3), logmap(4), logmap(5));
-                    fprintf(f_logs, "squaredMahalanobisDistance %f Same Direction %d _cov(T, Q)  [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", smd, same_robot_pair == 1,
-                        _covariance(0, 0), _covariance(1, 1), _covariance(2, 2), _covariance(3, 3), _covariance(4, 4), _covariance(5, 5));
-                }
-                
-                if (param.debug_write_pcm_errors) {
-                    pcm_errors << edge1.id << " " << edge2.id << " "  << smd << " " << std::endl;
-                }
+    //Merge in the serial order so the graph and the logs do not depend on the thread count
+    for (auto & pair : pairs) {
+        auto & edge1 = _all_loops[pair.i];
+        auto & edge2 = _all_loops[pair.j];
+        double smd = pair.smd;
+        if (smd < param.pcm_thres) {
+            //Add edge i to j
+            pcm_graph.addEdge(pair.i, pair.j);
+        }
 
+        if (param.debug_write_debug) {
+            auto & _cov_mat_1 = _all_covs[pair.i];
+            auto & _cov_mat_2 = _all_covs[pair.j];
+            auto & odom_a = pair.odom_a;
+            auto & odom_b = pair.odom_b;
+            auto & logmap = pair.logmap;
+            auto & _covariance = pair.covariance;
+            double traj_a = 0, traj_b = 0;
+            if (pair.same_robot_pair == 1) {
+                traj_a = ego_motion_trajs.at(edge1.id_a).trajectory_length_by_ts(edge1.ts_a, edge2.ts_a);
+                traj_b = ego_motion_trajs.at(edge1.id_b).trajectory_length_by_ts(edge1.ts_b, edge2.ts_b);
+            } else {
+                traj_a = ego_motion_trajs.at(edge1.id_a).trajectory_length_by_ts(edge1.ts_a, edge2.ts_b);
+                traj_b = ego_motion_trajs.at(edge1.id_b).trajectory_length_by_ts(edge1.ts_b, edge2.ts_a);
             }
+            fprintf(f_logs, "\n");
+            fprintf(f_logs, "EdgePair %ld->%ld\n", edge1.id, edge2.id);
+            fprintf(f_logs, "Edge1 %ld->%ld DOF %d Pose %s cov_1 [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", 
+                edge1.keyframe_id_a, edge1.keyframe_id_b, edge1.res_count, edge1.relative_pose.toStr().c_str(),
+                _cov_mat_1(0, 0), _cov_mat_1(1, 1), _cov_mat_1(2, 2), _cov_mat_1(3, 3), _cov_mat_1(4, 4), _cov_mat_1(5, 5));
+            fprintf(f_logs, "Edge2 %ld->%ld DOF %d Pose %s cov_2 [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", 
+                edge2.keyframe_id_a, edge2.keyframe_id_b, edge2.res_count, edge2.relative_pose.toStr().c_str(),
+                _cov_mat_2(0, 0), _cov_mat_2(1, 1), _cov_mat_2(2, 2), _cov_mat_2(3, 3), _cov_mat_2(4, 4), _cov_mat_2(5, 5));
+                
+            auto cov = odom_a.second;
+            fprintf(f_logs, "odom_a %s traj len %.2f cov (T, Q) [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", odom_a.first.toStr().c_str(), 
+                traj_a, cov(0, 0), cov(1, 1), cov(2, 2), cov(3, 3), cov(4, 4), cov(5, 5));
+            cov = odom_b.second;
+            fprintf(f_logs, "odom_b %s traj len %.2f cov (T, Q) [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", odom_b.first.toStr().c_str(), 
+                traj_b, cov(0, 0), cov(1, 1), cov(2, 2), cov(3, 3), cov(4, 4), cov(5, 5));
+            fprintf(f_logs, "err_pose %s logmap [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", pair.err_pose.toStr().c_str(), 
+                logmap(0), logmap(1), logmap(2), logmap(3), logmap(4), logmap(5));
+            fprintf(f_logs, "squaredMahalanobisDistance %f Same Direction %d _cov(T, Q)  [%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e,%+3.1e]\n", smd, pair.same_robot_pair == 1,
+                _covariance(0, 0), _covariance(1, 1), _covariance(2, 2), _covariance(3, 3), _covariance(4, 4), _covariance(5, 5));
+        }
+        
+        if (param.debug_write_pcm_errors) {
+            pcm_errors << edge1.id << " " << edge2.id << " "  << smd << " " << std::endl;
         }
-        _all_loops.push_back(edge1);
     }
 
     double compute_pcm_erros = tic1.toc();
     std::vector<int> max_clique_data;
-    FMC::CGraphIO pcm_graph_fmc;
-    pcm_graph_fmc.m_vi_Vertices.push_back(0);
-    for(size_t i=0;i < pcm_graph.size(); i++) {
-        pcm_graph_fmc.m_vi_Edges.insert(pcm_graph_fmc.m_vi_Edges.end(),pcm_graph[i].begin(),pcm_graph[i].end());
-        pcm_graph_fmc.m_vi_Vertices.push_back(pcm_graph_fmc.m_vi_Edges.size());
-    }
-    pcm_graph_fmc.CalculateVertexDegrees();
     if (param.incremental_pcm) {
         TicToc tic;
-        int prev_max_clique_size = good_loops_set[id_a][id_b].size();
-        int ret = FMC::maxCliqueHeuIncremental(pcm_graph_fmc, new_loops.size(), prev_max_clique_size, max_clique_data);
-        if (ret > 0 && max_clique_data.size() > 0) {
-            good_loops_set[id_a][id_b].clear();
-            good_loops_set[id_b][id_a].clear();
-            for (auto i : max_clique_data) {
-                good_loops_set[id_a][id_b].insert(_all_loops[i].id);
-                good_loops_set[id_b][id_a].insert(_all_loops[i].id);
-            }
-        }
-        printf("[D2PGO](OutlierRejection) %d<->%d compute_pcm_errors %.1fms maxCliqueHeuInc takes %.1fms ret %d(%d) loops %ld good %ld\n", 
-            id_a, id_b, compute_pcm_erros, tic.toc(), ret, max_clique_data.size(), _all_loops.size(), good_loops_set[id_a][id_b].size());
+        //Only cliques through the new loops are searched
+        max_clique_data = pcm_graph.updateMaxClique(first_new);
+        printf("[D2PGO](OutlierRejection) %d<->%d compute_pcm_errors %.1fms incremental max clique takes %.1fms loops %ld good %ld\n", 
+            id_a, id_b, compute_pcm_erros, tic.toc(), _all_loops.size(), max_clique_data.size());
     } else {
         TicToc tic;
+        FMC::CGraphIO pcm_graph_fmc;
+        pcm_graph.toFMC(pcm_graph_fmc);
         FMC::maxCliqueHeu(pcm_graph_fmc, max_clique_data);
         printf("[D2PGO](OutlierRejection) %d<->%d compute_pcm_errors %.1fms maxCliqueHeu takes %.1fms loops %ld good %ld\n", 
             id_a, id_b, compute_pcm_erros, tic.toc(), _all_loops.size(), max_clique_data.size());
-        //In non-incremental mode, we need to clear the good_loops_set
-        good_loops_set[id_a][id_b].clear();
-        good_loops_set[id_b][id_a].clear();
-        for (auto i : max_clique_data) {
-            good_loops_set[id_a][id_b].insert(_all_loops[i].id);
-            good_loops_set[id_b][id_a].insert(_all_loops[i].id);
-        }
+    }
+    good_loops_set[id_a][id_b].clear();
+    good_loops_set[id_b][id_a].clear();
+    for (auto i : max_clique_data) {
+        good_loops_set[id_a][id_b].insert(_all_loops[i].id);
+        good_loops_set[id_b][id_a].insert(_all_loops[i].id);
     }
 }
 }
\ No newline at end of file
@@ -2,20 +2,43 @@
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <tuple>
 #include <swarm_msgs/drone_trajectory.hpp>
 #include <swarm_msgs/relative_measurments.hpp>
 #include "../d2pgo_config.h"
+#include "pcm_graph.hpp"
+#include <d2common/d2basetypes.h>
 
 namespace D2PGO {
 
-typedef std::vector<std::vector<int>> DisjointGraph;
 class SwarmLocalOutlierRejection {
+    typedef std::tuple<int, D2Common::FrameIdType, D2Common::FrameIdType> OdomKey;
     SwarmLocalOutlierRejectionParams param;
     std::map<int, Swarm::DroneTrajectory>  & ego_motion_trajs;
-    //Drone  ida           idb            index_det       linked dets
-    std::map<int, std::map<int, DisjointGraph>> loop_pcm_graph;
+    //Drone  ida           idb            consistency graph, vertices are indices of all_loops
+    std::map<int, std::map<int, PCMGraph>> loop_pcm_graph;
     std::map<int, std::map<int, std::vector<Swarm::LoopEdge>>> all_loops;
+    //Covariance of each loop in all_loops
+    std::map<int, std::map<int, std::vector<Eigen::Matrix6d>>> all_loop_covs;
     std::set<int64_t> all_loops_set;
+    //Ego-motion between keyframe pairs, shared by all loops that meet the same keyframes
+    std::map<OdomKey, std::pair<Swarm::Pose, Eigen::Matrix6d>> odom_cache;
+
+    //Consistency check of loop i against loop j of the same drone pair
+    struct PCMPair {
+        int i;
+        int j;
+        int same_robot_pair;
+        std::pair<Swarm::Pose, Eigen::Matrix6d> odom_a;
+        std::pair<Swarm::Pose, Eigen::Matrix6d> odom_b;
+        Eigen::Matrix6d covariance;
+        Swarm::Pose err_pose;
+        Eigen::Matrix<double, 6, 1> logmap;
+        double smd = 0;
+    };
+
+    static double squaredMahalanobisDistance(const Eigen::Matrix<double, 6, 1> & logmap, const Eigen::Matrix6d & cov);
+    const std::pair<Swarm::Pose, Eigen::Matrix6d> & relativeOdom(int drone_id, D2Common::FrameIdType frame_a, D2Common::FrameIdType frame_b);
 
     void OutlierRejectionLoopEdgesPCM(const std::vector<Swarm::LoopEdge > & inter_loops, int id_a, int id_b);
     std::vector<int64_t> good_loops();
@@ -0,0 +1,149 @@
+#include "../src/swarm_outlier_rejection/pcm_graph.hpp"
+#include "fast_max-clique_finder/src/graphIO.h"
+#include "fast_max-clique_finder/src/findClique.h"
+#include <algorithm>
+#include <set>
+#include <stdio.h>
+
+using namespace D2PGO;
+
+int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("[PCMGraphTest] %s:%d check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures ++; \
+    } \
+} while (0)
+
+//Adjacency lists as the outlier rejection kept them before PCMGraph
+typedef std::vector<std::vector<int>> AdjacencyList;
+
+void buildFMC(const AdjacencyList & graph, FMC::CGraphIO & gio) {
+    gio.m_vi_Vertices.push_back(0);
+    for (size_t i = 0; i < graph.size(); i++) {
+        gio.m_vi_Edges.insert(gio.m_vi_Edges.end(), graph[i].begin(), graph[i].end());
+        gio.m_vi_Vertices.push_back(gio.m_vi_Edges.size());
+    }
+    gio.CalculateVertexDegrees();
+}
+
+int exactMaxCliqueSize(const AdjacencyList & graph) {
+    FMC::CGraphIO gio;
+    buildFMC(graph, gio);
+    std::vector<int> clique;
+    return FMC::maxClique(gio, 0, clique);
+}
+
+bool isClique(const PCMGraph & graph, const std::vector<int> & clique) {
+    for (size_t a = 0; a < clique.size(); a++) {
+        for (size_t b = a + 1; b < clique.size(); b++) {
+            if (!graph.connected(clique[a], clique[b])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//Each batch adds loops and their consistent pairs with all earlier loops, as OutlierRejectionLoopEdgesPCM does.
+//The maximum clique {1, 3, 4, 7, 9} is completed by the third batch; {0, 2, 5, 6} is a smaller clique.
+struct Batch {
+    int vertex_num;
+    std::vector<std::pair<int, int>> edges;
+};
+
+const std::vector<Batch> fixture = {
+    {4, {{0, 2}, {1, 3}, {0, 1}}},
+    {4, {{4, 1}, {4, 3}, {5, 0}, {5, 2}, {6, 0}, {6, 2}, {6, 5}, {7, 1}, {7, 3}, {7, 4}, {6, 4}}},
+    {4, {{8, 0}, {8, 6}, {9, 1}, {9, 3}, {9, 4}, {9, 7}, {10, 8}, {11, 2}, {11, 10}}},
+    {2, {{12, 5}, {13, 12}, {13, 11}}},
+};
+
+void testEdges() {
+    PCMGraph graph;
+    for (int i = 0; i < 70; i++) {
+        CHECK(graph.addVertex() == i);
+    }
+    graph.addEdge(0, 69);
+    graph.addEdge(69, 0);
+    graph.addEdge(3, 3);
+    graph.addEdge(65, 66);
+    CHECK(graph.connected(0, 69) && graph.connected(69, 0));
+    CHECK(graph.connected(65, 66) && graph.connected(66, 65));
+    CHECK(!graph.connected(3, 3) && !graph.connected(0, 65));
+    CHECK(graph.degree(0) == 1 && graph.degree(69) == 1 && graph.degree(3) == 0);
+    //Rows of vertices added before the graph grew past 64 are extended on demand
+    CHECK(graph.addVertex() == 70);
+    graph.addEdge(1, 70);
+    CHECK(graph.connected(70, 1) && graph.degree(1) == 1);
+}
+
+void testMaxClique() {
+    PCMGraph graph;
+    AdjacencyList old_graph;
+    int old_inc_size = 0;
+    for (auto & batch : fixture) {
+        int first_new = graph.size();
+        for (int k = 0; k < batch.vertex_num; k++) {
+            graph.addVertex();
+            old_graph.emplace_back();
+        }
+        for (auto & edge : batch.edges) {
+            graph.addEdge(edge.first, edge.second);
+            old_graph[edge.first].push_back(edge.second);
+            old_graph[edge.second].push_back(edge.first);
+        }
+        auto clique = graph.updateMaxClique(first_new);
+        CHECK(isClique(graph, clique));
+
+        //Previous incremental path: heuristic through the new loops, previous size kept when none is larger.
+        //Its clique vector is the finder's scratch buffer, so only the returned size is compared.
+        FMC::CGraphIO gio_inc;
+        buildFMC(old_graph, gio_inc);
+        std::vector<int> old_inc;
+        old_inc_size = FMC::maxCliqueHeuIncremental(gio_inc, batch.vertex_num, old_inc_size, old_inc);
+        //Previous non-incremental path
+        FMC::CGraphIO gio;
+        buildFMC(old_graph, gio);
+        std::vector<int> old_full;
+        FMC::maxCliqueHeu(gio, old_full);
+
+        printf("[PCMGraphTest] loops %d clique %ld old incremental %d old heuristic %ld exact %d\n",
+            graph.size(), clique.size(), old_inc_size, old_full.size(), exactMaxCliqueSize(old_graph));
+        CHECK((int) clique.size() == old_inc_size);
+        CHECK(clique.size() == old_full.size());
+        CHECK((int) clique.size() == exactMaxCliqueSize(old_graph));
+    }
+    std::set<int> clique(graph.maxClique().begin(), graph.maxClique().end());
+    CHECK(clique == std::set<int>({1, 3, 4, 7, 9}));
+}
+
+void testEdgeBetweenOlderVertices() {
+    //{0, 1, 2} is the clique until the edge 2-3 completes {0, 1, 2, 3} without a new vertex
+    PCMGraph graph;
+    for (int i = 0; i < 4; i++) {
+        graph.addVertex();
+    }
+    graph.addEdge(0, 1);
+    graph.addEdge(0, 2);
+    graph.addEdge(1, 2);
+    graph.addEdge(0, 3);
+    graph.addEdge(1, 3);
+    CHECK(graph.updateMaxClique(0).size() == 3);
+    graph.addEdge(2, 3);
+    auto & clique = graph.updateMaxClique(graph.size());
+    CHECK(clique.size() == 4 && isClique(graph, clique));
+}
+
+int main(int argc, char ** argv) {
+    testEdges();
+    testMaxClique();
+    testEdgeBetweenOlderVertices();
+    if (failures > 0) {
+        printf("[PCMGraphTest] %d checks failed\n", failures);
+        return 1;
+    }
+    printf("[PCMGraphTest] All checks passed\n");
+    return 0;
+}
@@ -33,6 +33,8 @@ class D2VINSNode :  public D2FrontEnd::D2Frontend
     int frame_count = 0;
     std::queue<D2Common::VisualImageDescArray> viokf_queue;
     std::mutex queue_lock;
+    //Serializes popping and applying landmark deltas, so consumers receive them in version order
+    std::mutex landmark_delta_lock;
     ros::Timer estimator_timer, solver_timer;
     std::thread thread_comm, thread_solver, thread_viokf;
     bool has_received_imu = false;
@@ -79,16 +81,25 @@ protected:
     }
 
     void updateOutModuleSldWinAndLandmarkDB() {
-        //Frame related operations. Need to be protected by frame_mutex
-        const std::lock_guard<std::recursive_mutex> lock(estimator->frame_mutex);
-        auto sld_win = estimator->getSelfSldWin();
-        auto landmark_db = estimator->getLandmarkDB();
+        //Called from both the keyframe and the solver threads. A delta applied after a newer one would be dropped
+        //by the consumers, so the pop and the apply are one step under landmark_delta_lock (not the estimator lock).
+        Guard delta_guard(landmark_delta_lock);
+        LandmarkDeltaPtr landmark_delta;
+        {
+            //Frame related operations. Need to be protected by frame_mutex
+            const std::lock_guard<std::recursive_mutex> lock(estimator->frame_mutex);
+            auto sld_win = estimator->getSelfSldWin();
+            if (params->enable_loop) {
+                loop_detector->updatebySldWin(sld_win);
+            }
+            feature_tracker->updatebySldWin(sld_win);
+            landmark_delta = estimator->popLandmarkUpdates();
+        }
+        //The delta only holds the landmarks changed since the last keyframe and is immutable, so it is applied without the estimator lock
         if (params->enable_loop) {
-            loop_detector->updatebyLandmarkDB(estimator->getLandmarkDB());
-            loop_detector->updatebySldWin(sld_win);
+            loop_detector->updatebyLandmarkDelta(landmark_delta);
         }
-        feature_tracker->updatebySldWin(sld_win);
-        feature_tracker->updatebyLandmarkDB(estimator->getLandmarkDB());
+        feature_tracker->updatebyLandmarkDelta(landmark_delta);
     }
 
     void processVIOKFThread() {
@@ -238,6 +249,23 @@ public:
     D2VINSNode(ros::NodeHandle & nh) {
         Init(nh);
     }
+
+    ~D2VINSNode() {
+        D2VINSNode::stop();
+    }
+
+    void stop() override {
+        //The estimator threads exit on ros shutdown; they feed the frontend modules, so join them first
+        for (auto th_est : {&thread_viokf, &thread_solver}) {
+            if (th_est->joinable()) {
+                th_est->join();
+            }
+        }
+        if (thread_comm.joinable()) {
+            thread_comm.detach();
+        }
+        D2Frontend::stop();
+    }
 };
 
 int main(int argc, char **argv)
@@ -251,6 +279,7 @@ int main(int argc, char **argv)
     ros::AsyncSpinner spinner(4);
     spinner.start();
     ros::waitForShutdown();
+    d2vins.stop();
     return 0;
 }
 
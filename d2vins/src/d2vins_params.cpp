@@ -122,6 +122,9 @@ void D2VINSConfig::init(const std::string & config_file) {
     ceres_options.trust_region_strategy_type = ceres::DOGLEG;
     ceres_options.max_solver_time_in_seconds = solver_time;
     ceres_options.max_num_iterations = fsSettings["max_num_iterations"];
+    if (!fsSettings["incremental_problem"].empty()) {
+        incremental_problem = (int) fsSettings["incremental_problem"];
+    }
 
     //Consenus Solver
     consensus_config = new ConsensusSolverConfig;
@@ -84,6 +84,7 @@ struct D2VINSConfig {
 
     //Solver
     ceres::Solver::Options ceres_options;
+    bool incremental_problem = false; //Keep residual blocks across solves instead of rebuilding the problem
     D2Common::ConsensusSolverConfig * consensus_config = nullptr;
     bool consensus_sync_to_start = true;
     int consensus_trigger_time_err_us = 50;
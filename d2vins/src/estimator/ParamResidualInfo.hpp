@@ -3,6 +3,7 @@
 #include <ceres/ceres.h>
 #include "../d2vins_params.hpp"
 #include <d2common/solver/BaseParamResInfo.hpp>
+#include <d2common/pool_allocator.hpp>
 #include "d2vinsstate.hpp"
 
 using namespace D2Common;
@@ -15,7 +16,7 @@ ParamInfo createLandmark(D2EstimatorState * state, int landmark_id, bool inv_dep
 ParamInfo createSpeedBias(D2EstimatorState * state, FrameIdType id);
 ParamInfo createTd(D2EstimatorState * state, int camera_id);
 
-class LandmarkTwoFrameOneCamResInfo : public ResidualInfo {
+class LandmarkTwoFrameOneCamResInfo : public ResidualInfo, public PoolAllocated<LandmarkTwoFrameOneCamResInfo> {
 public:
     FrameIdType frame_ida;
     FrameIdType frame_idb;
@@ -55,7 +56,7 @@ public:
     }
 };
 
-class LandmarkTwoFrameTwoCamResInfo : public ResidualInfo {
+class LandmarkTwoFrameTwoCamResInfo : public ResidualInfo, public PoolAllocated<LandmarkTwoFrameTwoCamResInfo> {
 public:
     FrameIdType frame_ida;
     FrameIdType frame_idb;
@@ -95,7 +96,7 @@ public:
     }
 };
 
-class LandmarkOneFrameTwoCamResInfo : public ResidualInfo {
+class LandmarkOneFrameTwoCamResInfo : public ResidualInfo, public PoolAllocated<LandmarkOneFrameTwoCamResInfo> {
 public:
     FrameIdType frame_ida;
     LandmarkIdType landmark_id;
@@ -155,7 +156,7 @@ public:
     }
 };
 
-class DepthResInfo : public ResidualInfo {
+class DepthResInfo : public ResidualInfo, public PoolAllocated<DepthResInfo> {
 public:
     FrameIdType base_frame_id;
     LandmarkIdType landmark_id;
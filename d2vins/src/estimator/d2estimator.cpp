@@ -20,6 +20,7 @@ namespace D2VINS {
 D2Estimator::D2Estimator(int drone_id):
     self_id(drone_id), state(drone_id) {
         sync_data_receiver = new SyncDataReceiver;
+        landmark_loss = new ceres::HuberLoss(1.0);
 }
 
 void D2Estimator::init(ros::NodeHandle & nh, D2VINSNet * net) {
@@ -42,7 +43,11 @@ void D2Estimator::init(ros::NodeHandle & nh, D2VINSNet * net) {
     if (params->estimation_mode == D2VINSConfig::DISTRIBUTED_CAMERA_CONSENUS) {
         solver = new D2VINSConsensusSolver(this, &state, sync_data_receiver, *params->consensus_config, solve_token);
     } else {
-        solver = new CeresSolver(&state, params->ceres_options);
+        solver = new CeresSolver(&state, params->ceres_options, params->incremental_problem);
+        if (params->incremental_problem) {
+            //The problem is never destroyed, so it must not own a parameterization created every solve
+            pose_local_param = new PoseLocalParameterization;
+        }
     }
 }
 
@@ -315,7 +320,24 @@ bool D2Estimator::inputImage(VisualImageDescArray & _frame) {
 
 void D2Estimator::setStateProperties() {
     ceres::Problem & problem = solver->getProblem();
-    auto pose_local_param = new PoseLocalParameterization;
+    bool incremental = pose_local_param != nullptr;
+    ceres::LocalParameterization * local_param = incremental ? pose_local_param : new PoseLocalParameterization;
+    bool local_param_used = false;
+    if (incremental) {
+        //Blocks kept from the last solve may still be set constant
+        std::vector<state_type*> param_blocks;
+        problem.GetParameterBlocks(&param_blocks);
+        for (auto pointer : param_blocks) {
+            problem.SetParameterBlockVariable(pointer);
+        }
+    }
+    auto setPoseParameterization = [&](state_type * pointer) {
+        //Kept blocks already have one, which cannot be replaced
+        if (problem.GetParameterization(pointer) == nullptr) {
+            problem.SetParameterization(pointer, local_param);
+            local_param_used = true;
+        }
+    };
     //set LocalParameterization
     for (auto & drone_id : state.availableDrones()) {
         if (state.size(drone_id) > 0) {
@@ -323,7 +345,7 @@ void D2Estimator::setStateProperties() {
                 auto frame_a = state.getFrame(drone_id, i);
                 auto pointer = state.getPoseState(frame_a.frame_id);
                 if (problem.HasParameterBlock(pointer)) {
-                    problem.SetParameterization(pointer, pose_local_param);
+                    setPoseParameterization(pointer);
                 }
             }
         }
@@ -339,7 +361,10 @@ void D2Estimator::setStateProperties() {
                 state.lastFrame().odom.vel().norm() < params->estimate_extrinsic_vel_thres) {
             problem.SetParameterBlockConstant(state.getExtrinsicState(cam_id));
         }
-        problem.SetParameterization(state.getExtrinsicState(cam_id), pose_local_param);
+        setPoseParameterization(state.getExtrinsicState(cam_id));
+    }
+    if (!incremental && !local_param_used) {
+        delete local_param;
     }
 
     for (auto lm_id: used_landmarks) {
@@ -483,11 +508,12 @@ void D2Estimator::solveinDistributedMode() {
     margined_landmarks = state.clearUselessFrames(); // clear in dist mode.
     resetMarginalizer();
     state.preSolve(imu_bufs);
-    solver->reset();
+    solver->beginUpdate();
 
     setupImuFactors();
     setupLandmarkFactors();
     setupPriorFactor();
+    solver->endUpdate();
     if (params->enable_perf_output) {
         printf("[D2VINS::solveDist: beforeSolve time cost %.1f ms\n", tic.toc());
     }
@@ -542,10 +568,11 @@ void D2Estimator::solveinDistributedMode() {
 void D2Estimator::solveNonDistrib() {
     resetMarginalizer();
     state.preSolve(imu_bufs);
-    solver->reset();
+    solver->beginUpdate();
     setupImuFactors();
     setupLandmarkFactors();
     setupPriorFactor();
+    solver->endUpdate();
     setStateProperties();
     SolverReport report = solver->solve();
     state.syncFromState(used_landmarks);
@@ -592,9 +619,16 @@ void D2Estimator::solveNonDistrib() {
 }
 
 void D2Estimator::addIMUFactor(FrameIdType frame_ida, FrameIdType frame_idb, IntegrationBase* pre_integrations) {
-    IMUFactor* imu_factor = new IMUFactor(pre_integrations);
-    auto info = ImuResInfo::create(imu_factor, frame_ida, frame_idb);
-    solver->addResidual(info);
+    ResidualKey key{ResidualType::IMUResidual, frame_ida, frame_idb, reinterpret_cast<intptr_t>(pre_integrations), 0, 0};
+    auto info = solver->keepResidual(key);
+    if (info != nullptr) {
+        //Bias may have changed since the last solve
+        static_cast<IMUFactor*>(info->cost_function)->updateSqrtInfo();
+    } else {
+        IMUFactor* imu_factor = new IMUFactor(pre_integrations);
+        info = ImuResInfo::create(imu_factor, frame_ida, frame_idb);
+        solver->addKeyedResidual(info, key);
+    }
     if (params->always_fixed_first_pose) {
         //At this time we fix the first pose and ignore the margin of this imu factor to achieve better numerical stability
         return;
@@ -641,7 +675,8 @@ void D2Estimator::setupImuFactors() {
 
 bool D2Estimator::hasCommonLandmarkMeasurments() {
     auto lms = state.availableLandmarkMeasurements(params->max_solve_cnt, params->max_solve_measurements);
-    for (auto lm : lms) {
+    for (auto lm_ptr : lms) {
+        auto & lm = *lm_ptr;
         if (lm.solver_id == -1 && lm.drone_id != self_id) {
             // This is a internal only remote landmark
             continue;
@@ -663,13 +698,14 @@ void D2Estimator::setupLandmarkFactors() {
     auto lms = state.availableLandmarkMeasurements(params->max_solve_cnt, params->max_solve_measurements);
     current_landmark_num = lms.size();
     current_measurement_num = 0;
-    auto loss_function = new ceres::HuberLoss(1.0);    
+    auto loss_function = landmark_loss;
     keyframe_measurements.clear();
     if (params->verbose) {
         printf("[D2VINS::setupLandmarkFactors] %d landmarks\n", lms.size());
     }
     //We first count keyframe_measurements
-    for (auto lm : lms) {
+    for (auto lm_ptr : lms) {
+        auto & lm = *lm_ptr;
         LandmarkPerFrame firstObs = lm.track[0];
         keyframe_measurements[firstObs.frame_id] ++;
         for (auto i = 1; i < lm.track.size(); i++) {
@@ -696,7 +732,8 @@ void D2Estimator::setupLandmarkFactors() {
         }
     }
 
-    for (auto lm : lms) {
+    for (auto lm_ptr : lms) {
+        auto & lm = *lm_ptr;
         auto lm_id = lm.landmark_id;
         LandmarkPerFrame firstObs = lm.track[0];
         if (ignore_frames.find(firstObs.frame_id) != ignore_frames.end()) {
@@ -708,10 +745,14 @@ void D2Estimator::setupLandmarkFactors() {
         if (firstObs.depth_mea && params->fuse_dep && 
                 firstObs.depth < params->max_depth_to_fuse &&
                 firstObs.depth > params->min_depth_to_fuse) {
-            auto f_dep = OneFrameDepth::Create(firstObs.depth);
-            auto info = DepthResInfo::create(f_dep, loss_function, firstObs.frame_id, lm_id);
+            ResidualKey key{ResidualType::DepthResidual, firstObs.frame_id, lm_id, 0, 0, 0};
+            auto info = solver->keepResidual(key);
+            if (info == nullptr) {
+                auto f_dep = OneFrameDepth::Create(firstObs.depth);
+                info = DepthResInfo::create(f_dep, loss_function, firstObs.frame_id, lm_id);
+                solver->addKeyedResidual(info, key);
+            }
             marginalizer->addResidualInfo(info);
-            solver->addResidual(info);
             used_landmarks.insert(lm_id);
         }
         current_measurement_num++;
@@ -720,8 +761,28 @@ void D2Estimator::setupLandmarkFactors() {
             if (ignore_frames.find(lm_per_frame.frame_id) != ignore_frames.end()) {
                 continue;
             }
+            if (lm_per_frame.camera_id == base_camera_id && firstObs.frame_id == lm_per_frame.frame_id) {
+                printf("\033[0;31m[ [D2VINS::setupLandmarkFactors] Warning: landmarkid %ld frame %ld<->%ld@%ld is the same camera id %d.\033[0m\n",
+                    lm_per_frame.landmark_id, firstObs.frame_id, lm_per_frame.frame_id, lm_id, base_camera_id);
+                continue;
+            }
+            ResidualKey key{ResidualType::NONE, firstObs.frame_id, lm_per_frame.frame_id, lm_id, firstObs.camera_id, lm_per_frame.camera_id};
+            if (lm_per_frame.camera_id == base_camera_id) {
+                key[0] = ResidualType::LandmarkTwoFrameOneCamResidual;
+            } else if (lm_per_frame.frame_id == firstObs.frame_id) {
+                key[0] = ResidualType::LandmarkOneFrameTwoCamResidual;
+            } else {
+                key[0] = ResidualType::LandmarkTwoFrameTwoCamResidual;
+            }
+            //Measurements of a kept residual do not change, so only new ones are created
+            ResidualInfo * info = solver->keepResidual(key);
+            if (info != nullptr) {
+                current_measurement_num++;
+                marginalizer->addResidualInfo(info);
+                used_landmarks.insert(lm_id);
+                continue;
+            }
             auto mea1 = lm_per_frame.measurement();
-            ResidualInfo * info = nullptr;
             if (lm_per_frame.camera_id == base_camera_id) {
                 ceres::CostFunction * f_td = nullptr;
                 bool enable_depth_mea = false;
@@ -735,11 +796,6 @@ void D2Estimator::setupLandmarkFactors() {
                     f_td = new ProjectionTwoFrameOneCamFactor(mea0, mea1, firstObs.velocity, lm_per_frame.velocity,
                         firstObs.cur_td, lm_per_frame.cur_td);
                 }
-                if (firstObs.frame_id == lm_per_frame.frame_id) {
-                    printf("\033[0;31m[ [D2VINS::setupLandmarkFactors] Warning: landmarkid %ld frame %ld<->%ld@%ld is the same camera id %d.\033[0m\n",
-                        lm_per_frame.landmark_id, firstObs.frame_id, lm_per_frame.frame_id, lm_id, base_camera_id);
-                    continue;
-                }
                 info = LandmarkTwoFrameOneCamResInfo::create(f_td, loss_function,
                     firstObs.frame_id, lm_per_frame.frame_id, lm_id, firstObs.camera_id, enable_depth_mea);
             } else {
@@ -757,13 +813,10 @@ void D2Estimator::setupLandmarkFactors() {
             }
             if (info != nullptr) {
                 current_measurement_num++;
-                solver->addResidual(info);
+                solver->addKeyedResidual(info, key);
                 marginalizer->addResidualInfo(info);
                 used_landmarks.insert(lm_id);
             }
-            if (params->estimation_mode != D2VINSConfig::DISTRIBUTED_CAMERA_CONSENUS) {
-                solver->getProblem().SetParameterLowerBound(state.getLandmarkState(lm_id), 0, params->min_inv_dep);
-            }
         }
     }
     if (params->verbose) {
@@ -771,10 +824,15 @@ void D2Estimator::setupLandmarkFactors() {
     }
 }
 
-const std::map<LandmarkIdType, LandmarkPerId> & D2Estimator::getLandmarkDB() const {
+const LandmarkDB & D2Estimator::getLandmarkDB() const {
     return state.getLandmarkDB();
 }
 
+LandmarkDeltaPtr D2Estimator::popLandmarkUpdates() {
+    const Guard lock(frame_mutex);
+    return state.popLandmarkUpdates();
+}
+
 const std::vector<VINSFrame*> & D2Estimator::getSelfSldWin() const {
     return state.getSldWin(self_id);
 }
@@ -782,9 +840,10 @@ const std::vector<VINSFrame*> & D2Estimator::getSelfSldWin() const {
 void D2Estimator::setupPriorFactor() {
     auto prior_factor = state.getPrior();
     if (prior_factor != nullptr) {
+        //The prior changes with every marginalization, so it always replaces the previous one
         auto pfactor = new PriorFactor(*prior_factor);
         auto info = PriorResInfo::create(pfactor);
-        solver->addResidual(info);
+        solver->addKeyedResidual(info, ResidualKey{ResidualType::PriorResidual, 0, 0, 0, 0, 0});
         marginalizer->addResidualInfo(info);
     }
 }
@@ -50,6 +50,8 @@ protected:
     bool updated = false;
     std::set<LandmarkIdType> used_landmarks;
     std::recursive_mutex imu_prop_lock;
+    ceres::LossFunction * landmark_loss = nullptr; //Shared by all landmark residuals, not owned by the problems
+    ceres::LocalParameterization * pose_local_param = nullptr; //Shared by the pose blocks of the persistent problem, incremental mode only
     
     //Internal functions
     bool tryinitFirstPose(VisualImageDescArray & frame);
@@ -93,7 +95,9 @@ public:
     void sendDistributedVinsData(DistributedVinsData data);
     void sendSyncSignal(SyncSignal data, int64_t token);
     bool readyForStart();
-    const std::map<LandmarkIdType, LandmarkPerId> & getLandmarkDB() const;
+    const LandmarkDB & getLandmarkDB() const;
+    //Landmarks changed since the previous call
+    LandmarkDeltaPtr popLandmarkUpdates();
     const std::vector<VINSFrame*> & getSelfSldWin() const;
     D2Visualization & getVisualizer();
     void setPGOPoses(const std::map<int, Swarm::Pose> & poses);
@@ -224,7 +224,7 @@ std::set<CamIdType> D2EstimatorState::getAvailableCameraIds() const {
     return ids;
 }
 
-std::vector<LandmarkPerId> D2EstimatorState::availableLandmarkMeasurements(int max_pts, int max_measurement) const {
+std::vector<const LandmarkPerId*> D2EstimatorState::availableLandmarkMeasurements(int max_pts, int max_measurement) const {
     std::set<FrameIdType> current_frames;
     for (auto &it : sld_wins) {
         for (auto &it2 : it.second) {
@@ -52,7 +52,7 @@ public:
     FrameIdType getLandmarkBaseFrame(LandmarkIdType landmark_id) const;
     Swarm::Pose getExtrinsic(CamIdType cam_id) const;
     std::set<CamIdType> getAvailableCameraIds() const;
-    std::vector<LandmarkPerId> availableLandmarkMeasurements(int max_pts, int max_measurement) const;
+    std::vector<const LandmarkPerId*> availableLandmarkMeasurements(int max_pts, int max_measurement) const;
     std::vector<LandmarkPerId> getInitializedLandmarks() const;
     LandmarkPerId & getLandmarkbyId(LandmarkIdType id);
     bool hasLandmark(LandmarkIdType id) const;
@@ -98,9 +98,12 @@ public:
     void setMarginalizer(Marginalizer * _marginalizer) {
         marginalizer = _marginalizer;
     }
-    const std::map<LandmarkIdType, LandmarkPerId> & getLandmarkDB() const {
+    const LandmarkDB & getLandmarkDB() const {
         return lmanager.getLandmarkDB();
     }
+    LandmarkDeltaPtr popLandmarkUpdates() {
+        return lmanager.popUpdates();
+    }
 
     void updateEgoMotion();
     void printLandmarkReport(FrameIdType frame_id) const;
@@ -1,6 +1,7 @@
 #include "landmark_manager.hpp"
 #include "d2vinsstate.hpp"
 #include "../d2vins_params.hpp"
+#include <queue>
 
 namespace D2VINS {
 
@@ -15,100 +16,108 @@ void D2LandmarkManager::addKeyframe(const VisualImageDescArray & images, double
                 continue;
             }
             lm.cur_td = td;
-            updateLandmark(lm);
-            if (landmark_state.find(lm.landmark_id) == landmark_state.end()) {
-                if (params->landmark_param == D2VINSConfig::LM_INV_DEP) {
-                    landmark_state[lm.landmark_id] = new state_type[INV_DEP_SIZE];
-                } else {
-                    landmark_state[lm.landmark_id] = new state_type[POS_SIZE];
-                }
+            if (landmark_db.count(lm.landmark_id) == 0) {
+                updated_landmarks.insert(lm.landmark_id);
             }
+            updateLandmark(lm);
+            landmarkStates().add(lm.landmark_id);
         }
     }
 }
 
-std::vector<LandmarkPerId> D2LandmarkManager::availableMeasurements(int max_pts, int max_solve_measurements, const std::set<FrameIdType> & current_frames) const {
-    std::map<FrameIdType, int> current_landmark_num;
-    std::map<FrameIdType, int> result_landmark_num;
-    std::map<FrameIdType, std::set<D2Common::LandmarkIdType>> current_assoicated_landmarks;
-    bool exit = false;
-    std::set<D2Common::LandmarkIdType> ret_ids_set;
-    std::vector<LandmarkPerId> ret_set;
+std::vector<const LandmarkPerId*> D2LandmarkManager::availableMeasurements(int max_pts, int max_solve_measurements, const std::set<FrameIdType> & current_frames) const {
+    //Greedy: repeatedly take the frame covered by fewest selected landmarks and add its best unselected landmark.
+    //Frames are kept in a min-heap of (coverage, frame_id), landmarks of each frame in a max-heap of scores.
+    //Both heaps invalidate lazily: stale coverage entries and already selected landmarks are skipped when popped.
+    typedef std::pair<int, FrameIdType> FrameEntry;
+    typedef std::pair<double, LandmarkIdType> LandmarkEntry;
+    auto landmark_cmp = [](const LandmarkEntry & a, const LandmarkEntry & b) {
+        //Highest score first, lowest id on ties
+        return a.first < b.first || (a.first == b.first && a.second > b.second);
+    };
+    typedef std::priority_queue<LandmarkEntry, std::vector<LandmarkEntry>, decltype(landmark_cmp)> LandmarkHeap;
+    std::priority_queue<FrameEntry, std::vector<FrameEntry>, std::greater<FrameEntry>> frame_heap;
+    std::map<FrameIdType, int> coverage;
+    std::map<FrameIdType, LandmarkHeap> frame_candidates;
+    std::set<FrameIdType> exhausted_frames;
+    std::set<LandmarkIdType> ret_ids_set;
+    std::vector<const LandmarkPerId*> ret_set;
     for (auto frame_id : current_frames) {
-        current_landmark_num[frame_id] = 0;
-        result_landmark_num[frame_id] = 0;
+        coverage[frame_id] = 0;
+        frame_heap.emplace(0, frame_id);
     }
     int count_measurements = 0;
     if (max_solve_measurements <= 0) {
         max_solve_measurements = 1000000;
     }
-    while (!exit) {
-        //found the frame with minimum landmarks in current frames
-        if (current_landmark_num.size() == 0) {
-            exit = true;
-        }
-        auto it = min_element(current_landmark_num.begin(), current_landmark_num.end(),
-            [](decltype(current_landmark_num)::value_type& l, decltype(current_landmark_num)::value_type& r) -> 
-                bool { return l.second < r.second; });
-        auto frame_id = it->first;
-        //Add the a landmark in its related landmarks with highest score
-        if (related_landmarks.find(frame_id) == related_landmarks.end()) {
-            //Remove the frame from current_landmark_num
-            current_landmark_num.erase(frame_id);
+    while (!frame_heap.empty() && ret_set.size() < max_pts && count_measurements < max_solve_measurements) {
+        auto frame_id = frame_heap.top().second;
+        int frame_coverage = frame_heap.top().first;
+        frame_heap.pop();
+        if (exhausted_frames.count(frame_id) > 0 || coverage.at(frame_id) != frame_coverage) {
             continue;
         }
-        auto frame_related_landmarks = related_landmarks.at(frame_id);
-        //Find the landmark with highest score
-        LandmarkIdType lm_best;
-        double score_best = -10000;
-        bool found = false;
-        for (auto & itre : frame_related_landmarks) {
-            LandmarkIdType lm_id = itre.first;
-            if (landmark_db.find(lm_id) == landmark_db.end() || ret_ids_set.find(lm_id) != ret_ids_set.end()) {
-                //The landmark is not in the database or has been added
-                continue;
-            }
-            auto & lm = landmark_db.at(lm_id);
-            if (lm.track.size() >= params->landmark_estimate_tracks && 
-                lm.flag >= LandmarkFlag::INITIALIZED) {
-                if (lm.scoreForSolve(params->self_id) > score_best) {
-                    score_best = lm.scoreForSolve(params->self_id);
-                    lm_best = lm_id;
-                    found = true;
+        auto it_heap = frame_candidates.find(frame_id);
+        if (it_heap == frame_candidates.end()) {
+            //Scores do not change during selection, so the heap of a frame is built once when it is first visited
+            it_heap = frame_candidates.emplace(frame_id, LandmarkHeap(landmark_cmp)).first;
+            auto it_related = related_landmarks.find(frame_id);
+            if (it_related != related_landmarks.end()) {
+                for (auto & itre : it_related->second) {
+                    auto it_lm = landmark_db.find(itre.first);
+                    if (it_lm == landmark_db.end()) {
+                        continue;
+                    }
+                    auto & lm = it_lm->second;
+                    if (lm.track.size() >= params->landmark_estimate_tracks && lm.flag >= LandmarkFlag::INITIALIZED) {
+                        it_heap->second.emplace(lm.scoreForSolve(params->self_id), itre.first);
+                    }
                 }
             }
         }
-        if (found) {
-            auto & lm = landmark_db.at(lm_best);
-            ret_set.emplace_back(lm);
-            ret_ids_set.insert(lm_best);
-            count_measurements += lm.track.size();
-            //Add the frame to current_landmark_num
-            for (auto track: lm.track) {
-                auto frame_id = track.frame_id;
-                current_assoicated_landmarks[frame_id].insert(lm_best);
-                //We count the landmark numbers, but not the measurements
-                current_landmark_num[frame_id] = current_assoicated_landmarks[frame_id].size();
-                result_landmark_num[frame_id] = current_landmark_num[frame_id];
-            }
-            if (ret_set.size() >= max_pts || count_measurements >= max_solve_measurements) {
-                exit = true;
-            }
-        } else {
-            //Remove the frame from current_landmark_num
-            current_landmark_num.erase(frame_id);
+        auto & candidates = it_heap->second;
+        while (!candidates.empty() && ret_ids_set.count(candidates.top().second) > 0) {
+            candidates.pop();
+        }
+        if (candidates.empty()) {
+            //No landmark left, it would never be selected again
+            exhausted_frames.insert(frame_id);
+            continue;
+        }
+        auto lm_best = candidates.top().second;
+        candidates.pop();
+        auto & lm = landmark_db.at(lm_best);
+        ret_set.emplace_back(&lm);
+        ret_ids_set.insert(lm_best);
+        count_measurements += lm.track.size();
+        //We count the landmark numbers, but not the measurements
+        std::set<FrameIdType> track_frames;
+        for (auto & track: lm.track) {
+            track_frames.insert(track.frame_id);
+        }
+        for (auto track_frame : track_frames) {
+            int num = ++coverage[track_frame];
+            frame_heap.emplace(num, track_frame);
         }
     }
     if (params->verbose) {
         printf("[D2VINS::D2LandmarkManager] Found %ld(total %ld) landmarks measure %d/%d in %ld frames\n", ret_set.size(), landmark_db.size(), 
-                count_measurements, max_solve_measurements, result_landmark_num.size());
+                count_measurements, max_solve_measurements, coverage.size());
     }
     return ret_set;
 }
 
 double * D2LandmarkManager::getLandmarkState(LandmarkIdType landmark_id) const {
     const Guard lock(state_lock);
-    return landmark_state.at(landmark_id);
+    return landmarkStates().at(landmark_id);
+}
+
+LandmarkStateStore & D2LandmarkManager::landmarkStates() {
+    return params->landmark_param == D2VINSConfig::LM_INV_DEP ? inv_dep_state : pos_state;
+}
+
+const LandmarkStateStore & D2LandmarkManager::landmarkStates() const {
+    return params->landmark_param == D2VINSConfig::LM_INV_DEP ? inv_dep_state : pos_state;
 }
 
 
@@ -140,13 +149,13 @@ void D2LandmarkManager::initialLandmarkState(LandmarkPerId & lm, const D2Estimat
         pos = firstFrame.odom.pose()*ext*pos;
         lm.position = pos;
         if (params->landmark_param == D2VINSConfig::LM_INV_DEP) {
-            *landmark_state[lm_id] = 1/lm_first.depth;
+            *landmarkStates().at(lm_id) = 1/lm_first.depth;
             if (params->debug_print_states) {
                 printf("[D2VINS::D2LandmarkManager] Initialize landmark %ld by depth measurement position %.3f %.3f %.3f inv_dep %.3f\n",
                     lm_id, pos.x(), pos.y(), pos.z(), 1/lm_first.depth);
             }
         } else {
-            memcpy(landmark_state[lm_id], lm.position.data(), sizeof(state_type)*POS_SIZE);
+            memcpy(landmarkStates().at(lm_id), lm.position.data(), sizeof(state_type)*POS_SIZE);
         }
         lm.flag = LandmarkFlag::INITIALIZED;
     } else if (lm.track.size() >= params->landmark_estimate_tracks || lm.isMultiCamera()) {
@@ -177,14 +186,14 @@ void D2LandmarkManager::initialLandmarkState(LandmarkPerId & lm, const D2Estimat
                     auto inv_dep = 1/ptcam.norm();
                     if (inv_dep > params->min_inv_dep) {
                         lm.flag = LandmarkFlag::INITIALIZED;
-                        *landmark_state[lm_id] = inv_dep;
+                        *landmarkStates().at(lm_id) = inv_dep;
                         if (params->debug_print_states) {
                             printf("[D2VINS::D2LandmarkManager] Landmark %ld tracks %ld baseline %.2f by tri. P %.3f %.3f %.3f inv_dep %.3f err %.3f\n",
                                 lm_id, lm.track.size(), (_max - _min).norm(), point_3d.x(), point_3d.y(), point_3d.z(), inv_dep, tri_err);
                         }
                     } else {
                         lm.flag = LandmarkFlag::INITIALIZED;
-                        *landmark_state[lm_id] = params->min_inv_dep;
+                        *landmarkStates().at(lm_id) = params->min_inv_dep;
                         if (params->debug_print_states) {
                             printf("\033[0;31m [D2VINS::D2LandmarkManager] Initialize failed too far away: landmark %ld tracks %ld baseline %.2f by triangulation position %.3f %.3f %.3f inv_dep %.3f \033[0m\n",
                                 lm_id, lm.track.size(), (_max - _min).norm(), point_3d.x(), point_3d.y(), point_3d.z(), inv_dep);
@@ -202,7 +211,7 @@ void D2LandmarkManager::initialLandmarkState(LandmarkPerId & lm, const D2Estimat
                     // }
                 } else {
                     lm.flag = LandmarkFlag::INITIALIZED;
-                    memcpy(landmark_state[lm_id], lm.position.data(), sizeof(state_type)*POS_SIZE);
+                    memcpy(landmarkStates().at(lm_id), lm.position.data(), sizeof(state_type)*POS_SIZE);
                 }
                 // Some debug code
             } else {
@@ -218,6 +227,9 @@ void D2LandmarkManager::initialLandmarkState(LandmarkPerId & lm, const D2Estimat
             }
         }
     }
+    if (lm.flag == LandmarkFlag::INITIALIZED) {
+        updated_landmarks.insert(lm_id);
+    }
 }
 
 void D2LandmarkManager::initialLandmarks(const D2EstimatorState * state) {
@@ -243,9 +255,9 @@ void D2LandmarkManager::initialLandmarks(const D2EstimatorState * state) {
                 auto firstFrame = state->getFramebyId(lm_per_frame.frame_id);
                 auto ext = state->getExtrinsic(lm_per_frame.camera_id);
                 Vector3d pos_cam = (firstFrame->odom.pose()*ext).inverse()*lm.position;
-                *landmark_state[lm_id] = 1.0/pos_cam.norm();
+                *landmarkStates().at(lm_id) = 1.0/pos_cam.norm();
             } else {
-                memcpy(landmark_state[lm_id], lm.position.data(), sizeof(state_type)*POS_SIZE);
+                memcpy(landmarkStates().at(lm_id), lm.position.data(), sizeof(state_type)*POS_SIZE);
             }
         }
     }
@@ -282,7 +294,7 @@ void D2LandmarkManager::outlierRejection(const D2EstimatorState * state, const s
                 if (reproj_error.norm() * params->focal_length > params->landmark_outlier_threshold) {
                     count_err_track += 1;
                     // printf("[outlierRejection] remove outlier track LM %d frame %ld inv_dep/dep %.2f/%.2f reproj_err %.2f/%.2f\n",
-                    //         lm_id, it->frame_id, *landmark_state[lm_id], 1./(*landmark_state[lm_id]), reproj_error.norm() * params->focal_length, 
+                    //         lm_id, it->frame_id, *landmarkStates().at(lm_id), 1./(*landmarkStates().at(lm_id)), reproj_error.norm() * params->focal_length, 
                     //         params->landmark_outlier_threshold);
                     // //Remove the track
                     // it = lm.track.erase(it);
@@ -299,9 +311,10 @@ void D2LandmarkManager::outlierRejection(const D2EstimatorState * state, const s
                 if (reproj_err*params->focal_length > params->landmark_outlier_threshold) {
                     remove_count ++;
                     lm.flag = LandmarkFlag::OUTLIER;
+                    updated_landmarks.insert(lm_id);
                     if (params->verbose) {
                         printf("[outlierRejection] remove LM %d inv_dep/dep %.2f/%.2f pos %.2f %.2f %.2f reproj_error %.2f\n",
-                            lm_id, *landmark_state[lm_id], 1./(*landmark_state[lm_id]), lm.position.x(), lm.position.y(), lm.position.z(), reproj_err*params->focal_length);
+                            lm_id, *landmarkStates().at(lm_id), 1./(*landmarkStates().at(lm_id)), lm.position.x(), lm.position.y(), lm.position.z(), reproj_err*params->focal_length);
                     }
                 }
             }
@@ -314,7 +327,7 @@ void D2LandmarkManager::syncState(const D2EstimatorState * state) {
     const Guard lock(state_lock);
     //Sync inverse depth to 3D positions
     estimated_landmark_size = 0;
-    for (auto it : landmark_state) {
+    for (auto it : landmarkStates().states()) {
         auto lm_id = it.first;
         auto & lm = landmark_db.at(lm_id);
         if (lm.solver_flag == LandmarkSolverFlag::SOLVED) {
@@ -348,13 +361,30 @@ void D2LandmarkManager::syncState(const D2EstimatorState * state) {
                 lm.flag = LandmarkFlag::ESTIMATED;
             }
             estimated_landmark_size ++;
+            updated_landmarks.insert(lm_id);
         }
     }
 }
 
 void D2LandmarkManager::removeLandmark(const LandmarkIdType & id) {
     landmark_db.erase(id);
-    landmark_state.erase(id);
+    landmarkStates().remove(id);
+    updated_landmarks.erase(id);
+}
+
+LandmarkDeltaPtr D2LandmarkManager::popUpdates() {
+    const Guard lock(state_lock);
+    auto delta = std::make_shared<LandmarkDelta>();
+    delta->version = ++landmark_version;
+    delta->updates.reserve(updated_landmarks.size());
+    for (auto lm_id : updated_landmarks) {
+        auto it = landmark_db.find(lm_id);
+        if (it != landmark_db.end()) {
+            delta->updates.emplace_back(it->second);
+        }
+    }
+    updated_landmarks.clear();
+    return delta;
 }
 
 double triangulatePoint3DPts(const std::vector<Swarm::Pose> poses, const std::vector<Vector3d> &points, Vector3d &point_3d) {
@@ -2,22 +2,32 @@
 
 #include <d2common/d2vinsframe.h>
 #include "d2frontend/d2landmark_manager.h"
+#include <unordered_set>
 
 namespace D2VINS {
 class D2EstimatorState;
 class D2LandmarkManager : public D2FrontEnd::LandmarkManager {
-    std::map<LandmarkIdType, state_type*> landmark_state;
+    //Dense state blocks of the landmarks, used as Ceres parameter blocks
+    LandmarkStateStore inv_dep_state{INV_DEP_SIZE};
+    LandmarkStateStore pos_state{POS_SIZE};
+    LandmarkStateStore & landmarkStates();
+    const LandmarkStateStore & landmarkStates() const;
     int estimated_landmark_size = 0;
+    //Landmarks whose position or flag changed since the last published delta
+    std::unordered_set<LandmarkIdType> updated_landmarks;
+    uint64_t landmark_version = 0;
     void initialLandmarkState(LandmarkPerId & lm, const D2EstimatorState * state);
 public:
     virtual void addKeyframe(const VisualImageDescArray & images, double td);
-    std::vector<LandmarkPerId> availableMeasurements(int max_pts, int max_solve_measurements, const std::set<FrameIdType> & current_frames) const;
+    //Returned pointers are into the landmark database and valid until landmarks are removed
+    std::vector<const LandmarkPerId*> availableMeasurements(int max_pts, int max_solve_measurements, const std::set<FrameIdType> & current_frames) const;
     double * getLandmarkState(LandmarkIdType landmark_id) const;
     void initialLandmarks(const D2EstimatorState * state);
     void syncState(const D2EstimatorState * state);
     void outlierRejection(const D2EstimatorState * state, const std::set<LandmarkIdType> & used_landmarks);
     void moveByPose(const Swarm::Pose & delta_pose);
     virtual void removeLandmark(const LandmarkIdType & id) override;
+    LandmarkDeltaPtr popUpdates();
 };
 
 }
\ No newline at end of file
@@ -3,26 +3,29 @@
 #include <ros/assert.h>
 #include <ceres/ceres.h>
 #include <Eigen/Dense>
+#include <d2common/pool_allocator.hpp>
 #include "../d2vins_params.hpp"
 
 namespace D2VINS {
-class OneFrameDepth {
+class OneFrameDepth : public ceres::SizedCostFunction<1, 1>, public D2Common::PoolAllocated<OneFrameDepth> {
   public:
     OneFrameDepth(double depth):
         _inv_dep(1/depth) {
         sqrt_inf = params->depth_sqrt_inf;
     }
-    template<typename T>
-    bool operator()(const T* const x, T *_residual) const {
-        _residual[0] = (x[0] - _inv_dep)*sqrt_inf;
+    //Linear in the inverse depth, so the jacobian is analytic and the factor can come from the pool
+    virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const {
+        residuals[0] = (parameters[0][0] - _inv_dep)*sqrt_inf;
+        if (jacobians != nullptr && jacobians[0] != nullptr) {
+            jacobians[0][0] = sqrt_inf;
+        }
         return true;
     }
     double _inv_dep;
     double sqrt_inf = 10.0;
 
     static ceres::CostFunction * Create(double depth) {
-        return (new ceres::AutoDiffCostFunction<OneFrameDepth, 1, 1>(
-            new OneFrameDepth(depth)));
+        return new OneFrameDepth(depth);
     }
 };
 }
\ No newline at end of file
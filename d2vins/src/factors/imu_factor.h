@@ -26,11 +26,17 @@ class IMUFactor : public ceres::SizedCostFunction<15, 7, 9, 7, 9>
     IMUFactor() = delete;
     IMUFactor(IntegrationBase* _pre_integration):pre_integration(_pre_integration)
     {
-        sqrt_info = Eigen::LLT<Eigen::Matrix<double, 15, 15>>(pre_integration->covariance.inverse()).matrixL().transpose();
+        updateSqrtInfo();
         // std::cout << "intergation sum_dt" << pre_integration->sum_dt << "cov\n" << pre_integration->covariance.block<3, 3>(O_BA, O_BA) << std::endl << 
         //     "sqrt_info OBA\n" << sqrt_info.block<3, 3>(O_BA, O_BA) << std::endl;
     }
 
+    //Must be called when a factor is reused after the pre-integration is repropagated
+    void updateSqrtInfo()
+    {
+        sqrt_info = Eigen::LLT<Eigen::Matrix<double, 15, 15>>(pre_integration->covariance.inverse()).matrixL().transpose();
+    }
+
     void testEvaluate(std::vector<double*> param, double *residuals, double **jacobians)
     {
         check = true;
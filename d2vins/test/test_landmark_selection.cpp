@@ -0,0 +1,136 @@
+#include "../src/estimator/landmark_manager.hpp"
+#include "../src/d2vins_params.hpp"
+#include <stdio.h>
+
+using namespace D2VINS;
+
+int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("[LandmarkSelectionTest] %s:%d check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures ++; \
+    } \
+} while (0)
+
+//Selection as availableMeasurements did it before the heaps: rescan all frames for the least covered one,
+//then rescan its landmarks for the best score. Landmarks are visited in id order, so ties keep the lowest id.
+std::vector<LandmarkIdType> previousSelection(const D2LandmarkManager & manager, int max_pts, int max_solve_measurements,
+        const std::set<FrameIdType> & current_frames) {
+    auto & landmark_db = manager.getLandmarkDB();
+    std::map<FrameIdType, int> current_landmark_num;
+    std::map<FrameIdType, std::set<LandmarkIdType>> current_assoicated_landmarks;
+    std::set<LandmarkIdType> ret_ids_set;
+    std::vector<LandmarkIdType> ret;
+    for (auto frame_id : current_frames) {
+        current_landmark_num[frame_id] = 0;
+    }
+    int count_measurements = 0;
+    if (max_solve_measurements <= 0) {
+        max_solve_measurements = 1000000;
+    }
+    while (current_landmark_num.size() > 0) {
+        auto it = min_element(current_landmark_num.begin(), current_landmark_num.end(),
+            [](const std::pair<const FrameIdType, int> & l, const std::pair<const FrameIdType, int> & r) {
+                return l.second < r.second;
+            });
+        auto frame_id = it->first;
+        LandmarkIdType lm_best;
+        double score_best = -10000;
+        bool found = false;
+        for (auto lm_id : manager.getRelatedLandmarks(frame_id)) {
+            if (landmark_db.find(lm_id) == landmark_db.end() || ret_ids_set.find(lm_id) != ret_ids_set.end()) {
+                continue;
+            }
+            auto & lm = landmark_db.at(lm_id);
+            if (lm.track.size() >= params->landmark_estimate_tracks && lm.flag >= LandmarkFlag::INITIALIZED &&
+                    lm.scoreForSolve(params->self_id) > score_best) {
+                score_best = lm.scoreForSolve(params->self_id);
+                lm_best = lm_id;
+                found = true;
+            }
+        }
+        if (!found) {
+            current_landmark_num.erase(frame_id);
+            continue;
+        }
+        auto & lm = landmark_db.at(lm_best);
+        ret.emplace_back(lm_best);
+        ret_ids_set.insert(lm_best);
+        count_measurements += lm.track.size();
+        for (auto & track : lm.track) {
+            current_assoicated_landmarks[track.frame_id].insert(lm_best);
+            current_landmark_num[track.frame_id] = current_assoicated_landmarks[track.frame_id].size();
+        }
+        if (ret.size() >= max_pts || count_measurements >= max_solve_measurements) {
+            break;
+        }
+    }
+    return ret;
+}
+
+//Fixed landmark set: tracks over consecutive frames with mixed drones, solvers and flags, so scores tie often
+void buildLandmarks(D2LandmarkManager & manager, int frame_num, int landmark_num) {
+    uint32_t seed = 20221016;
+    auto next = [&seed](int n) {
+        seed = seed * 1664525u + 1013904223u;
+        return (int) ((seed >> 16) % n);
+    };
+    const LandmarkFlag flags[] = {UNINITIALIZED, INITIALIZED, ESTIMATED, ESTIMATED};
+    for (int i = 0; i < landmark_num; i++) {
+        LandmarkPerFrame lpf;
+        lpf.landmark_id = 1000 + i;
+        lpf.flag = flags[next(4)];
+        lpf.solver_id = next(4) == 0 ? 2 : -1;
+        int base = next(frame_num);
+        int len = 1 + next(6);
+        for (int k = 0; k < len && base + k < frame_num; k++) {
+            lpf.frame_id = 100 + base + k;
+            lpf.drone_id = next(3) == 0 ? 2 : 1;
+            manager.updateLandmark(lpf);
+            lpf.solver_id = -1;
+        }
+    }
+}
+
+void compare(const D2LandmarkManager & manager, int max_pts, int max_solve_measurements, const std::set<FrameIdType> & frames) {
+    auto expected = previousSelection(manager, max_pts, max_solve_measurements, frames);
+    auto selected = manager.availableMeasurements(max_pts, max_solve_measurements, frames);
+    std::vector<LandmarkIdType> selected_ids;
+    for (auto lm : selected) {
+        selected_ids.emplace_back(lm->landmark_id);
+    }
+    printf("[LandmarkSelectionTest] max_pts %d max_measurements %d frames %ld: selected %ld previous %ld\n",
+        max_pts, max_solve_measurements, frames.size(), selected_ids.size(), expected.size());
+    CHECK(selected_ids == expected);
+}
+
+int main(int argc, char ** argv) {
+    params = new D2VINSConfig;
+    params->self_id = 1;
+    params->landmark_estimate_tracks = 3;
+    params->verbose = false;
+
+    D2LandmarkManager manager;
+    buildLandmarks(manager, 12, 300);
+    std::set<FrameIdType> all_frames, last_frames, no_landmark_frames{500, 501};
+    for (int i = 0; i < 12; i++) {
+        all_frames.insert(100 + i);
+        if (i >= 8) {
+            last_frames.insert(100 + i);
+        }
+    }
+    compare(manager, 1000, -1, all_frames);
+    compare(manager, 40, -1, all_frames);
+    compare(manager, 1000, 120, all_frames);
+    compare(manager, 25, 200, last_frames);
+    compare(manager, 1000, -1, last_frames);
+    compare(manager, 1000, -1, no_landmark_frames);
+    compare(manager, 1000, -1, std::set<FrameIdType>());
+    if (failures > 0) {
+        printf("[LandmarkSelectionTest] %d checks failed\n", failures);
+        return 1;
+    }
+    printf("[LandmarkSelectionTest] All checks passed\n");
+    return 0;
+}
@@ -63,6 +63,22 @@ void QuadCamDepthEst::loadCNN(YAML::Node & config) {
         bool cnn_int8 = config["cnn_int8"].as<bool>();
         bool cnn_fp16 = config["cnn_fp16"].as<bool>();
         nh.param<std::string>("cnn_model_path", cnn_model_path, "");
+        auto & onnx_config = D2FrontEnd::onnxRuntimeConfig();
+        if (config["cnn_use_cuda"]) {
+            onnx_config.use_cuda = config["cnn_use_cuda"].as<bool>();
+        }
+        if (config["cnn_intra_op_threads"]) {
+            onnx_config.intra_op_threads = config["cnn_intra_op_threads"].as<int>();
+        }
+        if (config["cnn_inter_op_threads"]) {
+            onnx_config.inter_op_threads = config["cnn_inter_op_threads"].as<int>();
+        }
+        if (config["cnn_enable_mem_pattern"]) {
+            onnx_config.enable_mem_pattern = config["cnn_enable_mem_pattern"].as<bool>();
+        }
+        if (config["cnn_enable_cpu_mem_arena"]) {
+            onnx_config.enable_cpu_mem_arena = config["cnn_enable_cpu_mem_arena"].as<bool>();
+        }
         if (cnn_type == "hitnet") {
             hitnet = new HitnetONNX(cnn_model_path, width, height, cnn_use_tensorrt, cnn_fp16, cnn_int8);
             cnn_rgb = false;
@@ -192,6 +208,13 @@ void QuadCamDepthEst::loadCameraConfig(YAML::Node & config, std::string configPa
     if (config["photometric_calib_1"]) {
         photometric_inv_1 = readVingette(configPath + "/" + config["photometric_calib_1"].as<std::string>(), avg_brightness);
     }
+    bool undistort_use_cuda = true;
+    if (config["undistort_use_cuda"]) {
+        undistort_use_cuda = config["undistort_use_cuda"].as<bool>();
+    }
+    if (config["undistort_map_cache_dir"]) {
+        D2Common::FisheyeUndist::mapCacheDir() = config["undistort_map_cache_dir"].as<std::string>();
+    }
     std::string calib_file_path = config["calib_file_path"].as<std::string>();
     printf("[QuadCamDepthEst] Load camera config from %s\n", calib_file_path.c_str());
     calib_file_path = configPath + "/" + calib_file_path;
@@ -205,7 +228,7 @@ void QuadCamDepthEst::loadCameraConfig(YAML::Node & config, std::string configPa
         raw_cameras.emplace_back(ret.first);
         if (camera_config == CameraConfig::FOURCORNER_FISHEYE) {
             double fov = config["fov"].as<double>();
-            undistortors.push_back(new D2Common::FisheyeUndist(ret.first, 0, fov, true,
+            undistortors.push_back(new D2Common::FisheyeUndist(ret.first, 0, fov, undistort_use_cuda,
                 D2Common::FisheyeUndist::UndistortPinhole2, width, height, photometric_inv));
         }
         raw_cam_extrinsics.emplace_back(ret.second);
@@ -153,6 +153,9 @@ std::pair<cv::Mat, cv::Mat>VirtualStereo::estimateDisparityViaRaw(const cv::Mat
             return std::make_pair(disp, limg_rect);
         }
         if (left.channels() == 1) {
+            if (!undist_left->enable_cuda) {
+                return std::make_pair(disp, undist_left->undist_id(left_color, undist_id_l, false));
+            }
             cv::cuda::GpuMat lcolor_gpu;
             lcolor_gpu = undist_left->undist_id_cuda(left_color, undist_id_l, false);
             lcolor_gpu.convertTo(lcolor_gpu, CV_8UC3);
@@ -177,6 +180,10 @@ std::vector<cv::cuda::GpuMat> VirtualStereo::rectifyImage(const cv::Mat & left,
             cv::cuda::multiply(img_cuda_l, inv_vingette_l, img_cuda_l);
             cv::cuda::multiply(img_cuda_r, inv_vingette_r, img_cuda_r);
         }
+    } else if (!undist_left->enable_cuda) {
+        //Undistortion and vignette correction in one CPU pass
+        img_cuda_l.upload(undist_left->undist_id(left, undist_id_l, true));
+        img_cuda_r.upload(undist_right->undist_id(right, undist_id_r, true));
     } else {
         img_cuda_l = undist_left->undist_id_cuda(left, undist_id_l, true);
         img_cuda_r = undist_right->undist_id_cuda(right, undist_id_r, true);